@@ -0,0 +1,447 @@
+/* BankAudit.c
+ * Ledger audit tool
+ *
+ * Replays a bank log in parallel and checks that every record's balance
+ * follows from the previous balance of the same account and the record's
+ * amount. Optionally compares the recomputed balances with the live
+ * server through its balance snapshot.
+ *
+ * The log is split into chunks at line boundaries and each chunk is
+ * summarized per account by its own worker process. The parent then
+ * merges the summaries in log order, checking that each chunk picks up
+ * an account where the previous chunk left it.
+ *
+ * The server never logs a zero amount, so a "D 0 balance" line can only
+ * come from a shutdown dump. Such a line is a checkpoint: the account
+ * continues from the dumped balance, whatever the records before it
+ * added up to.
+ */
+#include "BankAudit.h"
+
+/* Smallest chunk worth a worker of its own */
+#define MIN_CHUNK_BYTES (256 * 1024)
+
+/* Merged results, indexed like mergeIds */
+static AccountStore mergeIds;
+static AuditAccount *auditAccounts = NULL;
+static int auditCapacity = 0;
+
+int main(int argc, char *argv[]) {
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *fifoName = NULL;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "j:f:")) != -1) {
+        switch (opt) {
+            case 'j':
+                jobs = atoi(optarg);
+                break;
+            case 'f':
+                fifoName = optarg;
+                break;
+            default:
+                argc = -1; /* Force the usage message */
+                break;
+        }
+    }
+    
+    if (argc - optind != 1 || jobs < 1) {
+        fprintf(stderr, "Usage: %s [-j jobs] [-f ServerFIFO_Name] LogFile\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (jobs > MAX_AUDIT_JOBS) {
+        jobs = MAX_AUDIT_JOBS;
+    }
+    
+    const char *logName = argv[optind];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    /* Map the whole log */
+    int fd = open(logName, O_RDONLY);
+    if (fd == -1) {
+        errExit("open %s", logName);
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        errExit("fstat %s", logName);
+    }
+    
+    size_t size = st.st_size;
+    const char *data = NULL;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            errExit("mmap %s", logName);
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    
+    /* Split into chunks that start at line boundaries */
+    int numChunks = size / MIN_CHUNK_BYTES + 1;
+    if (numChunks > jobs) {
+        numChunks = jobs;
+    }
+    
+    AuditChunk *chunks = mmap(NULL, numChunks * sizeof(AuditChunk), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (chunks == MAP_FAILED) {
+        errExit("mmap chunk table");
+    }
+    
+    size_t pos = 0;
+    for (int c = 0; c < numChunks; c++) {
+        size_t chunkEnd = c == numChunks - 1 ? size : size / numChunks * (c + 1);
+        if (chunkEnd < pos) {
+            chunkEnd = pos;
+        }
+        
+        /* Extend to the end of the line */
+        while (chunkEnd < size && data[chunkEnd - 1] != '\n') {
+            chunkEnd++;
+        }
+        
+        memset(&chunks[c], 0, sizeof(AuditChunk));
+        chunks[c].begin = pos;
+        chunks[c].end = chunkEnd;
+        pos = chunkEnd;
+    }
+    
+    /* Each worker writes its per-account summary to an unlinked temporary file */
+    FILE *results[MAX_AUDIT_JOBS];
+    pid_t workers[MAX_AUDIT_JOBS];
+    
+    fflush(NULL);
+    for (int c = 0; c < numChunks; c++) {
+        results[c] = tmpfile();
+        if (results[c] == NULL) {
+            errExit("tmpfile");
+        }
+        
+        workers[c] = numChunks > 1 ? fork() : -1;
+        if (workers[c] == 0) {
+            auditChunk(data, &chunks[c], results[c]);
+            _exit(EXIT_SUCCESS);
+        } else if (workers[c] == -1) {
+            /* Single chunk, or fork failed - do the work here */
+            auditChunk(data, &chunks[c], results[c]);
+        }
+    }
+    
+    for (int c = 0; c < numChunks; c++) {
+        if (workers[c] > 0) {
+            waitpid(workers[c], NULL, 0);
+        }
+    }
+    
+    /* Merge in log order */
+    if (storeInit(&mergeIds, 1024) == -1) {
+        errExit("storeInit");
+    }
+    
+    long lineBase = 0, records = 0, malformed = 0, firstMalformedLine = 0;
+    for (int c = 0; c < numChunks; c++) {
+        if (!chunks[c].done) {
+            fprintf(stderr, "Audit worker for chunk %d did not finish\n", c);
+            exit(EXIT_FAILURE);
+        }
+        
+        mergeChunk(&chunks[c], results[c], lineBase + 1);
+        fclose(results[c]);
+        
+        records += chunks[c].numRecords;
+        malformed += chunks[c].malformed;
+        if (firstMalformedLine == 0 && chunks[c].firstMalformedLine > 0) {
+            firstMalformedLine = lineBase + chunks[c].firstMalformedLine;
+        }
+        lineBase += chunks[c].lines;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = timespecDiffMs(&start, &end);
+    
+    printf("Audited %s: %ld records, %d accounts, %ld lines in %d chunks\n",
+           logName, records, mergeIds.numAccounts, lineBase, numChunks);
+    
+    if (malformed > 0) {
+        printf("%ld malformed lines (first at line %ld)\n", malformed, firstMalformedLine);
+    }
+    
+    int divergent = reportDivergentAccounts();
+    
+    if (fifoName != NULL) {
+        divergent += crossCheckLive(fifoName, data, size);
+    }
+    
+    printf("Audit: records=%ld accounts=%d divergent=%d malformed=%ld elapsed=%.2fms "
+           "records_per_sec=%.0f\n",
+           records, mergeIds.numAccounts, divergent, malformed, elapsed,
+           elapsed > 0 ? records * 1000.0 / elapsed : 0.0);
+    
+    if (data != NULL) {
+        munmap((void *)data, size);
+    }
+    munmap(chunks, numChunks * sizeof(AuditChunk));
+    storeFree(&mergeIds);
+    free(auditAccounts);
+    
+    return divergent > 0 || malformed > 0 ? AUDIT_DIVERGENT : EXIT_SUCCESS;
+}
+
+/* Summarize one chunk per account and write the summary to results */
+void auditChunk(const char *data, AuditChunk *chunk, FILE *results) {
+    AccountStore ids;
+    ChunkAccount *entries = NULL;
+    int capacity = 0;
+    
+    if (storeInit(&ids, 1024) == -1) {
+        errExit("storeInit");
+    }
+    
+    const char *p = data + chunk->begin;
+    const char *end = data + chunk->end;
+    long line = 0;
+    
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        const char *lineEnd = newline ? newline : end;
+        LogRecord rec;
+        
+        line++;
+        
+        if (parseLogRecord(p, lineEnd - p, &rec)) {
+            long long delta = rec.opType == 'D' ? rec.amount : -(long long)rec.amount;
+            int checkpoint = rec.opType == 'D' && rec.amount == 0;
+            int index = storeLookup(&ids, rec.accountId);
+            
+            if (index == -1) {
+                index = storeAdd(&ids, rec.accountId, 0);
+                if (index == -1) {
+                    errExit("storeAdd");
+                }
+                
+                if (index >= capacity) {
+                    capacity = capacity ? 2 * capacity : 1024;
+                    entries = realloc(entries, capacity * sizeof(ChunkAccount));
+                    if (entries == NULL) {
+                        errExit("realloc");
+                    }
+                }
+                
+                ChunkAccount *entry = &entries[index];
+                memset(entry, 0, sizeof(ChunkAccount));
+                entry->accountId = rec.accountId;
+                entry->firstPre = rec.balance - delta;
+                entry->firstLine = line;
+                entry->startsAtCheckpoint = checkpoint;
+            } else if (!checkpoint && rec.balance - delta != entries[index].lastPost) {
+                /* Balance does not follow from the previous record */
+                entries[index].badRecords++;
+                if (entries[index].firstBadLine == 0) {
+                    entries[index].firstBadLine = line;
+                }
+            }
+            
+            if (checkpoint) {
+                entries[index].net = rec.balance;
+                entries[index].fromCheckpoint = 1;
+            } else {
+                entries[index].net += delta;
+            }
+            entries[index].lastPost = rec.balance;
+            entries[index].records++;
+            chunk->numRecords++;
+        } else if (lineEnd > p && p[0] != '#' && p[0] != '\n') {
+            chunk->malformed++;
+            if (chunk->firstMalformedLine == 0) {
+                chunk->firstMalformedLine = line;
+            }
+        }
+        
+        p = lineEnd + 1;
+    }
+    
+    if (ids.numAccounts > 0 &&
+        fwrite(entries, sizeof(ChunkAccount), ids.numAccounts, results) != (size_t)ids.numAccounts) {
+        errExit("write audit results");
+    }
+    fflush(results);
+    
+    chunk->lines = line;
+    chunk->numAccounts = ids.numAccounts;
+    chunk->done = 1;
+    
+    free(entries);
+    storeFree(&ids);
+}
+
+/* Fold one chunk's summaries into the merged results.
+ * The first record of an account in this chunk must continue from the
+ * balance the account had at the end of the previous chunks (0 for an
+ * account seen for the first time), unless it is a checkpoint. */
+void mergeChunk(AuditChunk *chunk, FILE *results, long firstLine) {
+    ChunkAccount entry;
+    
+    rewind(results);
+    
+    for (long i = 0; i < chunk->numAccounts; i++) {
+        if (fread(&entry, sizeof(ChunkAccount), 1, results) != 1) {
+            errExit("read audit results");
+        }
+        
+        int index = storeLookup(&mergeIds, entry.accountId);
+        if (index == -1) {
+            index = storeAdd(&mergeIds, entry.accountId, 0);
+            if (index == -1) {
+                errExit("storeAdd");
+            }
+            
+            if (index >= auditCapacity) {
+                auditCapacity = auditCapacity ? 2 * auditCapacity : 1024;
+                auditAccounts = realloc(auditAccounts, auditCapacity * sizeof(AuditAccount));
+                if (auditAccounts == NULL) {
+                    errExit("realloc");
+                }
+            }
+            memset(&auditAccounts[index], 0, sizeof(AuditAccount));
+        }
+        
+        AuditAccount *account = &auditAccounts[index];
+        
+        if (!entry.startsAtCheckpoint && entry.firstPre != account->recorded) {
+            account->badRecords++;
+            if (account->firstBadLine == 0) {
+                account->firstBadLine = firstLine - 1 + entry.firstLine;
+            }
+        }
+        if (entry.badRecords > 0) {
+            account->badRecords += entry.badRecords;
+            if (account->firstBadLine == 0) {
+                account->firstBadLine = firstLine - 1 + entry.firstBadLine;
+            }
+        }
+        
+        account->recomputed = entry.fromCheckpoint ? entry.net : account->recomputed + entry.net;
+        account->recorded = entry.lastPost;
+        account->records += entry.records;
+    }
+}
+
+/* Print every account whose records do not add up. Returns their number. */
+int reportDivergentAccounts(void) {
+    int divergent = 0;
+    
+    for (int i = 0; i < mergeIds.numAccounts; i++) {
+        AuditAccount *account = &auditAccounts[i];
+        
+        if (account->badRecords == 0 && account->recomputed == account->recorded) {
+            continue;
+        }
+        
+        printf(BANK_ID_FORMAT " diverges: recomputed %lld credits, recorded %lld credits, "
+               "%ld of %ld records inconsistent (first at line %ld)\n",
+               mergeIds.ids[i], account->recomputed, account->recorded,
+               account->badRecords, account->records, account->firstBadLine);
+        divergent++;
+    }
+    
+    return divergent;
+}
+
+/* Whether any record line lies in data[from, to) */
+static int hasRecords(const char *data, size_t from, size_t to) {
+    while (from < to) {
+        const char *newline = memchr(data + from, '\n', to - from);
+        size_t length = newline != NULL ? (size_t)(newline - data) + 1 - from : to - from;
+        
+        LogRecord rec;
+        if (parseLogRecord(data + from, length, &rec)) {
+            return 1;
+        }
+        from += length;
+    }
+    return 0;
+}
+
+/* Compare the recomputed balances with the live server's balance snapshot.
+ * The snapshot says how far into the log its balances go; the comparison
+ * only means something if no record separates that point from the end of
+ * the audited log, so it is skipped otherwise. Returns the number of
+ * accounts that disagree. */
+int crossCheckLive(const char *fifoName, const char *data, size_t size) {
+    BalanceSnapshot *snap = openSnapshot(fifoName);
+    if (snap == NULL) {
+        fprintf(stderr, "No live snapshot for %s (is the server running?)\n", fifoName);
+        return 0;
+    }
+    
+    SnapshotEntry *live = malloc(MAX_BATCH_SIZE * sizeof(SnapshotEntry));
+    if (live == NULL) {
+        errExit("malloc");
+    }
+    
+    /* A server just behind the log is given a moment; one ahead of it has
+     * applied records the audit never saw */
+    SnapshotLogState state;
+    int numLive;
+    for (int attempt = 0; ; attempt++) {
+        numLive = snapshotReadAll(snap, live, MAX_BATCH_SIZE, &state);
+        if (state.logSize <= size && !hasRecords(data, state.logSize, size)) {
+            break;
+        }
+        
+        if (state.logSize > size || attempt == LIVE_RETRIES) {
+            printf("Live database is at log offset %llu, the audited log ends at %zu; "
+                   "not cross-checked (audit again once the server is idle)\n",
+                   (unsigned long long)state.logSize, size);
+            free(live);
+            closeSnapshot(snap);
+            return 0;
+        }
+        usleep(LIVE_RETRY_US);
+    }
+    
+    int divergent = 0, checked = 0;
+    
+    /* Every live account must match the log */
+    for (int i = 0; i < numLive; i++) {
+        int index = storeLookup(&mergeIds, live[i].accountId);
+        long long logBalance = index >= 0 ? auditAccounts[index].recomputed : 0;
+        long long liveBalance = live[i].active ? live[i].balance : 0;
+        
+        checked++;
+        if (logBalance != liveBalance) {
+            printf(BANK_ID_FORMAT " differs from live database: log %lld credits, live %lld credits\n",
+                   live[i].accountId, logBalance, liveBalance);
+            divergent++;
+        }
+    }
+    
+    /* Accounts the log says are open must exist in the live database,
+     * unless a lazily started server has not loaded them yet */
+    for (int i = 0; i < mergeIds.numAccounts && state.unloaded == 0; i++) {
+        int found = 0;
+        
+        for (int j = 0; j < numLive && !found; j++) {
+            found = live[j].accountId == mergeIds.ids[i];
+        }
+        
+        if (!found && auditAccounts[i].recomputed != 0) {
+            printf(BANK_ID_FORMAT " missing from live database: log %lld credits\n",
+                   mergeIds.ids[i], auditAccounts[i].recomputed);
+            divergent++;
+        }
+    }
+    
+    printf("Cross-checked %d live accounts against the log\n", checked);
+    if (state.unloaded > 0) {
+        printf("%d accounts not loaded by the live server yet; "
+               "open accounts missing from it were not reported\n", state.unloaded);
+    }
+    
+    free(live);
+    closeSnapshot(snap);
+    return divergent;
+}
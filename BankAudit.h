@@ -0,0 +1,75 @@
+/* BankAudit.h
+ * Header file for the ledger audit tool
+ */
+#ifndef BANK_AUDIT_H
+#define BANK_AUDIT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "bank_shared.h"
+#include "bank_utils.h"
+#include "bank_snapshot.h"
+#include "bank_store.h"
+
+/* Upper bound on parallel audit workers */
+#define MAX_AUDIT_JOBS 64
+
+/* Exit status when the audit found divergent accounts */
+#define AUDIT_DIVERGENT 2
+
+/* Snapshot reads while the live server catches up with the audited log */
+#define LIVE_RETRIES 20
+#define LIVE_RETRY_US 50000
+
+/* One account's records inside one chunk of the log */
+typedef struct {
+    int accountId;          /* Account number */
+    long long firstPre;     /* Balance before the chunk's first record, implied by that record */
+    long long lastPost;     /* Recorded balance after the chunk's last record */
+    long long net;          /* Sum of the chunk's deposits minus withdrawals */
+    long records;           /* Records of this account in the chunk */
+    long badRecords;        /* Records whose balance does not follow from the previous one */
+    long firstLine;         /* Line of the chunk's first record */
+    long firstBadLine;      /* Line of the first bad record, 0 if none */
+    int startsAtCheckpoint; /* The first record is a dump line, so nothing carries over */
+    int fromCheckpoint;     /* net counts from the last dump line's balance */
+} ChunkAccount;
+
+/* One chunk of the log, filled in by its worker in shared memory.
+ * Line numbers are relative to the chunk until it is merged. */
+typedef struct {
+    size_t begin, end;      /* Byte range, aligned to line starts */
+    long lines;             /* Lines in the chunk */
+    long numAccounts;       /* ChunkAccount entries written to the results file */
+    long numRecords;        /* Records parsed */
+    long malformed;         /* Lines that are neither records, headers nor blank */
+    long firstMalformedLine;
+    int done;               /* Worker finished the chunk */
+} AuditChunk;
+
+/* One account over the whole log, indexed like the merge store */
+typedef struct {
+    long long recomputed;   /* Balance recomputed from amounts, from 0 or the last checkpoint */
+    long long recorded;     /* Last recorded balance */
+    long records;
+    long badRecords;
+    long firstBadLine;
+} AuditAccount;
+
+/* Function prototypes */
+void auditChunk(const char *data, AuditChunk *chunk, FILE *results);
+void mergeChunk(AuditChunk *chunk, FILE *results, long firstLine);
+int reportDivergentAccounts(void);
+int crossCheckLive(const char *fifoName, const char *data, size_t size);
+
+#endif /* BANK_AUDIT_H */
@@ -9,33 +9,78 @@ char serverFifo[SERVER_FIFO_NAME_LEN];
 int serverFd = -1;
 ClientOperation *operations = NULL;
 int numOperations = 0;
-sem_t *clientSem = NULL;
 
 /* Current operation index for better display */
 int currentOpIndex = 0;
 
+/* Scheduling weight requested from the server and latency reporting flag */
+int clientWeight = 0;
+int reportLatency = 0;
+
+/* Session mode: many batches over one connection, read from stdin */
+int sessionMode = 0;
+int sessionBatches = 0;
+int sessionOps = 0;
+int sessionAnswered = 0;
+
+/* Capacity of the operations array, and the open BEGIN block, if any */
+int operationsCapacity = 0;
+int openTxn = -1;
+
+/* Response FIFOs, one per operation slot of a batch; fifoIds[i] names
+ * the FIFO of slot i */
+int responseFds[MAX_BATCH_SIZE];
+int fifoIds[MAX_BATCH_SIZE];
+int nextFifoId = MAX_BATCH_SIZE + 1;    /* Names for slots whose response never came */
+
 /* Main function */
 int main(int argc, char *argv[]) {
-    /* Check command line arguments */
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <client_file> #ServerFIFO_Name\n", argv[0]);
+    /* Parse options */
+    int opt;
+    while ((opt = getopt(argc, argv, "w:ls")) != -1) {
+        switch (opt) {
+            case 'w':
+                clientWeight = atoi(optarg);
+                break;
+            case 'l':
+                reportLatency = 1;
+                break;
+            case 's':
+                sessionMode = 1;
+                break;
+            default:
+                argc = -1; /* Force the usage message */
+                break;
+        }
+    }
+    
+    /* Check command line arguments; a session reads its operations from stdin */
+    if (argc - optind != (sessionMode ? 1 : 2)) {
+        fprintf(stderr, "Usage: %s [-w weight] [-l] <client_file> #ServerFIFO_Name\n", argv[0]);
+        fprintf(stderr, "       %s [-w weight] [-l] -s #ServerFIFO_Name < commands\n", argv[0]);
         exit(EXIT_FAILURE);
     }
     
+    char *clientFile = sessionMode ? NULL : argv[optind];
+    
     /* Initialize the client */
-    initializeClient(argv[2]);
+    initializeClient(argv[argc - 1]);
     
     /* Parse the client file */
-    int numClients = parseClientFile(argv[1]);
-    if (numClients <= 0) {
-        fprintf(stderr, "Error: No valid operations found in client file\n");
-        cleanupClient();
-        exit(EXIT_FAILURE);
+    if (!sessionMode) {
+        int numClients = parseClientFile(clientFile);
+        if (numClients <= 0) {
+            if (numClients == 0) {
+                fprintf(stderr, "Error: No valid operations found in client file\n");
+            }
+            cleanupClient();
+            exit(EXIT_FAILURE);
+        }
+        
+        printf("Reading %s..\n", clientFile);
+        printf("%d clients to connect.. creating clients..\n", numClients);
     }
     
-    printf("Reading %s..\n", argv[1]);
-    printf("%d clients to connect.. creating clients..\n", numClients);
-    
     /* Connect to the bank server */
     serverFd = open(serverFifo, O_WRONLY);
     if (serverFd == -1) {
@@ -46,8 +91,16 @@ int main(int argc, char *argv[]) {
     
     printf("Connected to Adabank..\n");
     
-    /* Send all operations in batch mode */
-    sendOperationBatch();
+    if (sessionMode) {
+        runSession();
+    } else {
+        /* Send all operations in batch mode */
+        sendOperationBatch();
+        
+        if (reportLatency) {
+            printLatencyReport();
+        }
+    }
     
     printf("exiting..\n");
     
@@ -73,6 +126,12 @@ void initializeClient(const char *fifoName) {
     
     /* Set up the server FIFO name - properly use the template */
     snprintf(serverFifo, SERVER_FIFO_NAME_LEN, SERVER_FIFO_TEMPLATE, fifoName);
+    
+    /* Response FIFOs are created on first use */
+    for (int i = 0; i < MAX_BATCH_SIZE; i++) {
+        responseFds[i] = -1;
+        fifoIds[i] = i + 1;
+    }
 }
 
 void cleanupClient(void) {
@@ -80,18 +139,7 @@ void cleanupClient(void) {
     if (serverFd != -1) close(serverFd);
     
     /* Remove any client FIFOs we created */
-    for (int i = 0; i < numOperations; i++) {
-        char clientFifo[CLIENT_FIFO_NAME_LEN];
-        snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d", 
-                 (long)getpid(), i + 1);
-        unlink(clientFifo);
-    }
-    
-    /* Clean up semaphore */
-    if (clientSem != NULL && clientSem != SEM_FAILED) {
-        sem_close(clientSem);
-        sem_unlink(pidToString(getpid()));
-    }
+    closeResponseFifos();
     
     /* Free the operations array */
     free(operations);
@@ -109,53 +157,115 @@ void handleSignal(int sig) {
     exit(EXIT_SUCCESS);
 }
 
-/* Client file parsing */
+/* Client file parsing. Returns the number of operations, or -1 if the
+ * file cannot be read or has an invalid line. */
 int parseClientFile(const char *filename) {
     FILE *file = fopen(filename, "r");
     if (file == NULL) {
-        perror("fopen");
-        exit(EXIT_FAILURE);
+        perror(filename);
+        return -1;
     }
     
-    /* Count number of lines in the file */
     char line[256];
-    int lineCount = 0;
+    int result = 0;
     
-    while (fgets(line, sizeof(line), file) != NULL) {
-        /* Skip comment lines that start with # */
-        if (line[0] == '#' || strlen(line) <= 1) {
-            continue;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        result = addClientLine(line);
+    }
+    fclose(file);
+    
+    if (result == 0 && openTxn != -1) {
+        fprintf(stderr, "Error: BEGIN without matching COMMIT\n");
+        result = -1;
+    }
+    
+    if (result == -1) {
+        resetOperations();
+        return -1;
+    }
+    return numOperations; /* Number of operations is the client count */
+}
+
+/* Next free operation slot, growing the array as needed */
+static ClientOperation *nextOperation(void) {
+    if (numOperations == operationsCapacity) {
+        int capacity = operationsCapacity == 0 ? 16 : operationsCapacity * 2;
+        ClientOperation *grown = realloc(operations, capacity * sizeof(ClientOperation));
+        if (grown == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
         }
-        lineCount++;
+        operations = grown;
+        operationsCapacity = capacity;
     }
     
-    /* Allocate memory for operations */
-    operations = (ClientOperation *)malloc(lineCount * sizeof(ClientOperation));
-    if (operations == NULL) {
-        perror("malloc");
-        fclose(file);
-        exit(EXIT_FAILURE);
+    ClientOperation *op = &operations[numOperations];
+    memset(op, 0, sizeof(ClientOperation));
+    return op;
+}
+
+/* Add one line of client file syntax to the operations. A BEGIN ...
+ * COMMIT block becomes one operation once COMMIT is seen. Comments and
+ * blank lines are skipped. Returns 0, or -1 for an invalid line. */
+int addClientLine(char *line) {
+    /* Skip comment lines that start with # */
+    if (line[0] == '#' || strlen(line) <= 1) {
+        return 0;
     }
     
-    /* Reset file position to beginning */
-    rewind(file);
+    /* Transaction markers group the following ops into one request */
+    if (strncmp(line, "BEGIN", 5) == 0) {
+        if (openTxn != -1) {
+            fprintf(stderr, "Error: Nested BEGIN in client file\n");
+            return -1;
+        }
+        ClientOperation *txn = nextOperation();
+        strcpy(txn->operation, "txn");
+        openTxn = numOperations;
+        return 0;
+    }
     
-    /* Parse each line */
-    while (fgets(line, sizeof(line), file) != NULL) {
-        /* Skip comment lines that start with # */
-        if (line[0] == '#' || strlen(line) <= 1) {
-            continue;
+    if (strncmp(line, "COMMIT", 6) == 0) {
+        if (openTxn == -1 || operations[openTxn].numTxnOps == 0) {
+            fprintf(stderr, "Error: COMMIT without a non-empty BEGIN block\n");
+            return -1;
         }
-        
-        parseClientLine(line, &operations[numOperations]);
+        openTxn = -1;
         numOperations++;
+        return 0;
     }
     
-    fclose(file);
-    return numOperations; /* Number of operations is the client count */
+    ClientOperation op;
+    memset(&op, 0, sizeof(ClientOperation));
+    if (parseClientLine(line, &op) == -1) {
+        return -1;
+    }
+    
+    if (openTxn != -1) {
+        return addTransactionOp(&operations[openTxn], &op);
+    }
+    
+    ClientOperation *slot = nextOperation();
+    if (strcmp(op.operation, "transfer") == 0) {
+        /* A standalone transfer is sent as a single-op transaction */
+        strcpy(slot->operation, "txn");
+        if (addTransactionOp(slot, &op) == -1) {
+            return -1;
+        }
+    } else {
+        *slot = op;
+    }
+    numOperations++;
+    return 0;
 }
 
-void parseClientLine(char *line, ClientOperation *op) {
+/* Forget the parsed operations, keeping the array for the next batch */
+void resetOperations(void) {
+    numOperations = 0;
+    openTxn = -1;
+}
+
+int parseClientLine(char *line, ClientOperation *op) {
     /* Remove trailing newline */
     size_t len = strlen(line);
     if (len > 0 && line[len-1] == '\n') {
@@ -166,7 +276,7 @@ void parseClientLine(char *line, ClientOperation *op) {
     char *token = strtok(line, " ");
     if (token == NULL) {
         fprintf(stderr, "Error: Invalid line format\n");
-        exit(EXIT_FAILURE);
+        return -1;
     }
     
     strncpy(op->bankId, token, sizeof(op->bankId) - 1);
@@ -175,28 +285,167 @@ void parseClientLine(char *line, ClientOperation *op) {
     token = strtok(NULL, " ");
     if (token == NULL) {
         fprintf(stderr, "Error: Invalid line format\n");
-        exit(EXIT_FAILURE);
+        return -1;
     }
     
     strncpy(op->operation, token, sizeof(op->operation) - 1);
     op->operation[sizeof(op->operation) - 1] = '\0';
     
+    /* Reject unknown operations here, before the batch size is announced
+     * to the server; a request dropped later would leave the batch short */
+    if (strcmp(op->operation, "deposit") != 0 && strcmp(op->operation, "withdraw") != 0 &&
+        strcmp(op->operation, "balance") != 0 && strcmp(op->operation, "transfer") != 0) {
+        fprintf(stderr, "Error: Invalid operation: %s\n", op->operation);
+        return -1;
+    }
+    
+    /* Balance queries carry no amount */
+    if (strcmp(op->operation, "balance") == 0) {
+        op->amount = 0;
+        return 0;
+    }
+    
     token = strtok(NULL, " ");
     if (token == NULL) {
         fprintf(stderr, "Error: Invalid line format\n");
-        exit(EXIT_FAILURE);
+        return -1;
     }
     
     op->amount = atoi(token);
+    
+    /* Transfers name the destination account as a fourth field */
+    if (strcmp(op->operation, "transfer") == 0) {
+        token = strtok(NULL, " ");
+        if (token == NULL) {
+            fprintf(stderr, "Error: Transfer needs a destination BankID\n");
+            return -1;
+        }
+        
+        strncpy(op->toBankId, token, sizeof(op->toBankId) - 1);
+        op->toBankId[sizeof(op->toBankId) - 1] = '\0';
+    }
+    return 0;
 }
 
-/* Improved sendOperationBatch function for better batch processing */
-void sendOperationBatch() {
-    /* Create all the client FIFOs first */
-    for (int i = 0; i < numOperations; i++) {
+/* Append a parsed line to a transaction block */
+int addTransactionOp(ClientOperation *txn, ClientOperation *op) {
+    if (txn->numTxnOps >= MAX_TXN_OPS) {
+        fprintf(stderr, "Error: Transaction exceeds %d operations\n", MAX_TXN_OPS);
+        return -1;
+    }
+    
+    if (isNewClient(op->bankId) || isNewClient(op->toBankId)) {
+        fprintf(stderr, "Error: Transactions cannot open new accounts\n");
+        return -1;
+    }
+    
+    TransactionOp *txnOp = &txn->txnOps[txn->numTxnOps];
+    
+    if (strcmp(op->operation, "deposit") == 0) {
+        txnOp->op = OP_DEPOSIT;
+    } else if (strcmp(op->operation, "withdraw") == 0) {
+        txnOp->op = OP_WITHDRAW;
+    } else if (strcmp(op->operation, "transfer") == 0) {
+        txnOp->op = OP_TRANSFER;
+    } else {
+        fprintf(stderr, "Error: Invalid operation in transaction: %s\n", op->operation);
+        return -1;
+    }
+    
+    txnOp->amount = op->amount;
+    strcpy(txnOp->bankId, op->bankId);
+    strcpy(txnOp->toBankId, op->toBankId);
+    txn->numTxnOps++;
+    return 0;
+}
+
+/* Session mode: stay connected and run batches read from stdin until EOF.
+ * Op lines in client file syntax are collected and sent as one batch at
+ * a blank line, "RUN <file>" sends the operations of a client file as a
+ * batch. The server FIFO and the response FIFOs are set up once and
+ * reused by every batch. */
+void runSession(void) {
+    char line[256];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    printf("Session open, reading operations from stdin..\n");
+    fflush(stdout);
+    
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        if (strncmp(line, "RUN ", 4) == 0) {
+            /* Op lines given so far go first */
+            runSessionBatch();
+            
+            char *path = line + 4;
+            path[strcspn(path, "\r\n")] = '\0';
+            if (parseClientFile(path) > 0) {
+                printf("Reading %s..\n", path);
+                runSessionBatch();
+            }
+            continue;
+        }
+        
+        if (line[0] == '\n' && openTxn == -1) {
+            runSessionBatch();
+            continue;
+        }
+        
+        /* A bad line is dropped, the rest of the batch still goes */
+        if (addClientLine(line) == -1) {
+            fprintf(stderr, "Skipping invalid line\n");
+        }
+        if (numOperations == MAX_BATCH_SIZE) {
+            runSessionBatch();
+        }
+    }
+    
+    if (openTxn != -1) {
+        fprintf(stderr, "Error: BEGIN without matching COMMIT, dropping it\n");
+        openTxn = -1;
+    }
+    runSessionBatch();
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Session: batches=%d ops=%d answered=%d elapsed=%.2fms\n", 
+           sessionBatches, sessionOps, sessionAnswered, timespecDiffMs(&start, &end));
+}
+
+/* Send the operations parsed so far as one batch and wait for its responses */
+void runSessionBatch(void) {
+    if (numOperations == 0) {
+        return;
+    }
+    
+    printf("%d clients to connect.. creating clients..\n", numOperations);
+    sendOperationBatch();
+    
+    if (reportLatency) {
+        printLatencyReport();
+    }
+    fflush(stdout);
+    
+    sessionBatches++;
+    sessionOps += numOperations;
+    resetOperations();
+}
+
+/* Response FIFO of operation slot i */
+static void responseFifoName(char *name, int i) {
+    snprintf(name, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d", 
+             (long)getpid(), fifoIds[i]);
+}
+
+/* Create and open the response FIFOs of the first count slots, unless they
+ * are still open from an earlier batch */
+void openResponseFifos(int count) {
+    for (int i = 0; i < count; i++) {
+        if (responseFds[i] != -1) {
+            continue;
+        }
+        
         char clientFifo[CLIENT_FIFO_NAME_LEN];
-        snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d", 
-                 (long)getpid(), i + 1);
+        responseFifoName(clientFifo, i);
         
         /* Create the FIFO */
         umask(0);  /* So we get the permissions we want */
@@ -204,18 +453,81 @@ void sendOperationBatch() {
             perror("mkfifo");
             continue;
         }
+        
+        /* Opened for writing too, so the FIFO never reports a hangup when a
+         * writer closes it and poll only wakes up for actual responses */
+        responseFds[i] = open(clientFifo, O_RDWR | O_NONBLOCK);
+    }
+}
+
+/* Close and remove the response FIFO of slot i. A slot whose response
+ * never came gets a new name, so a late answer cannot be taken for the
+ * response to a later batch. */
+void dropResponseFifo(int i, int rename) {
+    char clientFifo[CLIENT_FIFO_NAME_LEN];
+    responseFifoName(clientFifo, i);
+    
+    if (responseFds[i] != -1) {
+        close(responseFds[i]);
+        responseFds[i] = -1;
     }
+    unlink(clientFifo);
+    
+    if (rename) {
+        fifoIds[i] = nextFifoId++;
+    }
+}
+
+void closeResponseFifos(void) {
+    for (int i = 0; i < MAX_BATCH_SIZE; i++) {
+        if (responseFds[i] != -1) {
+            dropResponseFifo(i, 0);
+        }
+    }
+}
+
+/* Send the parsed operations and collect their responses, at most
+ * MAX_BATCH_SIZE at a time */
+void sendOperationBatch(void) {
+    for (int first = 0; first < numOperations; first += MAX_BATCH_SIZE) {
+        int count = numOperations - first;
+        if (count > MAX_BATCH_SIZE) {
+            count = MAX_BATCH_SIZE;
+        }
+        sendOperations(&operations[first], first, count);
+    }
+}
+
+/* Improved batch processing: every operation gets its own response FIFO,
+ * all requests are sent before any response is read */
+void sendOperations(ClientOperation *ops, int first, int count) {
+    /* Open all FIFOs for reading before sending anything, so the server can
+     * answer fast-path requests (balance queries) without waiting for us */
+    openResponseFifos(count);
+    
+    struct pollfd pfds[MAX_BATCH_SIZE];
+    int waiting[MAX_BATCH_SIZE];
+    int received_responses = 0;
+    
+    /* Every operation gets a trace ID; the server decides which batches it traces */
+    static unsigned traceBatch = 0;
+    traceBatch++;
     
     /* Send all operations in rapid succession */
-    for (int i = 0; i < numOperations; i++) {
-        currentOpIndex = i;
-        ClientOperation *op = &operations[i];
+    for (int i = 0; i < count; i++) {
+        currentOpIndex = first + i;
+        ClientOperation *op = &ops[i];
+        waiting[i] = 0;
         
         /* Display client connection message */
-        int clientIndex = i + 1;
+        int clientIndex = first + i + 1;
         printf("Client%02d connected..", clientIndex);
         
-        if (strcmp(op->operation, "deposit") == 0) {
+        if (strcmp(op->operation, "txn") == 0) {
+            printf("running transaction of %d ops\n", op->numTxnOps);
+        } else if (strcmp(op->operation, "balance") == 0) {
+            printf("checking balance\n");
+        } else if (strcmp(op->operation, "deposit") == 0) {
             printf("depositing %d credits\n", op->amount);
         } else {
             printf("withdrawing %d credits\n", op->amount);
@@ -227,13 +539,24 @@ void sendOperationBatch() {
         req.pid = getpid();
         req.msgType = MSG_OPERATION;
         req.isNewClient = isNewClient(op->bankId);
-        req.batchSize = numOperations;
-        req.operationIndex = clientIndex;
+        req.batchSize = count;
+        req.operationIndex = fifoIds[i];
+        req.weight = clientWeight;
+        req.traceId = TRACE_ID(req.pid, traceBatch, clientIndex);
+        op->traceId = req.traceId;
         
-        if (strcmp(op->operation, "deposit") == 0) {
+        if (strcmp(op->operation, "txn") == 0) {
+            /* The whole BEGIN ... COMMIT block travels in this one request */
+            req.msgType = MSG_TRANSACTION;
+            req.isNewClient = 0;
+            req.numTxnOps = op->numTxnOps;
+            memcpy(req.txnOps, op->txnOps, sizeof(req.txnOps));
+        } else if (strcmp(op->operation, "deposit") == 0) {
             req.op = OP_DEPOSIT;
         } else if (strcmp(op->operation, "withdraw") == 0) {
             req.op = OP_WITHDRAW;
+        } else if (strcmp(op->operation, "balance") == 0) {
+            req.op = OP_BALANCE;
         } else {
             fprintf(stderr, "Error: Invalid operation: %s\n", op->operation);
             continue;
@@ -246,141 +569,102 @@ void sendOperationBatch() {
             req.bankId[sizeof(req.bankId) - 1] = '\0';
         }
         
-        /* Send the request to the server with retries */
-        int retries = 3;
-        while (retries--) {
-            if (write(serverFd, &req, sizeof(ClientRequest)) == sizeof(ClientRequest)) {
-                break; /* Success */
-            } else if (errno == EAGAIN || errno == EINTR) {
-                /* Temporary error, retry after a small delay */
-                usleep(50000); /* 50ms */
-            } else {
-                /* Permanent error */
-                perror("write to server");
-                break;
-            }
+        /* Send the request to the server. The server FIFO is blocking, so
+         * a full FIFO just makes the write wait for room. */
+        op->latencyMs = -1;
+        clock_gettime(CLOCK_MONOTONIC, &op->sentAt);
+        req.sentNs = op->sentAt.tv_sec * 1000000000L + op->sentAt.tv_nsec;
+        ssize_t written;
+        do {
+            written = write(serverFd, &req, sizeof(ClientRequest));
+        } while (written == -1 && errno == EINTR);
+        if (written != sizeof(ClientRequest)) {
+            perror("write to server");
+        } else {
+            waiting[i] = responseFds[i] != -1;
         }
     }
     
-    /* Now open and read all client FIFOs for responses */
-    int fd_array[MAX_BATCH_SIZE];
-    fd_set readfds;
-    int received_responses = 0;
-    
-    /* First, open all FIFOs in non-blocking mode */
-    for (int i = 0; i < numOperations; i++) {
-        char clientFifo[CLIENT_FIFO_NAME_LEN];
-        snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d", 
-                 (long)getpid(), i + 1);
-        
-        fd_array[i] = open(clientFifo, O_RDONLY | O_NONBLOCK);
-    }
-    
-    /* Process responses until we get them all or timeout */
-    time_t start_time = time(NULL);
-    
-    while (received_responses < numOperations && time(NULL) - start_time < 30) {
-        /* Set up descriptor set */
-        FD_ZERO(&readfds);
-        int maxfd = -1;
-        
-        for (int i = 0; i < numOperations; i++) {
-            if (fd_array[i] > 0) {
-                FD_SET(fd_array[i], &readfds);
-                if (fd_array[i] > maxfd) {
-                    maxfd = fd_array[i];
-                }
+    /* Process responses until we get them all or the deadline passes */
+    struct timespec deadline;
+    deadlineAfterMs(&deadline, RESPONSE_TIMEOUT_SEC * 1000);
+    
+    while (received_responses < count) {
+        /* Wait on every FIFO still owed a response */
+        int numFds = 0;
+        for (int i = 0; i < count; i++) {
+            pfds[i].fd = waiting[i] ? responseFds[i] : -1; /* poll skips negative fds */
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+            if (waiting[i]) {
+                numFds++;
             }
         }
         
-        if (maxfd == -1) {
-            /* No open FDs, try to open some */
-            for (int i = 0; i < numOperations; i++) {
-                if (fd_array[i] <= 0) {
-                    char clientFifo[CLIENT_FIFO_NAME_LEN];
-                    snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d", 
-                             (long)getpid(), i + 1);
-                    
-                    fd_array[i] = open(clientFifo, O_RDONLY | O_NONBLOCK);
-                }
-            }
-            
-            /* Check again after opening */
-            for (int i = 0; i < numOperations; i++) {
-                if (fd_array[i] > 0) {
-                    FD_SET(fd_array[i], &readfds);
-                    if (fd_array[i] > maxfd) {
-                        maxfd = fd_array[i];
-                    }
-                }
-            }
-            
-            if (maxfd == -1) {
-                /* Still no open FDs, wait a bit */
-                usleep(100000); /* 100ms */
-                continue;
-            }
+        if (numFds == 0) {
+            break; /* Nothing left that could still answer */
         }
         
-        /* Wait for data with timeout */
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 250000; /* 250ms timeout - more responsive */
+        int left = msUntil(&deadline);
+        if (left == 0) {
+            break;
+        }
         
-        int ready = select(maxfd + 1, &readfds, NULL, NULL, &tv);
+        int ready = poll(pfds, count, left);
         if (ready < 0) {
             if (errno == EINTR) continue; /* Interrupted, try again */
-            perror("select");
+            perror("poll");
             break;
         } else if (ready == 0) {
-            continue; /* Timeout, try again */
+            break; /* Deadline passed */
         }
         
         /* Check which FDs have data */
-        for (int i = 0; i < numOperations; i++) {
-            if (fd_array[i] > 0 && FD_ISSET(fd_array[i], &readfds)) {
+        for (int i = 0; i < count; i++) {
+            if (waiting[i] && (pfds[i].revents & POLLIN)) {
                 /* Read response */
                 ServerResponse resp;
-                ssize_t bytes_read = read(fd_array[i], &resp, sizeof(ServerResponse));
+                ssize_t bytes_read = read(responseFds[i], &resp, sizeof(ServerResponse));
                 
                 if (bytes_read == sizeof(ServerResponse)) {
+                    struct timespec now;
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    ops[i].latencyMs = timespecDiffMs(&ops[i].sentAt, &now);
+                    
                     /* Process the response */
-                    processResponse(&resp, &operations[i], i + 1);
+                    processResponse(&resp, &ops[i], first + i + 1);
                     received_responses++;
-                    
-                    /* Close this FD since we're done with it */
-                    close(fd_array[i]);
-                    fd_array[i] = -1;
+                    waiting[i] = 0;
                 } else if (bytes_read == -1 && errno != EAGAIN) {
                     /* Error other than "would block" */
                     perror("read from server");
-                    close(fd_array[i]);
-                    fd_array[i] = -1;
+                    waiting[i] = 0;
                 }
             }
         }
     }
+    sessionAnswered += received_responses;
     
-    /* Close any remaining FDs */
-    for (int i = 0; i < numOperations; i++) {
-        if (fd_array[i] > 0) {
-            close(fd_array[i]);
+    /* FIFOs still owed a response are not reused */
+    for (int i = 0; i < count; i++) {
+        if (waiting[i]) {
+            dropResponseFifo(i, 1);
         }
     }
-    
-    /* Remove the client FIFOs */
-    for (int i = 0; i < numOperations; i++) {
-        char clientFifo[CLIENT_FIFO_NAME_LEN];
-        snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d", 
-                 (long)getpid(), i + 1);
-        unlink(clientFifo);
-    }
 }
 
 /* Process server response */
 void processResponse(ServerResponse *resp, ClientOperation *op, int clientIndex) {
     /* Process the server's response */
-    if (resp->status == 0) {
+    if (resp->status == 0 && strcmp(op->operation, "txn") == 0) {
+        /* Transaction committed as a whole */
+        printf("Client%02d served.. transaction committed (%d ops)\n", 
+               clientIndex, resp->numTxnOps);
+    } else if (resp->status == 0 && strcmp(op->operation, "balance") == 0) {
+        /* Read-only query */
+        printf("Client%02d served.. %s has %d credits\n", 
+               clientIndex, resp->bankId, resp->balance);
+    } else if (resp->status == 0) {
         /* Success */
         if (resp->balance == 0 && strcmp(op->operation, "withdraw") == 0) {
             printf("Client%02d served.. account closed\n", clientIndex);
@@ -403,4 +687,55 @@ void processResponse(ServerResponse *resp, ClientOperation *op, int clientIndex)
 /* Helper functions */
 int isNewClient(const char *bankId) {
     return (strcmp(bankId, "N") == 0);
+}
+
+static int compareLatency(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Print per-operation latency percentiles in a form the benchmark can parse */
+void printLatencyReport(void) {
+    double latencies[MAX_BATCH_SIZE];
+    int count = 0;
+    
+    for (int i = 0; i < numOperations && count < MAX_BATCH_SIZE; i++) {
+        if (operations[i].latencyMs >= 0) {
+            latencies[count++] = operations[i].latencyMs;
+        }
+    }
+    
+    if (count == 0) {
+        printf("Latency: ops=0\n");
+        return;
+    }
+    
+    /* Wall time from the first request sent to the last response received */
+    double elapsed = 0;
+    for (int i = 0; i < numOperations; i++) {
+        if (operations[i].latencyMs >= 0) {
+            double done = timespecDiffMs(&operations[0].sentAt, &operations[i].sentAt) + 
+                          operations[i].latencyMs;
+            if (done > elapsed) {
+                elapsed = done;
+            }
+        }
+    }
+    
+    /* The slowest operation, to look up in the server's trace */
+    int slowest = -1;
+    for (int i = 0; i < numOperations; i++) {
+        if (operations[i].latencyMs >= 0 && 
+            (slowest == -1 || operations[i].latencyMs > operations[slowest].latencyMs)) {
+            slowest = i;
+        }
+    }
+    
+    qsort(latencies, count, sizeof(double), compareLatency);
+    
+    int p99 = (count * 99 + 99) / 100 - 1;
+    printf("Latency: ops=%d p50=%.2fms p99=%.2fms max=%.2fms elapsed=%.2fms\n", 
+           count, latencies[(count - 1) / 2], latencies[p99], latencies[count - 1], elapsed);
+    printf("Slowest: Client%02d %.2fms trace=%016lx\n", slowest + 1, 
+           operations[slowest].latencyMs, operations[slowest].traceId);
 }
\ No newline at end of file
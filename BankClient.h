@@ -19,18 +19,27 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/select.h>
-#include <semaphore.h>
+#include <poll.h>
 #include <time.h>
 
 #include "bank_shared.h"
 #include "bank_utils.h"
 
 
+/* Longest a client waits for the responses to its batch */
+#define RESPONSE_TIMEOUT_SEC 30
+
 /* Structure to store client information */
 typedef struct {
-    char operation[10];     /* "deposit" or "withdraw" */
+    char operation[10];     /* "deposit", "withdraw", "balance", "transfer" or "txn" */
     int amount;             /* Amount to deposit or withdraw */
     char bankId[20];        /* BankID for existing clients, "N" for new clients */
+    char toBankId[20];      /* Destination BankID for transfers */
+    int numTxnOps;          /* Number of ops grouped in a transaction */
+    TransactionOp txnOps[MAX_TXN_OPS]; /* Ops of a BEGIN ... COMMIT block */
+    struct timespec sentAt; /* When the request was written to the server */
+    double latencyMs;       /* Time until the response arrived, -1 if none */
+    unsigned long traceId;  /* Trace ID the request was sent with */
 } ClientOperation;
 
 /* Function prototypes */
@@ -44,21 +53,45 @@ void handleSignal(int sig);
 
 /* Client file parsing */
 int parseClientFile(const char *filename);
-void parseClientLine(char *line, ClientOperation *op);
+int addClientLine(char *line);
+void resetOperations(void);
+int parseClientLine(char *line, ClientOperation *op);
+int addTransactionOp(ClientOperation *txn, ClientOperation *op);
+
+/* Session mode */
+void runSession(void);
+void runSessionBatch(void);
+
+/* Response FIFOs */
+void openResponseFifos(int count);
+void dropResponseFifo(int i, int rename);
+void closeResponseFifos(void);
 
 /* Operations */
 void sendOperationBatch(void);
+void sendOperations(ClientOperation *ops, int first, int count);
 void processResponse(ServerResponse *resp, ClientOperation *op, int clientIndex);
 
 /* Helper functions */
 int isNewClient(const char *bankId);
+void printLatencyReport(void);
 
 /* Global variable declarations (extern) */
 extern char serverFifo[SERVER_FIFO_NAME_LEN];
 extern int serverFd;
 extern ClientOperation *operations;
 extern int numOperations;
-extern sem_t *clientSem;
 extern int currentOpIndex;
+extern int clientWeight;
+extern int reportLatency;
+extern int sessionMode;
+extern int sessionBatches;
+extern int sessionOps;
+extern int sessionAnswered;
+extern int operationsCapacity;
+extern int openTxn;
+extern int responseFds[MAX_BATCH_SIZE];
+extern int fifoIds[MAX_BATCH_SIZE];
+extern int nextFifoId;
 
 #endif /* BANK_CLIENT_H */
\ No newline at end of file
@@ -0,0 +1,122 @@
+/* BankHistory.c
+ * Account statement tool
+ *
+ * Usage: BankHistory [-s fromSeq] [-e toSeq] [-a fromTime] [-b toTime] [-n max] BankName BankID
+ *
+ * Looks the account up in the bank's history index and reads only that
+ * account's record lines from the log, instead of scanning the whole log.
+ * Sequence numbers count log records from 0; times are seconds since the
+ * epoch. Records indexed after a restart without their write time are
+ * left out when a time range is given.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "bank_utils.h"
+#include "bank_history.h"
+
+#define DEFAULT_MAX_RECORDS 1000
+
+int main(int argc, char *argv[]) {
+    uint64_t fromSeq = 0, toSeq = UINT64_MAX;
+    int64_t fromTime = 0, toTime = INT64_MAX;
+    int maxRecords = DEFAULT_MAX_RECORDS;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "s:e:a:b:n:")) != -1) {
+        switch (opt) {
+            case 's':
+                fromSeq = strtoull(optarg, NULL, 10);
+                break;
+            case 'e':
+                toSeq = strtoull(optarg, NULL, 10);
+                break;
+            case 'a':
+                fromTime = strtoll(optarg, NULL, 10);
+                break;
+            case 'b':
+                toTime = strtoll(optarg, NULL, 10);
+                break;
+            case 'n':
+                maxRecords = atoi(optarg);
+                break;
+            default:
+                argc = -1; /* Force the usage message */
+                break;
+        }
+    }
+    
+    if (argc - optind != 2 || maxRecords < 1) {
+        fprintf(stderr, "Usage: %s [-s fromSeq] [-e toSeq] [-a fromTime] [-b toTime] [-n max] "
+                "BankName BankID\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    
+    const char *bankName = argv[optind];
+    const char *bankId = argv[optind + 1];
+    int accountId = parseBankId(bankId);
+    if (accountId == -1) {
+        fprintf(stderr, "Not an account ID: %s\n", bankId);
+        exit(EXIT_FAILURE);
+    }
+    char indexName[80], logName[80];
+    snprintf(indexName, sizeof(indexName), HISTORY_NAME_TEMPLATE, bankName);
+    snprintf(logName, sizeof(logName), "%s.bankLog", bankName);
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    size_t mapSize;
+    void *map = historyMap(indexName, &mapSize);
+    if (map == NULL) {
+        fprintf(stderr, "No usable history index %s; start the server to build it\n", indexName);
+        exit(EXIT_FAILURE);
+    }
+    
+    int logFd = open(logName, O_RDONLY);
+    if (logFd == -1) {
+        errExit("open %s", logName);
+    }
+    
+    HistoryEntry *entries = malloc(maxRecords * sizeof(HistoryEntry));
+    if (entries == NULL) {
+        errExit("malloc");
+    }
+    
+    int matched = historyQuery(map, mapSize, accountId, fromSeq, toSeq, fromTime, toTime,
+                               entries, maxRecords);
+    int shown = matched < maxRecords ? matched : maxRecords;
+    
+    /* Read each record straight from its place in the log */
+    char line[128];
+    for (int i = 0; i < shown; i++) {
+        size_t length = entries[i].length < sizeof(line) ? entries[i].length : sizeof(line) - 1;
+        ssize_t n = pread(logFd, line, length, entries[i].offset);
+        if (n <= 0) {
+            errExit("pread %s", logName);
+        }
+        line[n] = '\0';
+        line[strcspn(line, "\n")] = '\0';
+        
+        char timeStr[30] = "-";
+        if (entries[i].time != 0) {
+            time_t when = entries[i].time;
+            strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime(&when));
+        }
+        printf("%8llu  %-19s  %s\n", (unsigned long long)entries[i].seq, timeStr, line);
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("History: account=%s records=%d shown=%d elapsed=%.3fms\n",
+           bankId, matched, shown, timespecDiffMs(&start, &end));
+    
+    free(entries);
+    close(logFd);
+    munmap(map, mapSize);
+    return 0;
+}
@@ -0,0 +1,366 @@
+/* BankRouter.c
+ * Shard router
+ *
+ * Accepts client requests on one server FIFO and forwards each one to one
+ * of several BankServer instances, chosen by the account number. Clients
+ * need no changes: a backend answers every operation straight on the
+ * client's own response FIFO, so a client whose operations span several
+ * shards still collects all of its responses in one place.
+ *
+ * A client's requests are held back until its whole batch has arrived
+ * (or ROUTER_FLUSH_MS have passed) and then forwarded together. Each
+ * backend sees the client as a batch of only the operations it owns,
+ * and the requests for one backend go out in as few writes as PIPE_BUF
+ * allows.
+ *
+ * New accounts are spread over the shards round robin. Every backend
+ * must hand out account numbers from its own share of the ID space
+ * (BankServer -i first:stride[:last]); the router prints the option each
+ * shard needs at startup.
+ */
+#include "BankRouter.h"
+
+static Shard shards[MAX_SHARDS];
+static int numShards = 0;
+static int routeMode = ROUTE_HASH;
+static int rangeSize = DEFAULT_RANGE_SIZE;
+static int nextNewShard = 0;
+
+static PendingRequest pending[ROUTER_MAX_PENDING];
+static int numPending = 0;
+static RouterClient clients[ROUTER_MAX_CLIENTS];
+static int numClients = 0;
+
+static char routerFifo[SERVER_FIFO_NAME_LEN];
+static long rejected = 0;
+static volatile sig_atomic_t stopRequested = 0;
+
+int main(int argc, char *argv[]) {
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "m:r:")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "hash") == 0) {
+                    routeMode = ROUTE_HASH;
+                } else if (strcmp(optarg, "range") == 0) {
+                    routeMode = ROUTE_RANGE;
+                } else {
+                    argc = -1;
+                }
+                break;
+            case 'r':
+                rangeSize = atoi(optarg);
+                break;
+            default:
+                argc = -1; /* Force the usage message */
+                break;
+        }
+    }
+    
+    if (argc - optind < 2 || argc - optind - 1 > MAX_SHARDS || rangeSize < 1) {
+        fprintf(stderr, "Usage: %s [-m hash|range] [-r rangeSize] RouterFIFO_Name BackendFIFO_Name...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    
+    openShards(&argv[optind + 1], argc - optind - 1);
+    
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleRouterSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN); /* A backend that went away shows up as EPIPE */
+    
+    /* Our own endpoint, where clients send their requests */
+    snprintf(routerFifo, SERVER_FIFO_NAME_LEN, SERVER_FIFO_TEMPLATE, argv[optind]);
+    if (mkfifo(routerFifo, FIFO_PERM) == -1 && errno != EEXIST) {
+        errExit("mkfifo %s", routerFifo);
+    }
+    
+    int routerFd = open(routerFifo, O_RDONLY | O_NONBLOCK);
+    if (routerFd == -1) {
+        errExit("open %s for reading", routerFifo);
+    }
+    
+    /* Keep a writer open, so that we never see EOF between clients */
+    int dummyFd = open(routerFifo, O_WRONLY);
+    if (dummyFd == -1) {
+        errExit("open %s for writing", routerFifo);
+    }
+    
+    printf("Routing %s to %d shards by %s\n", routerFifo, numShards,
+           routeMode == ROUTE_HASH ? "hash" : "range");
+    fflush(stdout);
+    
+    /* Whole requests only: clients write one request per write(), which is atomic */
+    ClientRequest buf[PIPE_BUF / sizeof(ClientRequest)];
+    
+    while (!stopRequested) {
+        struct pollfd pfd = { .fd = routerFd, .events = POLLIN };
+        int ready = poll(&pfd, 1, numPending > 0 ? ROUTER_FLUSH_MS : -1);
+        if (ready == -1) {
+            if (errno != EINTR) {
+                errLog(NULL, "poll");
+            }
+            continue;
+        }
+        
+        ssize_t numRead;
+        while ((numRead = read(routerFd, buf, sizeof(buf))) > 0) {
+            if (numRead % sizeof(ClientRequest) != 0) {
+                errLog(NULL, "Dropped %ld bytes of a partial request", (long)(numRead % sizeof(ClientRequest)));
+            }
+            for (size_t i = 0; i < numRead / sizeof(ClientRequest); i++) {
+                holdRequest(&buf[i]);
+            }
+        }
+        if (numRead == -1 && errno != EAGAIN && errno != EINTR) {
+            errLog(NULL, "read %s", routerFifo);
+        }
+        
+        dispatchExpired(0);
+        flushShards();
+    }
+    
+    dispatchExpired(1);
+    flushShards();
+    printRouterStats();
+    
+    close(dummyFd);
+    close(routerFd);
+    unlink(routerFifo);
+    for (int i = 0; i < numShards; i++) {
+        close(shards[i].fd);
+    }
+    return 0;
+}
+
+/* Connect to every backend; they must already be running */
+void openShards(char *names[], int count) {
+    numShards = count;
+    
+    for (int i = 0; i < numShards; i++) {
+        Shard *shard = &shards[i];
+        snprintf(shard->fifoName, sizeof(shard->fifoName), SERVER_FIFO_TEMPLATE, names[i]);
+        
+        /* Non-blocking open fails with ENXIO instead of waiting for a missing backend */
+        shard->fd = open(shard->fifoName, O_WRONLY | O_NONBLOCK);
+        if (shard->fd == -1) {
+            errExit("open backend %s", shard->fifoName);
+        }
+        
+        /* Then block on writes, so a busy backend slows the router down */
+        fcntl(shard->fd, F_SETFL, fcntl(shard->fd, F_GETFL) & ~O_NONBLOCK);
+        
+        if (routeMode == ROUTE_HASH) {
+            printf("Shard %d: %s, start it with -i %d:%d\n", i, shard->fifoName, i + 1, numShards);
+        } else if (i < numShards - 1) {
+            /* The bound keeps a shard from handing out its neighbour's numbers */
+            printf("Shard %d: %s, start it with -i %d:1:%d\n", i, shard->fifoName,
+                   i * rangeSize + 1, (i + 1) * rangeSize);
+        } else {
+            printf("Shard %d: %s, start it with -i %d:1\n", i, shard->fifoName, i * rangeSize + 1);
+        }
+    }
+}
+
+/* Shard owning an account. IDs that are not BankID_<n> go to shard 0,
+ * which rejects them like a single server would. */
+int shardForAccount(const char *bankId) {
+    int num = parseBankId(bankId);
+    if (num < 1) {
+        return 0;
+    }
+    
+    int shard = routeMode == ROUTE_HASH ? (num - 1) % numShards : (num - 1) / rangeSize;
+    return shard < numShards ? shard : numShards - 1;
+}
+
+/* Shard for one request, or -1 if the router has to answer it */
+int routeRequest(const ClientRequest *req) {
+    if (req->msgType == MSG_TRANSACTION) {
+        if (req->numTxnOps < 1 || req->numTxnOps > MAX_TXN_OPS) {
+            return 0; /* Let the backend reject it */
+        }
+        
+        /* A transaction is only atomic inside one server */
+        int shard = shardForAccount(req->txnOps[0].bankId);
+        for (int i = 0; i < req->numTxnOps; i++) {
+            const TransactionOp *op = &req->txnOps[i];
+            if (shardForAccount(op->bankId) != shard ||
+                (op->op == OP_TRANSFER && shardForAccount(op->toBankId) != shard)) {
+                return -1;
+            }
+        }
+        return shard;
+    }
+    
+    if (req->isNewClient) {
+        int shard = nextNewShard;
+        nextNewShard = (nextNewShard + 1) % numShards;
+        return shard;
+    }
+    
+    return shardForAccount(req->bankId);
+}
+
+/* Hold a request back until the rest of its client's batch is here */
+void holdRequest(const ClientRequest *req) {
+    int shard = routeRequest(req);
+    if (shard == -1) {
+        rejectRequest(req, "Transaction spans more than one shard");
+    }
+    
+    RouterClient *client = NULL;
+    for (int i = 0; i < numClients; i++) {
+        if (clients[i].pid == req->pid) {
+            client = &clients[i];
+            break;
+        }
+    }
+    
+    if (client == NULL) {
+        if (numClients == ROUTER_MAX_CLIENTS) {
+            dispatchExpired(1); /* Make room by forwarding everything held */
+        }
+        client = &clients[numClients++];
+        client->pid = req->pid;
+        client->expected = req->batchSize;
+        client->received = 0;
+        clock_gettime(CLOCK_MONOTONIC, &client->firstSeen);
+    }
+    
+    pending[numPending].req = *req;
+    pending[numPending].shard = shard;
+    numPending++;
+    client->received++;
+    
+    if (client->received >= client->expected) {
+        dispatchClient(req->pid);
+    } else if (numPending == ROUTER_MAX_PENDING) {
+        dispatchExpired(1);
+    }
+}
+
+/* Forward a client's held requests. Each backend is told the batch
+ * holds only the operations it gets, so its session completes. */
+void dispatchClient(pid_t pid) {
+    int perShard[MAX_SHARDS] = {0};
+    
+    for (int i = 0; i < numPending; i++) {
+        if (pending[i].req.pid == pid && pending[i].shard != -1) {
+            perShard[pending[i].shard]++;
+        }
+    }
+    
+    int kept = 0;
+    for (int i = 0; i < numPending; i++) {
+        if (pending[i].req.pid != pid) {
+            pending[kept++] = pending[i];
+            continue;
+        }
+        
+        int shard = pending[i].shard;
+        if (shard != -1) {
+            if (shards[shard].numOut == ROUTER_MAX_PENDING) {
+                flushShards();
+            }
+            ClientRequest *out = &shards[shard].out[shards[shard].numOut++];
+            *out = pending[i].req;
+            out->batchSize = perShard[shard];
+        }
+    }
+    numPending = kept;
+    
+    for (int i = 0; i < numClients; i++) {
+        if (clients[i].pid == pid) {
+            clients[i] = clients[--numClients];
+            break;
+        }
+    }
+}
+
+/* Forward batches that waited ROUTER_FLUSH_MS for the rest of their
+ * requests, or every held batch if all is set */
+void dispatchExpired(int all) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    for (int i = 0; i < numClients; ) {
+        if (all || timespecDiffMs(&clients[i].firstSeen, &now) >= ROUTER_FLUSH_MS) {
+            dispatchClient(clients[i].pid); /* Moves the last client into slot i */
+        } else {
+            i++;
+        }
+    }
+}
+
+/* Write out every shard's queued requests, as many per write as stay atomic */
+void flushShards(void) {
+    const int perWrite = PIPE_BUF / sizeof(ClientRequest);
+    
+    for (int i = 0; i < numShards; i++) {
+        Shard *shard = &shards[i];
+        
+        for (int sent = 0; sent < shard->numOut; ) {
+            int count = shard->numOut - sent < perWrite ? shard->numOut - sent : perWrite;
+            ssize_t numWritten = write(shard->fd, &shard->out[sent], count * sizeof(ClientRequest));
+            if (numWritten == -1 && errno == EINTR) {
+                continue;
+            }
+            if (numWritten != (ssize_t)(count * sizeof(ClientRequest))) {
+                errLog(NULL, "write to backend %s", shard->fifoName);
+                
+                /* Writes this small are all or nothing, so nothing from sent on arrived */
+                for (int j = sent; j < shard->numOut; j++) {
+                    rejectRequest(&shard->out[j], "Shard unavailable, operation not processed");
+                }
+                break;
+            }
+            sent += count;
+            shard->ops += count;
+            shard->writes++;
+        }
+        shard->numOut = 0;
+    }
+}
+
+/* Answer a request the router cannot forward, on the client's response FIFO */
+void rejectRequest(const ClientRequest *req, const char *message) {
+    ServerResponse resp;
+    memset(&resp, 0, sizeof(ServerResponse));
+    resp.status = ERR_INVALID_OPERATION;
+    resp.clientIndex = req->operationIndex;
+    resp.traceId = req->traceId;
+    resp.numTxnOps = req->msgType == MSG_TRANSACTION ? req->numTxnOps : 0;
+    snprintf(resp.message, sizeof(resp.message), "%s", message);
+    
+    char clientFifo[CLIENT_FIFO_NAME_LEN];
+    snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d",
+             (long)req->pid, req->operationIndex);
+    
+    int clientFd = open(clientFifo, O_WRONLY | O_NONBLOCK);
+    if (clientFd == -1 || write(clientFd, &resp, sizeof(ServerResponse)) != sizeof(ServerResponse)) {
+        errLog(NULL, "reply to %s", clientFifo);
+    }
+    if (clientFd != -1) {
+        close(clientFd);
+    }
+    rejected++;
+}
+
+void handleRouterSignal(int sig) {
+    (void)sig;
+    stopRequested = 1;
+}
+
+void printRouterStats(void) {
+    for (int i = 0; i < numShards; i++) {
+        printf("Shard %d: ops=%ld writes=%ld ops_per_write=%.2f\n", i, shards[i].ops, shards[i].writes,
+               shards[i].writes > 0 ? (double)shards[i].ops / shards[i].writes : 0.0);
+    }
+    printf("Rejected: %ld\n", rejected);
+    fflush(stdout);
+}
@@ -0,0 +1,69 @@
+/* BankRouter.h
+ * Header file for the shard router
+ */
+#ifndef BANK_ROUTER_H
+#define BANK_ROUTER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "bank_shared.h"
+#include "bank_utils.h"
+
+#define MAX_SHARDS 16
+#define ROUTER_MAX_PENDING 2048     /* Requests held back until their client's batch is complete */
+#define ROUTER_MAX_CLIENTS 64       /* Clients with requests held back at the same time */
+#define ROUTER_FLUSH_MS 20          /* Longest a request waits for the rest of its client's batch */
+#define DEFAULT_RANGE_SIZE 100      /* Account numbers per shard in range mode, MAX_ACCOUNTS of a server */
+
+/* How account numbers map to shards */
+#define ROUTE_HASH 0    /* Shard (n - 1) % numShards */
+#define ROUTE_RANGE 1   /* Shard (n - 1) / rangeSize */
+
+/* One backend BankServer */
+typedef struct {
+    char fifoName[SERVER_FIFO_NAME_LEN];
+    int fd;                     /* Write end of the backend's server FIFO */
+    ClientRequest out[ROUTER_MAX_PENDING]; /* Requests waiting to be written */
+    int numOut;
+    long ops;                   /* Requests forwarded */
+    long writes;                /* write calls used to forward them */
+} Shard;
+
+/* A client whose batch is still arriving */
+typedef struct {
+    pid_t pid;
+    int expected;               /* batchSize announced by the client */
+    int received;               /* Requests held back so far */
+    struct timespec firstSeen;  /* Arrival of the oldest held back request */
+} RouterClient;
+
+/* A request held back, with the shard it goes to (-1 if answered here) */
+typedef struct {
+    ClientRequest req;
+    int shard;
+} PendingRequest;
+
+/* Function prototypes */
+void openShards(char *names[], int count);
+int shardForAccount(const char *bankId);
+int routeRequest(const ClientRequest *req);
+void holdRequest(const ClientRequest *req);
+void dispatchClient(pid_t pid);
+void dispatchExpired(int all);
+void flushShards(void);
+void rejectRequest(const ClientRequest *req, const char *message);
+void handleRouterSignal(int sig);
+void printRouterStats(void);
+
+#endif /* BANK_ROUTER_H */
@@ -7,27 +7,130 @@
 FILE *logFile = NULL;
 char serverFifo[SERVER_FIFO_NAME_LEN];
 int serverFd = -1, dummyFd = -1;
-BankDatabase bankDb;  /* Regular structure, not a pointer */
+AccountStore bankDb;  /* Column-oriented account store */
 int activeClients = 0;
 int lastClientId = 0;
 char bankName[50];
-sem_t *serverSem = NULL;
-BatchInfo currentBatch = {0, 0, 0}; /* Current batch being processed */
-ClientRequest batchRequests[MAX_BATCH_SIZE]; /* Array to store batch requests */
+SyncRegion *syncRegion = NULL;         /* FIFO and database locks, shared with forked children */
+Arena roundArena;                       /* State of the current scheduling round */
+BalanceSnapshot *balanceSnapshot = NULL; /* Lock-free balance view for queries */
+int maxTellers = DEFAULT_MAX_TELLERS;    /* Admission limit on concurrent tellers */
+int maxQueuedOps = MAX_QUEUED_OPS;      /* Admission limit on queued operations */
+int applyMode = APPLY_ROUND;            /* When collected teller requests are applied */
+HistoryIndex historyIndex = { .fd = -1 }; /* Per-account index of the log */
+char logFileName[64];
+int lazyLoad = 0;                       /* Start from the checkpoint, loading accounts on demand */
+Checkpoint lazyCheckpoint;              /* Mapped checkpoint while accounts are still loading */
+int lazyRemaining = 0;                  /* Checkpoint accounts not loaded yet */
+struct timespec serverStart;            /* For time-to-first-request */
+
+volatile sig_atomic_t upgradeRequested = 0; /* Set by SIGUSR2 */
+int takeoverFd = -1;                    /* Handover socket when started by an old server */
+char **serverArgv = NULL;               /* Command line, re-used to exec the new binary */
+int followMode = 0;                     /* Read-only replica of the bank's log */
+Replica replica;                        /* Log follower state in follow mode */
+int idFirst = 1;                        /* First account number this server hands out */
+int idStride = 1;                       /* Step between account numbers, the shard count behind a router */
+int idLast = INT_MAX;                   /* Last account number it may hand out, the end of a shard's range */
+int ioBackend = IO_SELECT;              /* How log and FIFO I/O reach the kernel */
+
+static uint32_t lazyNextSlot = 0;       /* Where the idle-time loader continues */
+static int traceApply = 0;              /* The running apply stage has sampled operations */
 
 /* Flag to track initialization status - NEW ADDITION */
 static int server_initialized = 0;
 
 /* Implementation of main function */
 int main(int argc, char *argv[]) {
+    clock_gettime(CLOCK_MONOTONIC, &serverStart);
+    serverArgv = argv;
+    
+    /* Parse admission control options; -U is only passed by a server handing over to us */
+    int opt, traceSample = 0;
+    while ((opt = getopt(argc, argv, "t:q:a:lFi:uT:U:")) != -1) {
+        switch (opt) {
+            case 't':
+                maxTellers = atoi(optarg);
+                break;
+            case 'q':
+                maxQueuedOps = atoi(optarg);
+                break;
+            case 'a':
+                if (strcmp(optarg, "round") == 0) {
+                    applyMode = APPLY_ROUND;
+                } else if (strcmp(optarg, "ready") == 0) {
+                    applyMode = APPLY_READY;
+                } else {
+                    argc = -1;
+                }
+                break;
+            case 'l':
+                lazyLoad = 1;
+                break;
+            case 'F':
+                followMode = 1;
+                break;
+            case 'i':
+                if (sscanf(optarg, "%d:%d:%d", &idFirst, &idStride, &idLast) < 2 || 
+                    idFirst < 1 || idStride < 1 || idLast < idFirst) {
+                    argc = -1;
+                }
+                break;
+            case 'u':
+                ioBackend = IO_URING;
+                break;
+            case 'T':
+                traceSample = atoi(optarg);
+                if (traceSample < 1) {
+                    argc = -1;
+                }
+                break;
+            case 'U':
+                takeoverFd = atoi(optarg);
+                break;
+            default:
+                argc = -1; /* Force the usage message */
+                break;
+        }
+    }
+    
     /* Check command line arguments */
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s BankName ServerFIFO_Name\n", argv[0]);
+    if (argc - optind != 2 || maxTellers < 1 || maxQueuedOps < 1) {
+        fprintf(stderr, "Usage: %s [-t maxTellers] [-q maxQueuedOps] [-a round|ready] [-l] [-F] [-i first:stride[:last]] [-u] [-T sampleRate] BankName ServerFIFO_Name\n", argv[0]);
         exit(EXIT_FAILURE);
     }
     
+    if (maxTellers > MAX_BATCH_SIZE) {
+        maxTellers = MAX_BATCH_SIZE;
+    }
+    if (maxQueuedOps > MAX_QUEUED_OPS) {
+        maxQueuedOps = MAX_QUEUED_OPS;
+    }
+    
+    /* All locks live in one shared mapping for the server's lifetime */
+    syncRegion = syncCreate();
+    if (syncRegion == NULL) {
+        errExit("mmap lock region");
+    }
+    
+    /* Counters too, so tellers can count what they answer themselves */
+    if (metricsInit() == -1) {
+        errExit("mmap metrics");
+    }
+    
+    /* Tellers record their spans in the same trace buffer */
+    if (traceSample > 0 && !followMode && traceInit(traceSample) == -1) {
+        errExit("mmap trace buffer");
+    }
+    
+    /* A follower only reads the bank's log and answers balance queries */
+    if (followMode) {
+        initializeFollower(argv, argv[optind], argv[optind + 1]);
+        followPrimary();
+    }
+    
     /* Initialize the server */
-    initializeServer(argv, argv[1], argv[2]);
+    initializeServer(argv, argv[optind], argv[optind + 1]);
     
     /* Wait for client connections */
     waitForClients();
@@ -38,6 +141,9 @@ int main(int argc, char *argv[]) {
 
 /* Custom process creation function */
 pid_t Teller(void* func, void* arg_func) {
+    /* Flush stdio first so the child does not replay buffered output or log lines */
+    fflush(NULL);
+    
     pid_t pid = fork();
     
     if (pid == -1) {
@@ -49,8 +155,7 @@ pid_t Teller(void* func, void* arg_func) {
         tellerFunc(arg_func);
         exit(EXIT_SUCCESS);
     }
-    free(arg_func); /* Free the argument passed to the teller */
-    /* Parent returns child's PID */
+    /* Parent returns child's PID; arg_func stays with the caller */
     return pid;
 }
 
@@ -67,31 +172,81 @@ void initializeServer(char *argv[], const char *name, const char *fifoName) {
     /* Match the format in the PDF exactly */
     printf("%s %s #%s\n", argv[0], bankName, fifoName);
     printf("%s is active...\n", bankName);
+    printf("Admission limits: %d concurrent tellers, %d queued operations\n", 
+           maxTellers, maxQueuedOps);
+    printf("Apply mode: %s\n", applyMode == APPLY_READY ? "ready" : "round");
+    
+    /* Fall back to plain system calls where io_uring is missing or disabled */
+    if (ioInit(ioBackend) == -1) {
+        printf("io_uring unavailable, using plain system calls\n");
+        ioBackend = IO_SELECT;
+    }
+    printf("I/O backend: %s\n", ioBackend == IO_URING ? "io_uring" : "syscalls");
+    
+    /* The crash recovery harness arms a fault through the environment */
+    int fault = faultInit();
+    if (fault == -2) {
+        errExit("Unknown fault point in %s", FAULT_ENV);
+    } else if (fault != FAULT_NONE) {
+        printf("Fault: armed at %s\n", getenv(FAULT_ENV));
+    }
     
     /* Create log file */
-    char logFileName[64];
     snprintf(logFileName, sizeof(logFileName), "%s.bankLog", bankName);
     
     /* Check if log file exists */
     int logExists = access(logFileName, F_OK) == 0;
     
+    /* After a crash the log may end in half a record; it was never
+     * acknowledged, so it is dropped before anything reads the log */
+    if (logExists && takeoverFd == -1) {
+        long torn = repairLogTail(logFileName);
+        if (torn == -1) {
+            errExit("Failed to check the end of %s", logFileName);
+        } else if (torn > 0) {
+            printf("Log ended in a torn record, dropped %ld bytes\n", torn);
+        }
+    }
+    
     /* Initialize the database */
     initializeDatabase();
     
+    /* In lazy mode, start from the shutdown checkpoint if it matches the log */
+    int lazyReady = 0;
+    if (lazyLoad && logExists && takeoverFd == -1) {
+        lazyReady = openLazyCheckpoint();
+    }
+    
     /* Read log file to get the last client ID and restore accounts if it exists */
-    if (logExists) {
+    if (takeoverFd != -1) {
+        /* Live upgrade: accounts and descriptors come from the old server */
+        receiveHandover();
+        
+        logFile = ioOpenLog(logFileName, "a");
+        if (logFile == NULL) {
+            errExit("Failed to open log file");
+        }
+        fprintf(logFile, "# %s Log file updated @%s\n", bankName, __TIME__);
+    } else if (lazyReady) {
+        lastClientId = lazyCheckpoint.header->lastClientId;
+        printf("Checkpoint found. Loading %d accounts on demand.\n", lazyRemaining);
+        server_initialized = 1;
+        
+        logFile = ioOpenLog(logFileName, "a");
+        if (logFile == NULL) {
+            errExit("Failed to open log file");
+        }
+        fprintf(logFile, "# %s Log file updated @%s\n", bankName, __TIME__);
+    } else if (logExists) {
+        struct timespec replayStart, replayEnd;
+        struct stat logStat;
+        clock_gettime(CLOCK_MONOTONIC, &replayStart);
+        
         /* First read the highest client ID */
         readLogFile(logFileName, &lastClientId);
         
         /* Now restore the accounts */
-        restoreDatabaseFromLog(logFileName, &bankDb);
-        
-        int activeAccounts = 0;
-        for (int i = 0; i < bankDb.numAccounts; i++) {
-            if (bankDb.accounts[i].active) {
-                activeAccounts++;
-            }
-        }
+        int activeAccounts = restoreDatabaseFromLog(logFileName, &bankDb);
         
         /* Only print initialization message once - NEW ADDITION */
         if (!server_initialized) {
@@ -99,8 +254,14 @@ void initializeServer(char *argv[], const char *name, const char *fifoName) {
             server_initialized = 1;
         }
         
+        clock_gettime(CLOCK_MONOTONIC, &replayEnd);
+        if (stat(logFileName, &logStat) == 0) {
+            printf("Replayed %ld log bytes in %.3fms\n", (long)logStat.st_size,
+                   timespecDiffMs(&replayStart, &replayEnd));
+        }
+        
         /* Open log file in APPEND mode */
-        logFile = fopen(logFileName, "a+");
+        logFile = ioOpenLog(logFileName, "a");
         if (logFile == NULL) {
             errExit("Failed to open log file");
         }
@@ -115,7 +276,7 @@ void initializeServer(char *argv[], const char *name, const char *fifoName) {
         }
         
         /* Open log file in write mode for first creation only */
-        logFile = fopen(logFileName, "w");
+        logFile = ioOpenLog(logFileName, "w");
         if (logFile == NULL) {
             errExit("Failed to open log file");
         }
@@ -125,6 +286,14 @@ void initializeServer(char *argv[], const char *name, const char *fifoName) {
         getCurrentTimeStr(timeStr, sizeof(timeStr));
         fprintf(logFile, "# %s Log file updated @%s\n\n", bankName, timeStr);
     }
+    fflush(logFile);
+    
+    /* Open the history index and index whatever it has not seen yet */
+    char indexName[80];
+    snprintf(indexName, sizeof(indexName), HISTORY_NAME_TEMPLATE, bankName);
+    if (historyOpen(&historyIndex, indexName, logFileName) == -1) {
+        errLog(logFile, "history index %s unavailable", indexName);
+    }
     
     /* Set up signal handlers */
     struct sigaction sa;
@@ -136,14 +305,17 @@ void initializeServer(char *argv[], const char *name, const char *fifoName) {
         errExitWithLog(logFile, "sigaction");
     }
     
-    /* Set up signal handler for child processes */
-    struct sigaction sa_chld;
-    sa_chld.sa_handler = handleChildSignal;
-    sigemptyset(&sa_chld.sa_mask);
-    sa_chld.sa_flags = SA_NOCLDSTOP;
+    /* A teller that died shows up as EPIPE on its response pipe */
+    signal(SIGPIPE, SIG_IGN);
+    
+    /* SIGUSR2 asks for a live upgrade to the binary on disk */
+    struct sigaction sa_upgrade;
+    sa_upgrade.sa_handler = handleUpgradeSignal;
+    sigemptyset(&sa_upgrade.sa_mask);
+    sa_upgrade.sa_flags = 0;
     
-    if (sigaction(SIGCHLD, &sa_chld, NULL) == -1) {
-        errExitWithLog(logFile, "sigaction for SIGCHLD");
+    if (sigaction(SIGUSR2, &sa_upgrade, NULL) == -1) {
+        errExitWithLog(logFile, "sigaction for SIGUSR2");
     }
     
     /* Create the server FIFO - using the template correctly */
@@ -155,18 +327,38 @@ void initializeServer(char *argv[], const char *name, const char *fifoName) {
         errExitWithLog(logFile, "mkfifo %s", serverFifo);
     }
     
-    /* Create semaphore for synchronizing access to the server FIFO */
-    serverSem = sem_open(pidToString(getpid()), O_CREAT, 0666, 1);
-    if (serverSem == SEM_FAILED) {
-        errExitWithLog(logFile, "sem_open for server FIFO");
+    /* Publish the restored accounts for lock-free balance queries */
+    balanceSnapshot = createSnapshot(serverFifo);
+    if (balanceSnapshot == NULL) {
+        errExitWithLog(logFile, "shm_open for balance snapshot");
+    }
+    publishSnapshot();
+    
+    /* Mapped once; scheduling rounds only bump and reset it */
+    if (arenaInit(&roundArena, ROUND_ARENA_SIZE) == -1) {
+        errExitWithLog(logFile, "mmap round arena");
+    }
+    
+    /* Scrapes are served by a thread of their own, off the main loop */
+    char metricsPath[SERVER_FIFO_NAME_LEN + 16];
+    snprintf(metricsPath, sizeof(metricsPath), METRICS_SOCKET_TEMPLATE, serverFifo);
+    if (metricsStartExporter(metricsPath) == -1) {
+        errLog(logFile, "metrics socket %s", metricsPath);
+    } else {
+        printf("Metrics at %s\n", metricsPath);
+    }
+    
+    /* Tell the old server it can go */
+    if (takeoverFd != -1) {
+        completeHandover();
     }
 }
 
 void cleanupServer(void) {
-    /* Close and remove semaphores */
-    if (serverSem != NULL && serverSem != SEM_FAILED) {
-        sem_close(serverSem);
-        sem_unlink(pidToString(getpid()));
+    /* Remove the balance snapshot */
+    if (balanceSnapshot != NULL) {
+        destroySnapshot(balanceSnapshot, serverFifo);
+        balanceSnapshot = NULL;
     }
     
     /* Close FIFOs */
@@ -178,6 +370,20 @@ void cleanupServer(void) {
         errLog(logFile, "unlink %s", serverFifo);
     }
     
+    /* A follower owns neither the log nor the index */
+    if (followMode) {
+        printReplicaStatus();
+        replicaClose(&replica);
+        storeFree(&bankDb);
+        printf("%s replica says \"Bye\"...\n", bankName);
+        return;
+    }
+    
+    metricsStopExporter();
+    
+    /* The dump below needs every account */
+    loadPendingAccounts(INT_MAX);
+    
     /* Update log file with final database state */
     char timeStr[30];
     getCurrentTimeStr(timeStr, sizeof(timeStr));
@@ -186,10 +392,10 @@ void cleanupServer(void) {
     
     /* Only write active accounts */
     for (int i = 0; i < bankDb.numAccounts; i++) {
-        if (bankDb.accounts[i].active) {
-            fprintf(logFile, "%s D 0 %d\n", 
-                    bankDb.accounts[i].bankId, 
-                    bankDb.accounts[i].balance);
+        if (storeIsActive(&bankDb, i)) {
+            fprintf(logFile, BANK_ID_FORMAT " D 0 %d\n", 
+                    bankDb.ids[i], 
+                    bankDb.balances[i]);
         }
     }
     
@@ -201,9 +407,386 @@ void cleanupServer(void) {
         fclose(logFile);
     }
     
+    /* Checkpoint the accounts so the next lazy start can skip the log */
+    struct stat logStat;
+    char ckptName[80];
+    snprintf(ckptName, sizeof(ckptName), CHECKPOINT_NAME_TEMPLATE, bankName);
+    if (stat(logFileName, &logStat) == -1 ||
+        checkpointWrite(ckptName, &bankDb, lastClientId, logStat.st_size) == -1) {
+        fprintf(stderr, "Failed to write checkpoint %s\n", ckptName);
+    }
+    storePrintMemory(&bankDb, stdout);
+    storeFree(&bankDb);
+    arenaFree(&roundArena);
+    
+    /* Index the final dump and mark the index clean */
+    historyClose(&historyIndex, logFileName);
+    
+    printMetrics(stdout);
+    writeTrace();
+    syncPrintStats(syncRegion, stdout);
+    ioPrintStats(stdout);
+    ioShutdown();
+    syncDestroy(syncRegion);
+    
     printf("%s says \"Bye\"...\n", bankName);
 }
 
+/* Live upgrade - old server side. Hands the FIFO descriptors, the accounts
+ * and the log position to a freshly exec'd server binary and exits. Requests
+ * written meanwhile wait in the FIFO, which stays open throughout. If the
+ * new server does not take over, this one keeps serving. */
+void liveUpgrade(void) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printf("Live upgrade requested, handing over to a new %s...\n", serverArgv[0]);
+    
+    /* Everything the new server needs must be on disk or in the state object */
+    syncLock(syncRegion, &syncRegion->dbLock);
+    loadPendingAccounts(INT_MAX);
+    commitLogFile(logFile);
+    historyClose(&historyIndex, logFileName);
+    
+    struct stat logStat;
+    if (fstat(ioLogFd(), &logStat) == -1) {
+        errLog(logFile, "fstat %s", logFileName);
+        abortUpgrade(-1, NULL, 0);
+        return;
+    }
+    
+    UpgradeMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.magic = UPGRADE_MAGIC;
+    msg.oldPid = getpid();
+    msg.logSize = logStat.st_size;
+    snprintf(msg.stateName, sizeof(msg.stateName), UPGRADE_NAME_TEMPLATE, (long)getpid());
+    
+    size_t stateSize;
+    UpgradeState *state = upgradeStateCreate(msg.stateName, &bankDb, lastClientId, &stateSize);
+    if (state == NULL) {
+        errLog(logFile, "shm_open %s", msg.stateName);
+        abortUpgrade(-1, NULL, 0);
+        return;
+    }
+    
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        errLog(logFile, "socketpair");
+        abortUpgrade(-1, state, stateSize);
+        shm_unlink(msg.stateName);
+        return;
+    }
+    
+    fflush(NULL);
+    pid_t newPid = fork();
+    if (newPid == -1) {
+        errLog(logFile, "fork for live upgrade");
+        close(sv[0]);
+        close(sv[1]);
+        abortUpgrade(-1, state, stateSize);
+        shm_unlink(msg.stateName);
+        return;
+    }
+    
+    if (newPid == 0) {
+        /* Only the handover socket is inherited, the FIFO travels over it */
+        close(sv[0]);
+        close(serverFd);
+        close(dummyFd);
+        close(ioLogFd());
+        
+        char fdArg[16];
+        snprintf(fdArg, sizeof(fdArg), "%d", sv[1]);
+        
+        char *newArgv[64];
+        int n = 0;
+        newArgv[n++] = serverArgv[0];
+        newArgv[n++] = "-U";
+        newArgv[n++] = fdArg;
+        for (int i = 1; serverArgv[i] != NULL && n < 63; i++) {
+            if (strcmp(serverArgv[i], "-U") == 0) {
+                i++; /* Drop the handover option of our own start */
+                continue;
+            }
+            newArgv[n++] = serverArgv[i];
+        }
+        newArgv[n] = NULL;
+        
+        execv(serverArgv[0], newArgv);
+        _exit(127);
+    }
+    
+    close(sv[1]);
+    int fds[2] = { serverFd, dummyFd };
+    msg.numFds = 2;
+    
+    /* Wait for the new server to confirm that it is serving */
+    int status = -1;
+    struct pollfd pfd = { .fd = sv[0], .events = POLLIN };
+    if (sendWithFds(sv[0], &msg, sizeof(msg), fds, msg.numFds) == 0 &&
+        poll(&pfd, 1, UPGRADE_TIMEOUT_MS) == 1 &&
+        read(sv[0], &status, sizeof(status)) != sizeof(status)) {
+        status = -1;
+    }
+    close(sv[0]);
+    shm_unlink(msg.stateName);
+    
+    if (status != 0) {
+        kill(newPid, SIGKILL);
+        waitpid(newPid, NULL, 0);
+        abortUpgrade(newPid, state, stateSize);
+        return;
+    }
+    munmap(state, stateSize);
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%s handed over to PID %ld in %.3fms\n", bankName, (long)newPid, 
+           timespecDiffMs(&start, &end));
+    
+    /* Leave the FIFO, the balance snapshot and the log to the new server */
+    closeSnapshot(balanceSnapshot);
+    close(serverFd);
+    close(dummyFd);
+    fclose(logFile);
+    storeFree(&bankDb);
+    
+    printMetrics(stdout);
+    writeTrace();
+    exit(EXIT_SUCCESS);
+}
+
+/* Resume serving after a failed handover */
+void abortUpgrade(pid_t newPid, UpgradeState *state, size_t stateSize) {
+    if (state != NULL) {
+        munmap(state, stateSize);
+    }
+    
+    char indexName[80];
+    snprintf(indexName, sizeof(indexName), HISTORY_NAME_TEMPLATE, bankName);
+    if (historyOpen(&historyIndex, indexName, logFileName) == -1) {
+        errLog(logFile, "history index %s unavailable", indexName);
+    }
+    syncUnlock(&syncRegion->dbLock);
+    
+    if (newPid > 0) {
+        printf("Live upgrade failed, new server PID %ld did not take over\n", (long)newPid);
+    } else {
+        printf("Live upgrade failed, still serving\n");
+    }
+}
+
+/* Live upgrade - new server side. Receives the descriptors and loads the
+ * old server's accounts; exits if anything does not match, in which case
+ * the old server carries on. */
+void receiveHandover(void) {
+    UpgradeMessage msg;
+    int fds[UPGRADE_MAX_FDS];
+    
+    if (recvWithFds(takeoverFd, &msg, sizeof(msg), fds, UPGRADE_MAX_FDS) != sizeof(msg) ||
+        msg.magic != UPGRADE_MAGIC || msg.numFds != 2 || fds[0] == -1 || fds[1] == -1) {
+        errExit("receiving the handover");
+    }
+    
+    struct stat logStat;
+    if (stat(logFileName, &logStat) == -1 || (uint64_t)logStat.st_size != msg.logSize) {
+        fprintf(stderr, "Log %s does not match the handover\n", logFileName);
+        exit(EXIT_FAILURE);
+    }
+    
+    size_t stateSize;
+    UpgradeState *state = upgradeStateOpen(msg.stateName, &stateSize);
+    if (state == NULL) {
+        errExit("shm_open %s", msg.stateName);
+    }
+    
+    for (int i = 0; i < state->numAccounts; i++) {
+        int index = storeAdd(&bankDb, state->accounts[i].accountId, state->accounts[i].balance);
+        if (index == -1) {
+            errExit("storeAdd");
+        }
+        storeSetActive(&bankDb, index, state->accounts[i].active);
+    }
+    lastClientId = state->lastClientId;
+    munmap(state, stateSize);
+    
+    /* The descriptors arrive close-on-exec; keep it that way */
+    serverFd = fds[0];
+    dummyFd = fds[1];
+    ioAttachServerFd(serverFd);
+    
+    printf("Taking over from PID %ld with %d accounts\n", (long)msg.oldPid, bankDb.numAccounts);
+    server_initialized = 1;
+}
+
+/* Report success to the old server, which then exits */
+void completeHandover(void) {
+    int status = 0;
+    if (write(takeoverFd, &status, sizeof(status)) != sizeof(status)) {
+        errExitWithLog(logFile, "confirming the handover");
+    }
+    close(takeoverFd);
+    takeoverFd = -1;
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("Ready for requests %.3fms after launch\n", timespecDiffMs(&serverStart, &now));
+    fflush(stdout);
+}
+
+/* Follow mode - set up a read-only replica of the bank's log */
+void initializeFollower(char *argv[], const char *name, const char *fifoName) {
+    strncpy(bankName, name, sizeof(bankName) - 1);
+    bankName[sizeof(bankName) - 1] = '\0';
+    snprintf(logFileName, sizeof(logFileName), "%s.bankLog", bankName);
+    
+    printf("%s %s #%s\n", argv[0], bankName, fifoName);
+    printf("%s replica is following %s...\n", bankName, logFileName);
+    
+    initializeDatabase();
+    replicaOpen(&replica, logFileName);
+    if (replica.watchFd == -1) {
+        printf("inotify unavailable, polling the log every %dms\n", REPLICA_POLL_MS);
+    }
+    
+    /* Catch up with everything the primary has written so far */
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    replicaPoll(&replica, &bankDb);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Replica caught up: %ld records, %d accounts in %.3fms\n", 
+           replica.records, bankDb.numAccounts, timespecDiffMs(&start, &end));
+    
+    struct sigaction sa;
+    sa.sa_handler = handleSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    
+    if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1) {
+        errExit("sigaction");
+    }
+    
+    snprintf(serverFifo, SERVER_FIFO_NAME_LEN, SERVER_FIFO_TEMPLATE, fifoName);
+    umask(0);
+    if (mkfifo(serverFifo, FIFO_PERM) == -1 && errno != EEXIST) {
+        errExit("mkfifo %s", serverFifo);
+    }
+    
+    balanceSnapshot = createSnapshot(serverFifo);
+    if (balanceSnapshot == NULL) {
+        errExit("shm_open for balance snapshot");
+    }
+    publishSnapshot();
+    
+    /* Do not wait for a client, the log has to be followed meanwhile */
+    serverFd = open(serverFifo, O_RDONLY | O_NONBLOCK);
+    if (serverFd == -1) {
+        errExit("open %s for reading", serverFifo);
+    }
+    dummyFd = open(serverFifo, O_WRONLY);
+    if (dummyFd == -1) {
+        errExit("open %s for writing", serverFifo);
+    }
+}
+
+/* Follow mode main loop: apply new log records as they are written and
+ * answer client requests in between. Never returns. */
+void followPrimary(void) {
+    time_t lastReport = time(NULL);
+    long reportedRecords = replica.records;
+    long seenResets = 0;
+    
+    printf("Waiting for clients @%s...\n", serverFifo);
+    
+    while (1) {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(serverFd, &readfds);
+        int maxFd = serverFd;
+        if (replica.watchFd != -1) {
+            FD_SET(replica.watchFd, &readfds);
+            if (replica.watchFd > maxFd) {
+                maxFd = replica.watchFd;
+            }
+        }
+        
+        /* inotify wakes us on every write; without it, poll the log */
+        struct timeval timeout;
+        if (replica.watchFd != -1) {
+            timeout.tv_sec = REPLICA_REPORT_SEC;
+            timeout.tv_usec = 0;
+        } else {
+            timeout.tv_sec = 0;
+            timeout.tv_usec = REPLICA_POLL_MS * 1000;
+        }
+        
+        int ready = select(maxFd + 1, &readfds, NULL, NULL, &timeout);
+        if (ready == -1) {
+            if (errno != EINTR) {
+                perror("select");
+            }
+            continue;
+        }
+        
+        if (replica.watchFd != -1 && FD_ISSET(replica.watchFd, &readfds)) {
+            replicaDrainEvents(&replica);
+        }
+        
+        /* The log is re-checked on every wakeup, so a watch lost to a
+         * recreated log is picked up again here */
+        if (replicaPoll(&replica, &bankDb) > 0 || replica.resets != seenResets) {
+            if (replica.resets != seenResets) {
+                printf("Primary log was recreated, replaying it from the start\n");
+                snapshotBeginWrite(balanceSnapshot);
+                balanceSnapshot->numAccounts = 0;
+                stampSnapshot();
+                snapshotEndWrite(balanceSnapshot);
+                seenResets = replica.resets;
+            }
+            publishSnapshot();
+        }
+        
+        if (FD_ISSET(serverFd, &readfds)) {
+            ClientRequest req;
+            while (syncRead(syncRegion, serverFd, &req, sizeof(ClientRequest)) == sizeof(ClientRequest)) {
+                handleReplicaRequest(&req);
+            }
+        }
+        
+        if (time(NULL) - lastReport >= REPLICA_REPORT_SEC && replica.records != reportedRecords) {
+            printReplicaStatus();
+            reportedRecords = replica.records;
+            lastReport = time(NULL);
+        }
+    }
+}
+
+/* Answer balance queries from the replica; everything else belongs to the primary */
+void handleReplicaRequest(ClientRequest *req) {
+    if (req->msgType == MSG_OPERATION && req->op == OP_BALANCE) {
+        answerBalanceQuery(req);
+        return;
+    }
+    
+    ServerResponse resp;
+    memset(&resp, 0, sizeof(ServerResponse));
+    resp.status = ERR_INVALID_OPERATION;
+    resp.clientIndex = req->operationIndex;
+    resp.traceId = req->traceId;
+    snprintf(resp.message, sizeof(resp.message), "Read-only replica, send updates to the primary");
+    
+    if (sendClientResponse(req, &resp) == 0) {
+        printf("Client%02d update rejected by the read-only replica\n", req->operationIndex);
+    }
+}
+
+void printReplicaStatus(void) {
+    printf("Replica: records=%ld accounts=%d offset=%lld lag_bytes=%lld apply_lag_ms=%.3f "
+           "apply_lag_max_ms=%.3f\n", 
+           replica.records, bankDb.numAccounts, (long long)replica.offset, 
+           (long long)(replica.logSize - replica.offset), replica.lastLagMs, replica.maxLagMs);
+    fflush(stdout);
+}
+
 /* Signal handlers */
 void handleSignal(int sig) {
     static int cleaning_up = 0;
@@ -217,10 +800,14 @@ void handleSignal(int sig) {
     printf("Signal received closing active Tellers\n");
     printf("Removing ServerFIFO... Updating log file...\n");
     
-    /* Send termination signal to all child processes */
-    kill(0, SIGTERM);
+    /* Send termination signal to all child processes. A replica has no
+     * tellers, and its group may well be the primary's. */
+    if (!followMode) {
+        kill(0, SIGTERM);
+    }
     
-    sleep(1); /* Give tellers a chance to exit */
+    /* Give tellers a chance to exit, but no longer than they need */
+    reapTellers(SHUTDOWN_GRACE_MS);
     
     /* Clean up resources */
     cleanupServer();
@@ -229,30 +816,43 @@ void handleSignal(int sig) {
     exit(EXIT_SUCCESS);
 }
 
-void handleChildSignal(int sig) {
+void handleUpgradeSignal(int sig) {
     (void)sig; /* Suppress unused parameter warning */
-    int savedErrno = errno;
-    pid_t childPid;
-    int status;
-    
-    /* Reap all terminated child processes */
-    while ((childPid = waitpid(-1, &status, WNOHANG)) > 0) {
-        activeClients--;
-        
-        if (childPid > 0) {
-            if (WIFEXITED(status)) {
-                if (WEXITSTATUS(status) != 0) {
-                    printLog(logFile, "ERROR: Teller %d exited with non-zero status %d", 
-                            childPid, WEXITSTATUS(status));
-                }
-            } else if (WIFSIGNALED(status)) {
-                printLog(logFile, "ERROR: Teller %d killed by signal %d", 
-                        childPid, WTERMSIG(status));
-            }
+    upgradeRequested = 1;
+}
+
+/* Reap tellers until none are left or timeoutMs has passed. Only used on
+ * shutdown, where the round's pidfds are out of reach; SIGCHLD is taken
+ * synchronously meanwhile, so every wakeup is a teller exiting. */
+void reapTellers(int timeoutMs) {
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+    
+    struct timespec deadline;
+    deadlineAfterMs(&deadline, timeoutMs);
+    
+    while (1) {
+        pid_t childPid;
+        while ((childPid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            activeClients--;
+        }
+        if (childPid == -1) {
+            break; /* No children left */
+        }
+        
+        int left = msUntil(&deadline);
+        if (left == 0) {
+            break;
+        }
+        struct timespec wait = { left / 1000, (long)(left % 1000) * 1000000 };
+        if (sigtimedwait(&chld, NULL, &wait) == -1 && errno == EAGAIN) {
+            break;
         }
     }
     
-    errno = savedErrno;
+    sigprocmask(SIG_SETMASK, &old, NULL);
 }
 
 /* Set up signal handling for teller processes */
@@ -280,12 +880,32 @@ int extractClientNumber(const char *bankId) {
 void waitForClients(void) {
     /* Main server loop */
     while (1) {
-        /* Print the waiting message at the beginning of each cycle */
-        printf("Waiting for clients @%s...\n", serverFifo);
+        /* Hand over to a new binary once the queued work is done */
+        if (upgradeRequested && !schedulerHasWork()) {
+            upgradeRequested = 0;
+            liveUpgrade();
+        }
+        
+        /* Print the waiting message whenever we run out of work */
+        if (!schedulerHasWork()) {
+            printf("Waiting for clients @%s...\n", serverFifo);
+        }
         
         /* Open the FIFO for reading if not already open */
         if (serverFd == -1) {
-            serverFd = open(serverFifo, O_RDONLY);
+            static int reported = 0;
+            if (!reported) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                printf("Ready for requests %.3fms after launch\n", timespecDiffMs(&serverStart, &now));
+                fflush(stdout);
+                reported = 1;
+            }
+            
+            /* Blocks until the first client opens the FIFO; an upgrade signal may interrupt it */
+            do {
+                serverFd = open(serverFifo, O_RDONLY);
+            } while (serverFd == -1 && errno == EINTR);
             if (serverFd == -1) {
                 errExitWithLog(logFile, "open %s for reading", serverFifo);
             }
@@ -295,226 +915,402 @@ void waitForClients(void) {
             if (dummyFd == -1) {
                 errExitWithLog(logFile, "open %s for writing", serverFifo);
             }
+            
+            /* Reads must not block while queued work is waiting to be scheduled */
+            fcntl(serverFd, F_SETFL, fcntl(serverFd, F_GETFL) | O_NONBLOCK);
+            ioAttachServerFd(serverFd);
         }
         
-        /* Reset batch information */
-        resetBatchInfo(&currentBatch);
-        
-        /* Read client requests */
-        ClientRequest req;
-        while (1) {
-            ssize_t numRead = read_mutually_exclusive(serverSem, serverFd, &req, sizeof(ClientRequest));
+        /* Nothing queued - sleep until a client writes something. While
+         * checkpoint accounts are still loading, load a chunk whenever
+         * there is nothing to read instead. */
+        if (!schedulerHasWork()) {
+            fd_set readfds;
+            FD_ZERO(&readfds);
+            FD_SET(serverFd, &readfds);
+            struct timeval noWait = {0, 0};
             
-            if (numRead != sizeof(ClientRequest)) {
-                if (numRead == -1 && errno != EINTR) {
-                    errLog(logFile, "read");
+            int ready = select(serverFd + 1, &readfds, NULL, NULL, lazyRemaining > 0 ? &noWait : NULL);
+            if (ready == -1) {
+                if (errno != EINTR) {
+                    errLog(logFile, "select");
                 }
-                break; /* Error or signal interruption */
+                continue;
             }
-            
-            /* If this is a new batch (different PID or first request), handle it */
-            if (currentBatch.pid != req.pid || currentBatch.total == 0) {
-                /* If we were already processing a batch, process it now */
-                if (currentBatch.pid != 0 && currentBatch.received > 0) {
-                    processBatch();
-                }
-                
-                /* Start a new batch */
-                currentBatch.pid = req.pid;
-                currentBatch.total = req.batchSize;
-                currentBatch.received = 0;
+            if (ready == 0) {
+                syncLock(syncRegion, &syncRegion->dbLock);
+                loadPendingAccounts(LAZY_LOAD_CHUNK);
+                syncUnlock(&syncRegion->dbLock);
+                continue;
             }
-            
-            /* Store the request in our batch array */
-            if (currentBatch.received < MAX_BATCH_SIZE) {
-                batchRequests[currentBatch.received] = req;
-                currentBatch.received++;
+        }
+        
+        /* Drain every request that is already waiting in the FIFO, so that
+         * clients arriving during a bulk batch join the very next round */
+        ClientRequest *reqs;
+        int numRead = 0;
+        while (!upgradeRequested) {
+            /* Up to IO_READ_BATCH requests per read */
+            syncLock(syncRegion, &syncRegion->fifoLock);
+            numRead = ioReadRequests(serverFd, &reqs);
+            syncUnlock(&syncRegion->fifoLock);
+            if (numRead <= 0) {
+                break;
             }
             
-            /* If we've received all requests in this batch, process it */
-            if (currentBatch.received >= currentBatch.total) {
-                processBatch();
-                resetBatchInfo(&currentBatch);
-                break; /* Exit read loop after processing a complete batch */
+            static int firstRequest = 1;
+            if (firstRequest) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                printf("Time to first request: %.3fms\n", timespecDiffMs(&serverStart, &now));
+                firstRequest = 0;
+            }
+            for (int i = 0; i < numRead; i++) {
+                BANK_PROBE5(request_receive, reqs[i].traceId, 
+                            reqs[i].isNewClient ? -1 : parseBankId(reqs[i].bankId),
+                            reqs[i].msgType == MSG_TRANSACTION ? OP_TRANSACTION : reqs[i].op,
+                            reqs[i].amount, reqs[i].pid);
+                handleClientRequest(&reqs[i]);
             }
         }
         
-        /* If the pipe was closed, sleep briefly to avoid busy waiting */
-        if (serverFd == -1) {
-            sleep(1);
+        if (numRead == -1 && errno != EAGAIN && errno != EINTR) {
+            errLog(logFile, "read");
+        }
+        
+        /* Run one fair round across all sessions with queued operations.
+         * Everything the round needs comes from the arena, released at once. */
+        ClientRequest *round = arenaAlloc(&roundArena, maxTellers * sizeof(ClientRequest));
+        int numRequests = round != NULL ? scheduleRound(round, maxTellers) : 0;
+        metricsSetGauges(0, queuedOps(), activeSessions());
+        processBatch(round, numRequests);
+        if (numRequests > 0) {
+            metricsRecordRound(roundArena.allocs, roundArena.used, roundArena.overflows);
         }
+        arenaReset(&roundArena);
+        retireSessions();
+        metricsSetGauges(0, queuedOps(), activeSessions());
     }
 }
 
-/* Improved processBatch function for true concurrency */
-void processBatch(void) {
-    /* Only process batches with clients */
-    if (currentBatch.pid == 0 || currentBatch.received == 0) {
-        return;
+/* Queue one request in its client's session, or answer it right away */
+void handleClientRequest(ClientRequest *req) {
+    /* Sampled requests are stamped on arrival, the rest carry no time */
+    req->receivedNs = 0;
+    if (traceSampled(req->traceId)) {
+        req->receivedNs = traceNow();
+        traceSpan(req->traceId, SPAN_CLIENT_FIFO, req->sentNs, req->receivedNs, 0);
     }
     
-    printf(" - Received %d clients from PID%d..\n", currentBatch.received, currentBatch.pid);
-    
-    /* Create all teller processes */
-    pid_t tellerPids[MAX_BATCH_SIZE] = {0};
-    int pipes[MAX_BATCH_SIZE][4] = {{-1}}; /* [i][0]=st_read, [i][1]=st_write, [i][2]=ts_read, [i][3]=ts_write */
-    
-    /* First set up all pipes */
-    for (int i = 0; i < currentBatch.received; i++) {
-        /* Create pipes */
-        if (pipe(pipes[i]) == -1 || pipe(pipes[i] + 2) == -1) {
-            errLog(logFile, "pipe creation failed");
-            /* Close any pipes we've created so far */
-            for (int j = 0; j <= i; j++) {
-                for (int k = 0; k < 4; k++) {
-                    if (pipes[j][k] != -1) {
-                        close(pipes[j][k]);
-                        pipes[j][k] = -1;
-                    }
-                }
-            }
-            return; /* Abort batch processing if pipe creation fails */
-        }
+    ClientSession *session = getSession(req->pid, req->batchSize, req->weight);
+    if (session == NULL) {
+        /* Too many concurrent clients */
+        rejectBusy(req);
+        return;
     }
     
-    /* Create a semaphore for database access */
-    sem_t *dbSem = sem_open("bank_db_mutex", O_CREAT, 0666, 1);
-    if (dbSem == SEM_FAILED) {
-        errLog(logFile, "sem_open for database failed");
-        return;
+    /* Balance queries are answered from the snapshot right away, without
+     * a teller or the database lock, unless an earlier operation of the
+     * same batch on that account is still queued */
+    if (req->msgType == MSG_OPERATION && req->op == OP_BALANCE && 
+        (req->isNewClient || !sessionUpdatesAccount(session, parseBankId(req->bankId))) &&
+        answerBalanceQuery(req) == 0) {
+        session->answered++;
+    } else if (queuedOps() >= maxQueuedOps || enqueueRequest(session, req) == -1) {
+        /* Queue is full - shed load with an immediate busy response */
+        rejectBusy(req);
+        session->answered++;
     }
     
-    /* Spawn all tellers simultaneously */
-    for (int i = 0; i < currentBatch.received; i++) {
-        /* Allocate memory for teller args - will be freed by teller */
-        struct TellerArgs *teller_arg = malloc(sizeof(struct TellerArgs));
-        if (!teller_arg) {
-            errLog(logFile, "malloc for teller args failed");
-            for (int k = 0; k < 4; k++) {
-                if (pipes[i][k] != -1) {
-                    close(pipes[i][k]);
-                    pipes[i][k] = -1;
-                }
+    if (sessionReceivedAll(session)) {
+        printf(" - Received %d clients from PID%d..\n", session->total, session->pid);
+    }
+}
+
+/* Account numbers a queued request names: its own, or those of its
+ * transaction ops. A new client has none yet. Returns how many. */
+static int requestAccounts(const ClientRequest *req, int *ids) {
+    int count = 0;
+    
+    if (req->msgType == MSG_TRANSACTION) {
+        for (int i = 0; i < req->numTxnOps && i < MAX_TXN_OPS; i++) {
+            ids[count++] = parseBankId(req->txnOps[i].bankId);
+            if (req->txnOps[i].op == OP_TRANSFER) {
+                ids[count++] = parseBankId(req->txnOps[i].toBankId);
             }
-            continue;
         }
-        
-        /* Set up teller args */
-        memset(teller_arg, 0, sizeof(struct TellerArgs));
-        teller_arg->client_req = batchRequests[i];
-        teller_arg->pipe_read = pipes[i][0];  /* teller reads from server_to_teller[0] */
-        teller_arg->pipe_write = pipes[i][3]; /* teller writes to teller_to_server[1] */
-        
-        /* Create teller process */
-        ClientRequest *req = &batchRequests[i];
-        int clientIndex = req->operationIndex;
-        void *func = req->op == OP_DEPOSIT ? depositTeller : withdrawTeller;
-        
-        /* Fork the teller */
-        tellerPids[i] = Teller(func, teller_arg);
-        
-        if (tellerPids[i] <= 0) {
-            /* Fork failed, clean up */
-            free(teller_arg);
-            for (int k = 0; k < 4; k++) {
-                if (pipes[i][k] != -1) {
-                    close(pipes[i][k]);
-                    pipes[i][k] = -1;
-                }
+    } else if (!req->isNewClient) {
+        ids[count++] = parseBankId(req->bankId);
+    }
+    return count;
+}
+
+/* Whether two queued requests name a common account */
+static int requestsShareAccount(const ClientRequest *a, const ClientRequest *b) {
+    int idsA[2 * MAX_TXN_OPS], idsB[2 * MAX_TXN_OPS];
+    int numA = requestAccounts(a, idsA);
+    int numB = requestAccounts(b, idsB);
+    
+    for (int i = 0; i < numA; i++) {
+        for (int j = 0; j < numB; j++) {
+            if (idsA[i] != -1 && idsA[i] == idsB[j]) {
+                return 1;
             }
-            continue;
-        }
-        
-        /* Parent process */
-        activeClients++;
-        
-        /* Close unused pipe ends in parent */
-        close(pipes[i][0]); pipes[i][0] = -1;
-        close(pipes[i][3]); pipes[i][3] = -1;
-        
-        /* Print teller activation message */
-        printf(" -- Teller %d is active serving Client%02d", tellerPids[i], clientIndex);
-        
-        if (!req->isNewClient && strlen(req->bankId) > 0) {
-            printf("...Welcome back Client%02d\n", clientIndex);
-        } else {
-            printf("...\n");
         }
     }
+    return 0;
+}
+
+/* Improved processBatch function for true concurrency */
+void processBatch(ClientRequest *requests, int numRequests) {
+    /* Only process rounds with clients */
+    if (numRequests == 0) {
+        return;
+    }
+    BANK_PROBE2(batch_start, numRequests, queuedOps());
+    
+    /* Teller processes, their pidfds and pipes, created lazily as tellers are admitted */
+    pid_t *tellerPids = arenaCalloc(&roundArena, numRequests, sizeof(pid_t));
+    int *pidfds = arenaAlloc(&roundArena, numRequests * sizeof(int));
+    struct timespec *started = arenaAlloc(&roundArena, numRequests * sizeof(struct timespec));
+    int (*pipes)[4] = arenaAlloc(&roundArena, numRequests * sizeof(*pipes)); /* [i][0]=st_read, [i][1]=st_write, [i][2]=ts_read, [i][3]=ts_write */
+    int nextTeller = 0;           /* Next queued request to hand to a teller */
+    
+    /* Tellers already reaped, and tellers killed for running past their deadline */
+    int *teller_completed = arenaCalloc(&roundArena, numRequests, sizeof(int));
+    int *timedOut = arenaCalloc(&roundArena, numRequests, sizeof(int));
+    
+    /* Requests handed in by tellers, held until the whole round can be applied */
+    TellerRequest *tellerReqs = arenaAlloc(&roundArena, numRequests * sizeof(TellerRequest));
+    ServerResponse *tellerResps = arenaAlloc(&roundArena, numRequests * sizeof(ServerResponse));
+    int *haveRequest = arenaCalloc(&roundArena, numRequests, sizeof(int));
+    int *answered = arenaCalloc(&roundArena, numRequests, sizeof(int));
+    int *applyNow = arenaAlloc(&roundArena, numRequests * sizeof(int));
+    long *collectedNs = arenaAlloc(&roundArena, numRequests * sizeof(long)); /* Sampled requests only */
+    
+    /* Response writes of one apply, submitted as a batch */
+    IoWrite *writes = arenaAlloc(&roundArena, numRequests * sizeof(IoWrite));
+    int *writeTeller = arenaAlloc(&roundArena, numRequests * sizeof(int));
+    
+    /* Scratch space for the apply stage, reused by every apply of the round */
+    ApplyScratch scratch;
+    scratch.pending = arenaAlloc(&roundArena, numRequests * sizeof(int));
+    scratch.groupReqs = arenaAlloc(&roundArena, numRequests * sizeof(TellerRequest *));
+    scratch.groupResps = arenaAlloc(&roundArena, numRequests * sizeof(ServerResponse *));
+    
+    if (tellerPids == NULL || pidfds == NULL || started == NULL || pipes == NULL || 
+        teller_completed == NULL || timedOut == NULL || tellerReqs == NULL ||
+        tellerResps == NULL || haveRequest == NULL || answered == NULL || applyNow == NULL || 
+        collectedNs == NULL ||
+        writes == NULL || writeTeller == NULL ||
+        scratch.pending == NULL || scratch.groupReqs == NULL || scratch.groupResps == NULL) {
+        errLog(logFile, "round arena exhausted");
+        for (int i = 0; i < numRequests; i++) {
+            rejectBusy(&requests[i]);
+        }
+        return;
+    }
+    
+    for (int i = 0; i < numRequests; i++) {
+        for (int k = 0; k < 4; k++) {
+            pipes[i][k] = -1;
+        }
+        pidfds[i] = -1;
+    }
     
-    /* Set up an fd_set for all pipe descriptors for reading */
-    fd_set readfds;
-    int maxfd, remaining_tellers;
-    
-    /* Create arrays to track which tellers need to be responded to and which are completed */
-    int teller_completed[MAX_BATCH_SIZE] = {0};
+    /* Set up an fd_set for all pipe descriptors and pidfds for reading */
+    fd_set readfds;
+    int maxfd, remaining_tellers;
     
-    /* Process teller communications using non-blocking select to allow concurrency */
+    /* Every teller stays in the loop until its pidfd reports the exit and
+     * it is reaped, so the round ends with no teller left behind */
     do {
         FD_ZERO(&readfds);
         maxfd = -1;
         remaining_tellers = 0;
+        int collected = 0, awaiting = 0;
+        int waitMs = -1; /* Until the nearest teller deadline */
         
-        /* Add all active teller read pipes to the set */
-        for (int i = 0; i < currentBatch.received; i++) {
-            if (!teller_completed[i] && pipes[i][2] != -1) {
-                FD_SET(pipes[i][2], &readfds);
-                if (pipes[i][2] > maxfd) {
-                    maxfd = pipes[i][2];
+        for (int i = 0; i < nextTeller; i++) {
+            if (teller_completed[i]) {
+                continue;
+            }
+            remaining_tellers++;
+            
+            /* Readable once the teller has exited */
+            FD_SET(pidfds[i], &readfds);
+            if (pidfds[i] > maxfd) {
+                maxfd = pidfds[i];
+            }
+            if (!timedOut[i]) {
+                int left = tellerTimeLeft(&started[i]);
+                if (waitMs == -1 || left < waitMs) {
+                    waitMs = left;
                 }
-                remaining_tellers++;
             }
+            
+            if (pipes[i][2] == -1) {
+                continue; /* Only its exit is left */
+            }
+            if (haveRequest[i]) {
+                collected++;
+                continue; /* Waiting for the apply stage */
+            }
+            if (!answered[i]) {
+                awaiting++;
+            }
+            
+            FD_SET(pipes[i][2], &readfds);
+            if (pipes[i][2] > maxfd) {
+                maxfd = pipes[i][2];
+            }
+        }
+        
+        /* Admit queued requests while we are below the concurrent teller limit */
+        while (remaining_tellers < maxTellers && nextTeller < numRequests) {
+            int i = nextTeller++;
+            
+            if (spawnTeller(&requests[i], &tellerPids[i], &pidfds[i], pipes[i]) == -1) {
+                teller_completed[i] = 1;
+                continue; /* Client already got a busy response */
+            }
+            FAULT_POINT(FAULT_TELLER_SPAWN);
+            clock_gettime(CLOCK_MONOTONIC, &started[i]);
+            
+            FD_SET(pidfds[i], &readfds);
+            FD_SET(pipes[i][2], &readfds);
+            if (pidfds[i] > maxfd) {
+                maxfd = pidfds[i];
+            }
+            if (pipes[i][2] > maxfd) {
+                maxfd = pipes[i][2];
+            }
+            if (waitMs == -1 || TELLER_TIMEOUT_MS < waitMs) {
+                waitMs = TELLER_TIMEOUT_MS;
+            }
+            remaining_tellers++;
+            awaiting++;
         }
         
+        metricsSetActiveTellers(remaining_tellers);
         if (remaining_tellers == 0) {
-            break; /* No active tellers */
+            break; /* No active tellers and nothing left to admit */
         }
         
-        /* Set up a short timeout to make select non-blocking */
-        struct timeval tv;
-        tv.tv_sec = 1;
-        tv.tv_usec = 250000; /* 10ms timeout - fast enough for responsive service */
+        /* Pick the collected requests to apply. In round mode this waits
+         * until every admitted teller has handed in its request or gone
+         * away. In ready mode a request also waits while an earlier one of
+         * the round on the same account is still due, so every account sees
+         * its operations, and the log its records, in batch order. */
+        int ready = 0;
+        if (collected > 0 && (awaiting == 0 || applyMode == APPLY_READY)) {
+            for (int i = 0; i < nextTeller; i++) {
+                applyNow[i] = haveRequest[i];
+                
+                for (int j = 0; j < i && applyNow[i]; j++) {
+                    int due = !answered[j] && (haveRequest[j] ? !applyNow[j] :
+                                               !teller_completed[j] && pipes[j][2] != -1);
+                    if (due && requestsShareAccount(&requests[i], &requests[j])) {
+                        applyNow[i] = 0;
+                    }
+                }
+                ready += applyNow[i];
+            }
+        }
         
-        /* Try to read from any ready teller */
-        int select_result = select(maxfd + 1, &readfds, NULL, NULL, &tv);
+        /* Apply them under one lock hold and send each teller its response */
+        if (ready > 0) {
+            struct timespec lockStart, lockEnd;
+            long lockRequestNs = 0, lockedNs = 0, releasedNs = 0;
+            
+            int numWrites = 0;
+            
+            /* The apply stage is traced along with the sampled requests in it */
+            traceApply = 0;
+            for (int i = 0; i < nextTeller && traceRate > 0; i++) {
+                if (applyNow[i] && tellerReqs[i].traceId != 0) {
+                    traceApply = 1;
+                }
+            }
+            
+            ioHoldLog();
+            if (traceApply) {
+                lockRequestNs = traceNow();
+            }
+            syncLock(syncRegion, &syncRegion->dbLock);
+            clock_gettime(CLOCK_MONOTONIC, &lockStart);
+            if (traceApply) {
+                lockedNs = traceNow();
+            }
+            applyBatch(tellerReqs, tellerResps, applyNow, nextTeller, &scratch);
+            clock_gettime(CLOCK_MONOTONIC, &lockEnd);
+            syncUnlock(&syncRegion->dbLock);
+            FAULT_POINT(FAULT_BATCH_APPLY);
+            
+            metricsRecordApply(ready, timespecDiffMs(&lockStart, &lockEnd));
+            if (traceApply) {
+                releasedNs = traceNow();
+                traceSpan(0, SPAN_LOCK_WAIT, lockRequestNs, lockedNs, ready);
+                traceSpan(0, SPAN_LOCK_HOLD, lockedNs, releasedNs, ready);
+            }
+            
+            for (int i = 0; i < nextTeller; i++) {
+                if (!applyNow[i]) {
+                    continue;
+                }
+                haveRequest[i] = 0;
+                answered[i] = 1;
+                metricsRecordResult(tellerReqs[i].operation, tellerResps[i].status);
+                if (tellerReqs[i].traceId != 0) {
+                    traceSpan(tellerReqs[i].traceId, SPAN_ROUND_WAIT, collectedNs[i], lockRequestNs, 0);
+                    traceSpan(tellerReqs[i].traceId, SPAN_APPLY, lockRequestNs, releasedNs, 0);
+                }
+                
+                if (pipes[i][1] != -1) {
+                    writes[numWrites].fd = pipes[i][1];
+                    writes[numWrites].buf = &tellerResps[i];
+                    writes[numWrites].len = sizeof(ServerResponse);
+                    writeTeller[numWrites++] = i;
+                }
+            }
+            
+            /* The round's log records and responses go out together */
+            ioWriteBatch(writes, numWrites);
+            FAULT_POINT(FAULT_BATCH_REPLY);
+            if (traceApply) {
+                traceSpan(0, SPAN_IO_SUBMIT, releasedNs, traceNow(), numWrites);
+                traceApply = 0;
+            }
+            for (int w = 0; w < numWrites; w++) {
+                if (writes[w].result != sizeof(ServerResponse)) {
+                    /* Error writing */
+                    close(pipes[writeTeller[w]][1]);
+                    pipes[writeTeller[w]][1] = -1;
+                }
+            }
+            continue;
+        }
+        
+        /* Sleep until a teller hands in its request, a teller exits or the
+         * nearest teller deadline passes */
+        struct timeval tv = { waitMs / 1000, (waitMs % 1000) * 1000 };
+        int select_result = select(maxfd + 1, &readfds, NULL, NULL, waitMs >= 0 ? &tv : NULL);
         
         if (select_result < 0 && errno != EINTR) {
             errLog(logFile, "select failed");
             break;
-        } else if (select_result == 0) {
-            /* No descriptors ready - check for finished tellers */
-            for (int i = 0; i < currentBatch.received; i++) {
-                if (!teller_completed[i] && tellerPids[i] > 0) {
-                    int status;
-                    pid_t result = waitpid(tellerPids[i], &status, WNOHANG);
-                    if (result > 0) {
-                        /* Teller has completed */
-                        teller_completed[i] = 1;
-                        
-                        /* Close its pipes */
-                        if (pipes[i][1] != -1) {
-                            close(pipes[i][1]);
-                            pipes[i][1] = -1;
-                        }
-                        if (pipes[i][2] != -1) {
-                            close(pipes[i][2]);
-                            pipes[i][2] = -1;
-                        }
-                    }
-                }
-            }
-            continue; /* Try again */
+        } else if (select_result < 0) {
+            continue; /* Interrupted, fd_set is undefined */
         }
         
-        /* Process tellers with ready data */
-        for (int i = 0; i < currentBatch.received; i++) {
+        /* Collect requests from tellers with ready data */
+        for (int i = 0; i < nextTeller; i++) {
             if (!teller_completed[i] && pipes[i][2] != -1 && FD_ISSET(pipes[i][2], &readfds)) {
                 /* Read teller request */
-                TellerRequest teller_req;
-                ssize_t numRead = read(pipes[i][2], &teller_req, sizeof(TellerRequest));
+                ssize_t numRead = read(pipes[i][2], &tellerReqs[i], sizeof(TellerRequest));
                 
-                if (numRead != sizeof(TellerRequest)) {
-                    /* Error or partial read */
+                if (numRead != sizeof(TellerRequest) || answered[i]) {
+                    /* Error, partial read or the teller finished */
                     if (pipes[i][2] != -1) {
                         close(pipes[i][2]);
                         pipes[i][2] = -1;
@@ -526,71 +1322,205 @@ void processBatch(void) {
                     continue;
                 }
                 
-                /* Process database request - here's where concurrency happens */
-                ServerResponse server_resp;
-                memset(&server_resp, 0, sizeof(ServerResponse));
-                int clientIndex = batchRequests[i].operationIndex;
-                
-                /* Lock the database for thread safety */
-                sem_wait(dbSem);
-                
-                /* Process the database request */
-                processDatabaseRequest(&teller_req, &server_resp, clientIndex);
-                
-                /* Unlock the database */
-                sem_post(dbSem);
-                
-                /* Send response back to teller immediately */
-                if (pipes[i][1] != -1) {
-                    if (write(pipes[i][1], &server_resp, sizeof(ServerResponse)) != sizeof(ServerResponse)) {
-                        /* Error writing */
-                        close(pipes[i][1]);
-                        pipes[i][1] = -1;
-                    }
+                haveRequest[i] = 1;
+                if (tellerReqs[i].traceId != 0) {
+                    collectedNs[i] = traceNow();
                 }
             }
         }
+        
+        /* Reap the tellers that exited, and kill the ones past their deadline.
+         * A teller reaped before its request was applied gets nothing applied:
+         * it has already told its client that the server timed out. */
+        for (int i = 0; i < nextTeller; i++) {
+            if (teller_completed[i]) {
+                continue;
+            }
+            
+            if (FD_ISSET(pidfds[i], &readfds)) {
+                reapTeller(tellerPids[i], pidfds[i], &started[i], timedOut[i]);
+                closeTellerPipes(pipes[i]);
+                pidfds[i] = -1;
+                haveRequest[i] = 0;
+                teller_completed[i] = 1;
+            } else if (!timedOut[i] && tellerTimeLeft(&started[i]) == 0) {
+                printLog(logFile, "ERROR: Teller %d still running after %dms, killing it", 
+                         tellerPids[i], TELLER_TIMEOUT_MS);
+                pidfd_send_signal(pidfds[i], SIGKILL, NULL, 0);
+                timedOut[i] = 1;
+            }
+        }
     } while (remaining_tellers > 0);
     
-    /* Clean up semaphore */
-    sem_close(dbSem);
-    sem_unlink("bank_db_mutex");
+    /* Only tellers left behind by a select failure are still here */
+    for (int i = 0; i < nextTeller; i++) {
+        if (!teller_completed[i]) {
+            pidfd_send_signal(pidfds[i], SIGKILL, NULL, 0);
+            reapTeller(tellerPids[i], pidfds[i], &started[i], 1);
+            closeTellerPipes(pipes[i]);
+        }
+    }
+    BANK_PROBE2(batch_done, numRequests, nextTeller);
+}
+
+/* Milliseconds a teller started at *started has left before it is killed */
+int tellerTimeLeft(const struct timespec *started) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
     
-    /* Clean up any remaining pipes and wait for tellers */
-    for (int i = 0; i < currentBatch.received; i++) {
-        /* Close any remaining pipe descriptors */
-        for (int k = 0; k < 4; k++) {
-            if (pipes[i][k] != -1) {
-                close(pipes[i][k]);
-                pipes[i][k] = -1;
-            }
-        }
-        
-        /* Wait for any teller that's still running */
-        if (tellerPids[i] > 0 && !teller_completed[i]) {
-            int status;
-            if (waitpid(tellerPids[i], &status, WNOHANG) == 0) {
-                /* Give it a little time, then try again */
-                usleep(50000); /* 50ms */
-                if (waitpid(tellerPids[i], &status, WNOHANG) == 0) {
-                    /* If still running, terminate it */
-                    kill(tellerPids[i], SIGTERM);
-                    waitpid(tellerPids[i], &status, 0);
-                }
-            }
+    double left = TELLER_TIMEOUT_MS - timespecDiffMs(started, &now);
+    return left > 0 ? (int)(left + 0.999) : 0;
+}
+
+/* Collect the exit status of a teller whose pidfd is readable (or that was
+ * just killed), log abnormal exits and account for its lifetime */
+void reapTeller(pid_t pid, int pidfd, const struct timespec *started, int timedOut) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    
+    while (waitid(P_PIDFD, pidfd, &info, WEXITED) == -1 && errno == EINTR) {
+        continue;
+    }
+    close(pidfd);
+    activeClients--;
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    int failed = info.si_code == CLD_EXITED && info.si_status != 0;
+    int signaled = info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED;
+    if (failed) {
+        printLog(logFile, "ERROR: Teller %d exited with non-zero status %d", pid, info.si_status);
+    } else if (signaled && !timedOut) {
+        printLog(logFile, "ERROR: Teller %d killed by signal %d", pid, info.si_status);
+    }
+    
+    double lifetimeMs = timespecDiffMs(started, &now);
+    metricsRecordTeller(lifetimeMs, failed, signaled, timedOut);
+    BANK_PROBE3(teller_exit, pid, signaled ? -info.si_status : info.si_status, 
+                (long)(lifetimeMs * 1000000.0));
+}
+
+/* Fork a teller for one queued request, wire up its pipes and open the
+ * pidfd its exit is watched through. If any of them cannot be created the
+ * client gets an explicit busy response instead of a silent drop.
+ * Returns 0 on success, -1 otherwise. */
+int spawnTeller(ClientRequest *req, pid_t *tellerPid, int *pidfd, int tellerPipes[4]) {
+    /* Create pipes */
+    if (pipe(tellerPipes) == -1 || pipe(tellerPipes + 2) == -1) {
+        errLog(logFile, "pipe creation failed");
+        closeTellerPipes(tellerPipes);
+        rejectBusy(req);
+        return -1;
+    }
+    
+    /* Teller args live in the round arena; the child gets its own copy with the fork */
+    struct TellerArgs *teller_arg = arenaAlloc(&roundArena, sizeof(struct TellerArgs));
+    if (!teller_arg) {
+        errLog(logFile, "round arena exhausted for teller args");
+        closeTellerPipes(tellerPipes);
+        rejectBusy(req);
+        return -1;
+    }
+    
+    /* Set up teller args */
+    memset(teller_arg, 0, sizeof(struct TellerArgs));
+    teller_arg->client_req = *req;
+    teller_arg->pipe_read = tellerPipes[0];  /* teller reads from server_to_teller[0] */
+    teller_arg->pipe_write = tellerPipes[3]; /* teller writes to teller_to_server[1] */
+    if (req->receivedNs != 0) {
+        teller_arg->traceId = req->traceId;
+        teller_arg->spawnNs = traceNow();
+        traceSpan(req->traceId, SPAN_SCHEDULED, req->receivedNs, teller_arg->spawnNs, 0);
+    }
+    teller_arg->stall = faultArmed == FAULT_TELLER_STALL && faultHit(FAULT_TELLER_STALL);
+    
+    /* Create teller process */
+    int clientIndex = req->operationIndex;
+    void *func;
+    if (req->msgType == MSG_TRANSACTION) {
+        func = transactionTeller;
+    } else if (req->op == OP_BALANCE) {
+        func = balanceTeller; /* Client FIFO was not ready for an inline answer */
+    } else {
+        func = req->op == OP_DEPOSIT ? depositTeller : withdrawTeller;
+    }
+    
+    /* Fork the teller */
+    *tellerPid = Teller(func, teller_arg);
+    
+    if (*tellerPid <= 0) {
+        /* Fork failed (e.g. process limit reached), clean up */
+        closeTellerPipes(tellerPipes);
+        rejectBusy(req);
+        return -1;
+    }
+    
+    /* Nothing else reaps our children, so the PID cannot be reused before we open this */
+    *pidfd = pidfd_open(*tellerPid, 0);
+    if (*pidfd == -1) {
+        errLog(logFile, "pidfd_open for teller %d", *tellerPid);
+        kill(*tellerPid, SIGKILL);
+        waitpid(*tellerPid, NULL, 0);
+        closeTellerPipes(tellerPipes);
+        rejectBusy(req);
+        return -1;
+    }
+    
+    /* Parent process */
+    activeClients++;
+    BANK_PROBE5(teller_spawn, req->traceId, req->isNewClient ? -1 : parseBankId(req->bankId),
+                req->msgType == MSG_TRANSACTION ? OP_TRANSACTION : req->op, req->amount, *tellerPid);
+    
+    /* Close unused pipe ends in parent */
+    close(tellerPipes[0]); tellerPipes[0] = -1;
+    close(tellerPipes[3]); tellerPipes[3] = -1;
+    
+    /* Print teller activation message */
+    printf(" -- Teller %d is active serving Client%02d", *tellerPid, clientIndex);
+    
+    if (req->msgType == MSG_TRANSACTION) {
+        printf("...transaction of %d ops\n", req->numTxnOps);
+    } else if (!req->isNewClient && strlen(req->bankId) > 0) {
+        printf("...Welcome back Client%02d\n", clientIndex);
+    } else {
+        printf("...\n");
+    }
+    
+    return 0;
+}
+
+void closeTellerPipes(int tellerPipes[4]) {
+    for (int k = 0; k < 4; k++) {
+        if (tellerPipes[k] != -1) {
+            close(tellerPipes[k]);
+            tellerPipes[k] = -1;
         }
     }
 }
 
-/* Reset batch information */
-void resetBatchInfo(BatchInfo *batch) {
-    batch->pid = 0;
-    batch->total = 0;
-    batch->received = 0;
+/* Tell a client right away that the server cannot take this operation */
+void rejectBusy(ClientRequest *req) {
+    ServerResponse resp;
+    memset(&resp, 0, sizeof(ServerResponse));
+    resp.status = ERR_SERVER_BUSY;
+    resp.clientIndex = req->operationIndex;
+    strcpy(resp.message, "Server busy, please try again later");
+    resp.traceId = req->traceId;
+    metricsRecordResult(req->msgType == MSG_TRANSACTION ? OP_TRANSACTION : req->op, ERR_SERVER_BUSY);
+    
+    if (sendClientResponse(req, &resp) == -1) {
+        errLog(logFile, "busy response to PID%d", req->pid);
+    }
+    if (req->receivedNs != 0) {
+        traceSpan(req->traceId, SPAN_REJECTED, req->receivedNs, traceNow(), 0);
+    }
+    
+    printf("Client%02d rejected... server busy\n", req->operationIndex);
 }
 
 /* Fixed tellerProcess function with proper fd_set declaration */
-void *tellerProcess(void *arg, int isDeposit) {
+void *tellerProcess(void *arg, int operation) {
     /* Set up teller signals */
     setupTellerSignals();
     
@@ -605,10 +1535,12 @@ void *tellerProcess(void *arg, int isDeposit) {
     ClientRequest *req = &teller_arg->client_req;
     int pipe_read = teller_arg->pipe_read;
     int pipe_write = teller_arg->pipe_write;
+    unsigned long traceId = teller_arg->traceId;
+    long startNs = traceId != 0 ? traceNow() : 0;
+    traceSpan(traceId, SPAN_FORK, teller_arg->spawnNs, startNs, 0);
     
     /* Validate pipe descriptors */
     if (pipe_read < 0 || pipe_write < 0) {
-        free(teller_arg);
         exit(1); /* Bad pipe descriptors */
     }
     
@@ -617,66 +1549,63 @@ void *tellerProcess(void *arg, int isDeposit) {
     snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d", 
              (long)req->pid, req->operationIndex);
     
-    /* Open the FIFO for writing without blocking for too long */
-    int clientFd = -1;
-    
-    /* Try to open in non-blocking mode first with retries */
-    for (int attempt = 0; attempt < 10 && clientFd == -1; attempt++) {
-        clientFd = open(clientFifo, O_WRONLY | O_NONBLOCK);
-        
-        if (clientFd == -1) {
-            if (errno == ENXIO) {
-                /* No reader yet, sleep briefly and retry */
-                usleep(50000); /* 50ms */
-            } else {
-                /* Other error */
-                break;
-            }
-        } else {
-            /* Success - switch back to blocking mode */
-            int flags = fcntl(clientFd, F_GETFL);
-            fcntl(clientFd, F_SETFL, flags & ~O_NONBLOCK);
-            break;
-        }
+    /* Open the FIFO for writing, waiting for the client to open its end
+     * but not for too long */
+    int clientFd = openWithTimeout(clientFifo, O_WRONLY, TELLER_OPEN_TIMEOUT_MS);
+    if (traceId != 0) {
+        traceSpan(traceId, SPAN_OPEN_CLIENT, startNs, traceNow(), 0);
     }
     
     if (clientFd == -1) {
-        /* Still couldn't open client FIFO after retries */
+        /* The client never showed up */
         close(pipe_read);
         close(pipe_write);
-        free(teller_arg);
         exit(2);
     }
     
     /* For withdraw operation, validate new client cannot withdraw */
-    if (!isDeposit && req->isNewClient) {
+    if (operation == OP_WITHDRAW && req->isNewClient) {
         ServerResponse client_resp;
         memset(&client_resp, 0, sizeof(ServerResponse));
         client_resp.status = ERR_INVALID_OPERATION;
         strcpy(client_resp.message, "New clients cannot withdraw. Please deposit first.");
         client_resp.clientIndex = req->operationIndex;
+        client_resp.traceId = req->traceId;
+        metricsRecordResult(OP_WITHDRAW, ERR_INVALID_OPERATION);
         
         write(clientFd, &client_resp, sizeof(ServerResponse));
         
         close(clientFd);
         close(pipe_read);
         close(pipe_write);
-        free(teller_arg);
         exit(EXIT_SUCCESS);
     }
     
     /* Prepare request for the server */
     TellerRequest teller_req;
     memset(&teller_req, 0, sizeof(TellerRequest));
-    teller_req.operation = isDeposit ? OP_DEPOSIT : OP_WITHDRAW;
+    teller_req.operation = operation;
     teller_req.amount = req->amount;
     teller_req.isNewClient = req->isNewClient;
     teller_req.clientPid = req->pid;
     teller_req.clientIndex = req->operationIndex;
+    teller_req.traceId = traceId;
+    
+    /* From here on accounts are only known by number */
+    teller_req.accountId = req->isNewClient ? -1 : parseBankId(req->bankId);
+    
+    if (operation == OP_TRANSACTION) {
+        teller_req.numTxnOps = req->numTxnOps;
+        for (int i = 0; i < req->numTxnOps && i < MAX_TXN_OPS; i++) {
+            teller_req.txnOps[i].op = req->txnOps[i].op;
+            teller_req.txnOps[i].amount = req->txnOps[i].amount;
+            teller_req.txnOps[i].accountId = parseBankId(req->txnOps[i].bankId);
+            teller_req.txnOps[i].toAccountId = parseBankId(req->txnOps[i].toBankId);
+        }
+    }
     
-    if (strlen(req->bankId) > 0) {
-        strncpy(teller_req.bankId, req->bankId, sizeof(teller_req.bankId) - 1);
-        teller_req.bankId[sizeof(teller_req.bankId) - 1] = '\0';
+    if (teller_arg->stall) {
+        usleep(TELLER_STALL_MS * 1000);
     }
     
     /* Send request to main server - use non-blocking write with timeout */
@@ -696,17 +1625,18 @@ void *tellerProcess(void *arg, int isDeposit) {
         client_resp.status = ERR_INVALID_OPERATION;
         strcpy(client_resp.message, "Server communication error");
         client_resp.clientIndex = req->operationIndex;
+        client_resp.traceId = req->traceId;
         
         write(clientFd, &client_resp, sizeof(ServerResponse));
         
         close(clientFd);
         close(pipe_read);
         close(pipe_write);
-        free(teller_arg);
         exit(3);
     }
     
     /* Write when ready */
+    long awaitNs = traceId != 0 ? traceNow() : 0;
     if (write(pipe_write, &teller_req, sizeof(TellerRequest)) != sizeof(TellerRequest)) {
         /* Write error */
         ServerResponse client_resp;
@@ -714,13 +1644,13 @@ void *tellerProcess(void *arg, int isDeposit) {
         client_resp.status = ERR_INVALID_OPERATION;
         strcpy(client_resp.message, "Failed to communicate with server");
         client_resp.clientIndex = req->operationIndex;
+        client_resp.traceId = req->traceId;
         
         write(clientFd, &client_resp, sizeof(ServerResponse));
         
         close(clientFd);
         close(pipe_read);
         close(pipe_write);
-        free(teller_arg);
         exit(4);
     }
     
@@ -751,199 +1681,701 @@ void *tellerProcess(void *arg, int isDeposit) {
             server_resp.clientIndex = req->operationIndex;
         }
     }
+    server_resp.traceId = req->traceId;
+    
+    long replyNs = traceId != 0 ? traceNow() : 0;
+    traceSpan(traceId, SPAN_AWAIT_SERVER, awaitNs, replyNs, 0);
     
     /* Send response to client */
     if (write(clientFd, &server_resp, sizeof(ServerResponse)) != sizeof(ServerResponse)) {
         /* Error writing to client, but we can't do much about it now */
     }
+    if (traceId != 0) {
+        traceSpan(traceId, SPAN_REPLY, replyNs, traceNow(), 0);
+    }
     
     /* Clean up */
     close(clientFd);
     close(pipe_read);
     close(pipe_write);
-    free(teller_arg);
     
     exit(EXIT_SUCCESS);
 }
 
 /* Deposit teller */
 void *depositTeller(void *arg) {
-    return tellerProcess(arg, 1);
+    return tellerProcess(arg, OP_DEPOSIT);
 }
 
 /* Withdraw teller */
 void *withdrawTeller(void *arg) {
-    return tellerProcess(arg, 0);
+    return tellerProcess(arg, OP_WITHDRAW);
+}
+
+/* Transaction teller - carries a whole multi-op transaction in one round trip */
+void *transactionTeller(void *arg) {
+    return tellerProcess(arg, OP_TRANSACTION);
+}
+
+/* Balance teller - only used when a query could not be answered inline */
+void *balanceTeller(void *arg) {
+    return tellerProcess(arg, OP_BALANCE);
+}
+
+/* Answer a balance query from the snapshot without spawning a teller.
+ * Returns -1 if the response could not be delivered yet, in which case
+ * the query falls back to a regular teller. */
+int answerBalanceQuery(ClientRequest *req) {
+    ServerResponse resp;
+    memset(&resp, 0, sizeof(ServerResponse));
+    resp.clientIndex = req->operationIndex;
+    resp.traceId = req->traceId;
+    
+    int accountId = req->isNewClient ? -1 : parseBankId(req->bankId);
+    
+    /* An account not loaded yet is not in the snapshot either */
+    if (accountId != -1 && lazyRemaining > 0) {
+        syncLock(syncRegion, &syncRegion->dbLock);
+        findAccount(accountId);
+        syncUnlock(&syncRegion->dbLock);
+    }
+    
+    if (accountId != -1 && snapshotLookup(balanceSnapshot, accountId, &resp.balance) == 0) {
+        generateBankId(resp.bankId, accountId);
+        snprintf(resp.message, sizeof(resp.message), "Balance: %d credits", resp.balance);
+    } else {
+        resp.status = ERR_INVALID_ACCOUNT;
+        strcpy(resp.message, "Account not found");
+    }
+    
+    if (sendClientResponse(req, &resp) == -1) {
+        return -1;
+    }
+    metricsRecordResult(OP_BALANCE, resp.status);
+    if (req->receivedNs != 0) {
+        traceSpan(req->traceId, SPAN_SNAPSHOT, req->receivedNs, traceNow(), 0);
+    }
+    
+    printf("Client%02d balance query served from snapshot\n", req->operationIndex);
+    return 0;
 }
 
-/* Process teller request and update database */
+/* Write a response straight to the client FIFO of one operation */
+int sendClientResponse(ClientRequest *req, ServerResponse *resp) {
+    char clientFifo[CLIENT_FIFO_NAME_LEN];
+    snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE "_%d", 
+             (long)req->pid, req->operationIndex);
+    
+    /* Never block the main loop - the client opens its FIFOs before sending */
+    return ioSendFile(clientFifo, resp, sizeof(ServerResponse));
+}
+
+/* Process teller request and update database. Its log records are only
+ * buffered; applyBatch commits them with the rest of the round. */
 void processDatabaseRequest(TellerRequest *req, ServerResponse *resp, int clientNum) {
+    int accountId = req->accountId;
+    BANK_PROBE4(apply_entry, req->traceId, accountId, req->operation, req->amount);
+    
     resp->status = 0;  /* Success by default */
     resp->clientIndex = req->clientIndex;
     
-    if (req->operation == OP_DEPOSIT) {
-        if (req->isNewClient) {
-            /* Create new account */
-            int accountIndex = createAccount(req->amount);
-            if (accountIndex >= 0) {
-                strncpy(resp->bankId, bankDb.accounts[accountIndex].bankId, sizeof(resp->bankId));
-                resp->balance = bankDb.accounts[accountIndex].balance;
-                snprintf(resp->message, sizeof(resp->message), 
-                        "New account created with %d credits", req->amount);
-                
-                printf("Client%02d deposited %d credits... updating log\n", 
-                       clientNum, req->amount);
-            } else {
-                resp->status = ERR_INVALID_OPERATION;
-                strcpy(resp->message, "Failed to create account");
-                printf("Client%02d deposit failed... account creation error\n", 
-                       clientNum);
-            }
+    if (req->operation == OP_DEPOSIT && req->isNewClient) {
+        /* Create new account */
+        int accountIndex = createAccount(req->amount);
+        if (accountIndex >= 0) {
+            accountId = bankDb.ids[accountIndex];
+            generateBankId(resp->bankId, bankDb.ids[accountIndex]);
+            resp->balance = bankDb.balances[accountIndex];
+            snprintf(resp->message, sizeof(resp->message), 
+                    "New account created with %d credits", req->amount);
+            
+            printf("Client%02d deposited %d credits... updating log\n", 
+                   clientNum, req->amount);
         } else {
-            /* Deposit to existing account */
-            int accountIndex = findAccount(req->bankId);
-            if (accountIndex >= 0) {
-                int newBalance = depositToAccount(req->bankId, req->amount);
-                if (newBalance >= 0) {
-                    strncpy(resp->bankId, req->bankId, sizeof(resp->bankId));
-                    resp->balance = newBalance;
-                    snprintf(resp->message, sizeof(resp->message), 
-                            "Deposited %d credits. New balance: %d", req->amount, newBalance);
-                    
-                    printf("Client%02d deposited %d credits... updating log\n", 
-                           clientNum, req->amount);
-                } else {
-                    resp->status = ERR_INVALID_OPERATION;
-                    strcpy(resp->message, "Deposit operation failed");
-                    printf("Client%02d deposit failed... operation error\n", 
-                           clientNum);
-                }
-            } else {
-                resp->status = ERR_INVALID_ACCOUNT;
-                strcpy(resp->message, "Account not found");
-                printf("Client%02d deposit failed... account not found\n", 
-                       clientNum);
-            }
+            resp->status = ERR_INVALID_OPERATION;
+            strcpy(resp->message, "Failed to create account");
+            printf("Client%02d deposit failed... account creation error\n", 
+                   clientNum);
         }
-    } else if (req->operation == OP_WITHDRAW) {
-        /* Withdraw from existing account */
-        int accountIndex = findAccount(req->bankId);
+    } else if (req->operation == OP_DEPOSIT || req->operation == OP_WITHDRAW || 
+               req->operation == OP_BALANCE) {
+        /* Single op on an existing account - a group of one */
+        int accountIndex = req->isNewClient ? -1 : findAccount(req->accountId);
         if (accountIndex >= 0) {
-            int newBalance = withdrawFromAccount(req->bankId, req->amount);
-            if (newBalance >= 0) {
-                strncpy(resp->bankId, req->bankId, sizeof(resp->bankId));
-                resp->balance = newBalance;
-                
-                if (newBalance == 0) {
-                    snprintf(resp->message, sizeof(resp->message), 
-                            "Withdrew %d credits. Account closed.", req->amount);
-                    removeAccount(req->bankId);
-                    printf("Client%02d withdraws %d credits... updating log... Bye Client%02d\n", 
-                           clientNum, req->amount, clientNum);
-                } else {
-                    snprintf(resp->message, sizeof(resp->message), 
-                            "Withdrew %d credits. New balance: %d", req->amount, newBalance);
-                    printf("Client%02d withdraws %d credits... updating log\n", 
-                           clientNum, req->amount);
-                }
-            } else if (newBalance == ERR_INSUFFICIENT_FUNDS) {
+            applyAccountOps(&req, &resp, 1, accountIndex);
+        } else {
+            rejectUnknownAccount(req, resp);
+        }
+    } else if (req->operation == OP_TRANSACTION) {
+        processTransaction(req, resp, clientNum);
+    } else {
+        resp->status = ERR_INVALID_OPERATION;
+        strcpy(resp->message, "Invalid operation");
+        printf("Client%02d invalid operation %d\n", clientNum, req->operation);
+    }
+    
+    BANK_PROBE5(apply_return, req->traceId, accountId, req->operation, req->amount, resp->status);
+}
+
+/* Answer an op whose account does not exist (or was closed earlier in the batch) */
+void rejectUnknownAccount(TellerRequest *req, ServerResponse *resp) {
+    int clientNum = req->clientIndex;
+    
+    resp->status = ERR_INVALID_ACCOUNT;
+    resp->clientIndex = clientNum;
+    strcpy(resp->message, "Account not found");
+    
+    if (req->operation == OP_DEPOSIT) {
+        printf("Client%02d deposit failed... account not found\n", clientNum);
+    } else if (req->operation == OP_WITHDRAW) {
+        printf("Client%02d withdraws %d credits... account not found.\n", 
+               clientNum, req->amount);
+    } else {
+        printf("Client%02d balance query... account not found\n", clientNum);
+    }
+}
+
+/* Apply a run of deposits, withdrawals and balance queries to one account.
+ * The ops are applied in order against a running balance, each one gets its
+ * own response, and the whole run is written as a single net log record.
+ * A withdrawal that empties the account closes it, so later ops in the run
+ * see no account, exactly as if they had been applied one by one.
+ * The caller commits the log. */
+void applyAccountOps(TellerRequest **reqs, ServerResponse **resps, int count, int index) {
+    int balance = bankDb.balances[index];
+    int active = 1;
+    int deposited = 0;
+    
+    for (int k = 0; k < count; k++) {
+        TellerRequest *req = reqs[k];
+        ServerResponse *resp = resps[k];
+        int clientNum = req->clientIndex;
+        
+        resp->status = 0;
+        resp->clientIndex = clientNum;
+        
+        if (!active) {
+            rejectUnknownAccount(req, resp);
+            continue;
+        }
+        
+        generateBankId(resp->bankId, bankDb.ids[index]);
+        
+        if (req->operation == OP_DEPOSIT) {
+            balance += req->amount;
+            deposited += req->amount;
+            resp->balance = balance;
+            snprintf(resp->message, sizeof(resp->message), 
+                    "Deposited %d credits. New balance: %d", req->amount, balance);
+            printf("Client%02d deposited %d credits... updating log\n", 
+                   clientNum, req->amount);
+        } else if (req->operation == OP_WITHDRAW) {
+            if (balance < req->amount) {
                 resp->status = ERR_INSUFFICIENT_FUNDS;
+                resp->bankId[0] = '\0';
                 strcpy(resp->message, "Insufficient funds for withdrawal");
-                
                 printf("Client%02d withdraws %d credit.. operation not permitted.\n", 
                        clientNum, req->amount);
+                continue;
+            }
+            
+            balance -= req->amount;
+            resp->balance = balance;
+            
+            if (balance == 0) {
+                active = 0;
+                snprintf(resp->message, sizeof(resp->message), 
+                        "Withdrew %d credits. Account closed.", req->amount);
+                printf("Client%02d withdraws %d credits... updating log... Bye Client%02d\n", 
+                       clientNum, req->amount, clientNum);
             } else {
-                resp->status = ERR_INVALID_OPERATION;
-                strcpy(resp->message, "Withdraw operation failed");
-                printf("Client%02d withdraws %d credits... operation failed.\n", 
+                snprintf(resp->message, sizeof(resp->message), 
+                        "Withdrew %d credits. New balance: %d", req->amount, balance);
+                printf("Client%02d withdraws %d credits... updating log\n", 
                        clientNum, req->amount);
             }
         } else {
-            resp->status = ERR_INVALID_ACCOUNT;
-            strcpy(resp->message, "Account not found");
-            printf("Client%02d withdraws %d credits... account not found.\n", 
-                   clientNum, req->amount);
+            resp->balance = balance;
+            snprintf(resp->message, sizeof(resp->message), 
+                    "Balance: %d credits", balance);
+            printf("Client%02d balance query served\n", clientNum);
         }
-    } else {
+    }
+    
+    /* One record carries the net effect; restore only needs the final
+     * balance. Updates that cancel out are logged as their deposit and
+     * withdrawal totals, so the round still shows in histories and audits. */
+    int net = balance - bankDb.balances[index];
+    if (net > 0) {
+        logRecord(bankDb.ids[index], 'D', net, balance);
+    } else if (net < 0) {
+        logRecord(bankDb.ids[index], 'W', -net, balance);
+    } else if (deposited > 0) {
+        logRecord(bankDb.ids[index], 'D', deposited, balance + deposited);
+        logRecord(bankDb.ids[index], 'W', deposited, balance);
+    }
+    
+    bankDb.balances[index] = balance;
+    storeSetActive(&bankDb, index, active);
+    syncSnapshotAccount(index);
+}
+
+/* Only plain ops on a named existing account can be coalesced */
+static int isGroupable(const TellerRequest *req) {
+    if (req->isNewClient || req->accountId < 0) {
+        return 0;
+    }
+    return req->operation == OP_DEPOSIT || req->operation == OP_WITHDRAW || 
+           req->operation == OP_BALANCE;
+}
+
+/* Apply the pending groupable ops in [from, to), one pass per account */
+static void applyGroups(TellerRequest *reqs, ServerResponse *resps, int *pending, int from, int to,
+                        ApplyScratch *scratch) {
+    TellerRequest **groupReqs = scratch->groupReqs;
+    ServerResponse **groupResps = scratch->groupResps;
+    
+    for (int i = from; i < to; i++) {
+        if (!pending[i]) {
+            continue;
+        }
+        
+        /* Collect every later op on the same account, keeping batch order */
+        int count = 0;
+        for (int j = i; j < to; j++) {
+            if (pending[j] && reqs[j].accountId == reqs[i].accountId) {
+                groupReqs[count] = &reqs[j];
+                groupResps[count++] = &resps[j];
+                pending[j] = 0;
+            }
+        }
+        
+        /* A group is applied in one go, so its ops enter and return together */
+        for (int k = 0; k < count; k++) {
+            BANK_PROBE4(apply_entry, groupReqs[k]->traceId, groupReqs[k]->accountId, 
+                        groupReqs[k]->operation, groupReqs[k]->amount);
+        }
+        
+        int index = findAccount(reqs[i].accountId);
+        if (index >= 0) {
+            applyAccountOps(groupReqs, groupResps, count, index);
+        } else {
+            for (int k = 0; k < count; k++) {
+                rejectUnknownAccount(groupReqs[k], groupResps[k]);
+            }
+        }
+        
+        for (int k = 0; k < count; k++) {
+            BANK_PROBE5(apply_return, groupReqs[k]->traceId, groupReqs[k]->accountId, 
+                        groupReqs[k]->operation, groupReqs[k]->amount, groupResps[k]->status);
+        }
+    }
+}
+
+/* Apply all collected teller requests of a round.
+ * Plain ops are grouped by account so a hot account is looked up, updated
+ * and logged once per round instead of once per op. Account creations and
+ * transactions act as barriers: the groups collected before them are applied
+ * first, so the outcome is the same as applying the requests in batch order.
+ * All log records of the round are committed with one flush. */
+void applyBatch(TellerRequest *reqs, ServerResponse *resps, const int *ready, int numRequests,
+                ApplyScratch *scratch) {
+    int *pending = scratch->pending;
+    int from = 0;
+    
+    memset(pending, 0, numRequests * sizeof(int));
+    
+    for (int i = 0; i < numRequests; i++) {
+        if (!ready[i]) {
+            continue;
+        }
+        
+        memset(&resps[i], 0, sizeof(ServerResponse));
+        
+        if (isGroupable(&reqs[i])) {
+            pending[i] = 1;
+            continue;
+        }
+        
+        applyGroups(reqs, resps, pending, from, i, scratch);
+        processDatabaseRequest(&reqs[i], &resps[i], reqs[i].clientIndex);
+        from = i + 1;
+    }
+    
+    applyGroups(reqs, resps, pending, from, numRequests, scratch);
+    commitLog();
+}
+
+/* Slot in the scratch balance table used while validating a transaction */
+typedef struct {
+    int index;              /* Account index in bankDb */
+    int balance;            /* Tentative balance */
+} TxnSlot;
+
+static int txnSlot(TxnSlot *slots, int *numSlots, int accountIndex) {
+    for (int i = 0; i < *numSlots; i++) {
+        if (slots[i].index == accountIndex) {
+            return i;
+        }
+    }
+    
+    slots[*numSlots].index = accountIndex;
+    slots[*numSlots].balance = bankDb.balances[accountIndex];
+    return (*numSlots)++;
+}
+
+/* Apply a transaction all-or-nothing.
+ * Every op is first checked against a scratch copy of the touched balances;
+ * only when all of them succeed are the balances written back and the log
+ * records buffered, to be committed with the rest of the round. */
+void processTransaction(TellerRequest *req, ServerResponse *resp, int clientNum) {
+    TxnSlot slots[2 * MAX_TXN_OPS];
+    int numSlots = 0;
+    int fromSlot[MAX_TXN_OPS], toSlot[MAX_TXN_OPS];
+    int toBalances[MAX_TXN_OPS];
+    
+    resp->numTxnOps = req->numTxnOps;
+    
+    if (req->numTxnOps <= 0 || req->numTxnOps > MAX_TXN_OPS) {
         resp->status = ERR_INVALID_OPERATION;
-        strcpy(resp->message, "Invalid operation");
-        printf("Client%02d invalid operation %d\n", clientNum, req->operation);
+        strcpy(resp->message, "Invalid transaction size");
+        printf("Client%02d transaction rejected... invalid size %d\n", 
+               clientNum, req->numTxnOps);
+        return;
     }
+    
+    /* Validate every op against the scratch balances */
+    for (int i = 0; i < req->numTxnOps; i++) {
+        TellerTxnOp *op = &req->txnOps[i];
+        int status = 0;
+        const char *reason = NULL;
+        
+        int from = findAccount(op->accountId);
+        int to = op->op == OP_TRANSFER ? findAccount(op->toAccountId) : -1;
+        
+        if (op->amount <= 0) {
+            status = ERR_INVALID_OPERATION;
+            reason = "invalid amount";
+        } else if (from < 0 || (op->op == OP_TRANSFER && to < 0)) {
+            status = ERR_INVALID_ACCOUNT;
+            reason = "account not found";
+        } else if (op->op == OP_TRANSFER && from == to) {
+            status = ERR_INVALID_OPERATION;
+            reason = "transfer to same account";
+        } else if (op->op != OP_DEPOSIT && op->op != OP_WITHDRAW && op->op != OP_TRANSFER) {
+            status = ERR_INVALID_OPERATION;
+            reason = "invalid operation";
+        }
+        
+        if (status == 0) {
+            fromSlot[i] = txnSlot(slots, &numSlots, from);
+            toSlot[i] = to >= 0 ? txnSlot(slots, &numSlots, to) : -1;
+            
+            if (op->op == OP_DEPOSIT) {
+                slots[fromSlot[i]].balance += op->amount;
+            } else if (slots[fromSlot[i]].balance < op->amount) {
+                status = ERR_INSUFFICIENT_FUNDS;
+                reason = "insufficient funds";
+            } else {
+                slots[fromSlot[i]].balance -= op->amount;
+                if (op->op == OP_TRANSFER) {
+                    slots[toSlot[i]].balance += op->amount;
+                    toBalances[i] = slots[toSlot[i]].balance;
+                }
+            }
+        }
+        
+        if (status != 0) {
+            resp->status = status;
+            resp->failedOp = i + 1;
+            snprintf(resp->message, sizeof(resp->message), 
+                    "Transaction aborted at op %d: %s", i + 1, reason);
+            printf("Client%02d transaction aborted at op %d... %s\n", 
+                   clientNum, i + 1, reason);
+            return;
+        }
+        
+        resp->txnBalances[i] = slots[fromSlot[i]].balance;
+    }
+    
+    /* Commit: buffer all log records */
+    for (int i = 0; i < req->numTxnOps; i++) {
+        TellerTxnOp *op = &req->txnOps[i];
+        
+        if (op->op == OP_DEPOSIT) {
+            logRecord(op->accountId, 'D', op->amount, resp->txnBalances[i]);
+        } else {
+            logRecord(op->accountId, 'W', op->amount, resp->txnBalances[i]);
+            if (op->op == OP_TRANSFER) {
+                logRecord(op->toAccountId, 'D', op->amount, toBalances[i]);
+            }
+        }
+    }
+    
+    /* Readers see the whole transaction or none of it */
+    snapshotBeginWrite(balanceSnapshot);
+    for (int i = 0; i < numSlots; i++) {
+        int index = slots[i].index;
+        bankDb.balances[index] = slots[i].balance;
+        
+        /* Accounts emptied by the transaction are closed, like a full withdrawal */
+        if (bankDb.balances[index] == 0) {
+            storeSetActive(&bankDb, index, 0);
+        }
+        snapshotStoreAccount(balanceSnapshot, index, bankDb.ids[index], 
+                             bankDb.balances[index], storeIsActive(&bankDb, index));
+    }
+    stampSnapshot();
+    snapshotEndWrite(balanceSnapshot);
+    
+    TellerTxnOp *last = &req->txnOps[req->numTxnOps - 1];
+    generateBankId(resp->bankId, last->accountId);
+    resp->balance = resp->txnBalances[req->numTxnOps - 1];
+    snprintf(resp->message, sizeof(resp->message), 
+            "Transaction of %d ops committed", req->numTxnOps);
+    
+    printf("Client%02d transaction of %d ops committed... updating log\n", 
+           clientNum, req->numTxnOps);
 }
 
 /* Database operations */
 void initializeDatabase(void) {
-    bankDb.numAccounts = 0;
+    if (storeInit(&bankDb, MAX_ACCOUNTS) == -1) {
+        errExit("Failed to allocate the account store");
+    }
 }
 
-int findAccount(const char *bankId) {
-    for (int i = 0; i < bankDb.numAccounts; i++) {
-        if (bankDb.accounts[i].active && strcmp(bankDb.accounts[i].bankId, bankId) == 0) {
-            return i;
+int findAccount(int accountId) {
+    int index = storeLookup(&bankDb, accountId);
+    
+    /* Fault the account in from the checkpoint on first access */
+    if (index == -1 && lazyRemaining > 0) {
+        const CheckpointSlot *slot = checkpointLookup(&lazyCheckpoint, accountId);
+        if (slot != NULL) {
+            index = loadAccount(slot);
         }
     }
-    return -1;  /* Account not found */
+    
+    if (index == -1 || !storeIsActive(&bankDb, index)) {
+        return -1;  /* Account not found */
+    }
+    return index;
+}
+
+/* Next account number after lastClientId in this server's share of the
+ * ID space: idFirst, idFirst + idStride, ... Behind a router every shard
+ * gets its own idFirst, so account IDs stay unique across shards. */
+int nextClientId(void) {
+    if (lastClientId < idFirst) {
+        return idFirst;
+    }
+    return idFirst + ((lastClientId - idFirst) / idStride + 1) * idStride;
 }
 
 /* Fixed createAccount function to properly increment lastClientId */
 int createAccount(int amount) {
-    if (bankDb.numAccounts >= 100) {
+    if (bankDb.numAccounts + lazyRemaining >= MAX_ACCOUNTS) {
         return -1;  /* Maximum number of accounts reached */
     }
+    if (nextClientId() > idLast) {
+        return -1;  /* This server's share of the ID space is used up */
+    }
     
-    /* Increment lastClientId for the new account */
-    lastClientId++;
+    /* Advance lastClientId for the new account */
+    lastClientId = nextClientId();
     
-    int index = bankDb.numAccounts++;
-    generateBankId(bankDb.accounts[index].bankId, lastClientId);
-    bankDb.accounts[index].balance = amount;
-    bankDb.accounts[index].active = 1;
+    int index = storeAdd(&bankDb, lastClientId, amount);
+    if (index == -1) {
+        return -1;
+    }
     
-    /* Update log file */
-    updateLogFile(logFile, bankDb.accounts[index].bankId, 'D', amount, amount);
+    /* Buffer the opening record; the round commits it */
+    logRecord(bankDb.ids[index], 'D', amount, amount);
+    syncSnapshotAccount(index);
     
     return index;
 }
 
-int depositToAccount(const char *bankId, int amount) {
-    int index = findAccount(bankId);
+int depositToAccount(int accountId, int amount) {
+    int index = findAccount(accountId);
     if (index == -1) {
         return -1;  /* Account not found */
     }
     
-    bankDb.accounts[index].balance += amount;
+    bankDb.balances[index] += amount;
     
     /* Update log file */
-    updateLogFile(logFile, bankId, 'D', amount, bankDb.accounts[index].balance);
+    logRecord(accountId, 'D', amount, bankDb.balances[index]);
+    commitLog();
+    syncSnapshotAccount(index);
     
-    return bankDb.accounts[index].balance;
+    return bankDb.balances[index];
 }
 
-int withdrawFromAccount(const char *bankId, int amount) {
-    int index = findAccount(bankId);
+int withdrawFromAccount(int accountId, int amount) {
+    int index = findAccount(accountId);
     if (index == -1) {
         return -1;  /* Account not found */
     }
     
-    if (bankDb.accounts[index].balance < amount) {
+    if (bankDb.balances[index] < amount) {
         return ERR_INSUFFICIENT_FUNDS;  /* Insufficient funds */
     }
     
-    bankDb.accounts[index].balance -= amount;
+    bankDb.balances[index] -= amount;
     
     /* Update log file */
-    updateLogFile(logFile, bankId, 'W', amount, bankDb.accounts[index].balance);
+    logRecord(accountId, 'W', amount, bankDb.balances[index]);
+    commitLog();
+    syncSnapshotAccount(index);
     
-    return bankDb.accounts[index].balance;
+    return bankDb.balances[index];
 }
 
-void removeAccount(const char *bankId) {
-    int index = findAccount(bankId);
+void removeAccount(int accountId) {
+    int index = findAccount(accountId);
     if (index == -1) {
         return;  /* Account not found */
     }
     
-    bankDb.accounts[index].active = 0;
+    storeSetActive(&bankDb, index, 0);
+    syncSnapshotAccount(index);
+}
+
+/* Copy one account into the balance snapshot */
+void syncSnapshotAccount(int index) {
+    /* Gone already when shutdown loads the remaining lazy accounts */
+    if (balanceSnapshot == NULL) {
+        return;
+    }
+    
+    snapshotBeginWrite(balanceSnapshot);
+    snapshotStoreAccount(balanceSnapshot, index, bankDb.ids[index], 
+                         bankDb.balances[index], storeIsActive(&bankDb, index));
+    stampSnapshot();
+    snapshotEndWrite(balanceSnapshot);
+}
+
+/* Copy the whole account table into the balance snapshot */
+void publishSnapshot(void) {
+    snapshotBeginWrite(balanceSnapshot);
+    for (int i = 0; i < bankDb.numAccounts; i++) {
+        snapshotStoreAccount(balanceSnapshot, i, bankDb.ids[i], 
+                             bankDb.balances[i], storeIsActive(&bankDb, i));
+    }
+    stampSnapshot();
+    snapshotEndWrite(balanceSnapshot);
+}
+
+/* Record how far into the log the snapshot's balances go, so a reader of
+ * both (BankAudit -f) can tell whether they match. Every record written
+ * so far counts, flushed or not. Must be called inside a snapshot write. */
+void stampSnapshot(void) {
+    uint64_t logSize = followMode ? (uint64_t)replica.offset : (uint64_t)ioLogOffset();
+    snapshotStoreLogState(balanceSnapshot, logSize, lazyRemaining);
+}
+
+/* Map the shutdown checkpoint for lazy loading. Returns 1 if it matches
+ * the log, otherwise 0 and the caller restores from the log. */
+int openLazyCheckpoint(void) {
+    char ckptName[80];
+    snprintf(ckptName, sizeof(ckptName), CHECKPOINT_NAME_TEMPLATE, bankName);
+    
+    struct stat logStat;
+    if (checkpointOpen(&lazyCheckpoint, ckptName) == -1) {
+        printf("No usable checkpoint %s, restoring from the log\n", ckptName);
+        return 0;
+    }
+    if (stat(logFileName, &logStat) == -1 || 
+        lazyCheckpoint.header->logSize != (uint64_t)logStat.st_size) {
+        printf("Checkpoint %s does not match the log, restoring from the log\n", ckptName);
+        checkpointClose(&lazyCheckpoint);
+        return 0;
+    }
+    
+    lazyRemaining = lazyCheckpoint.header->numAccounts;
+    lazyNextSlot = 0;
+    return 1;
+}
+
+/* Copy one checkpoint account into the store. Returns its index or -1. */
+int loadAccount(const CheckpointSlot *slot) {
+    int index = storeAdd(&bankDb, slot->accountId, slot->balance);
+    if (index == -1) {
+        return -1;
+    }
+    
+    storeSetActive(&bankDb, index, slot->active);
+    syncSnapshotAccount(index);
+    lazyRemaining--;
+    
+    if (lazyRemaining == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        printf("All %d checkpoint accounts loaded %.3fms after launch\n", 
+               bankDb.numAccounts, timespecDiffMs(&serverStart, &now));
+        checkpointClose(&lazyCheckpoint);
+    }
+    return index;
+}
+
+/* Load up to maxAccounts checkpoint accounts that were not faulted in yet.
+ * The caller holds the database lock, or is the shutdown path. */
+void loadPendingAccounts(int maxAccounts) {
+    while (lazyRemaining > 0 && maxAccounts > 0 && 
+           lazyNextSlot < lazyCheckpoint.header->tableSize) {
+        const CheckpointSlot *slot = &lazyCheckpoint.slots[lazyNextSlot++];
+        
+        if (slot->accountId != -1 && storeLookup(&bankDb, slot->accountId) == -1) {
+            if (loadAccount(slot) == -1) {
+                errLog(logFile, "loading account " BANK_ID_FORMAT, slot->accountId);
+            }
+            maxAccounts--;
+        }
+    }
+}
+
+/* Buffer a log record and add it to the account's history */
+void logRecord(int accountId, char opType, int amount, int balance) {
+    off_t offset = ioLogOffset();
+    int length = appendLogRecord(logFile, accountId, opType, amount, balance);
+    if (length > 0) {
+        historyAppend(&historyIndex, accountId, offset, length, time(NULL));
+        metricsRecordLogBytes(length);
+    }
+    BANK_PROBE5(log_append, accountId, opType, amount, balance, length);
+    FAULT_POINT(FAULT_LOG_APPEND);
+}
+
+/* Write out the records buffered so far, timing the flush */
+void commitLog(void) {
+    struct timespec start, end;
+    long startNs = traceApply ? traceNow() : 0;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    commitLogFile(logFile);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double commitMs = timespecDiffMs(&start, &end);
+    metricsRecordCommit(commitMs);
+    BANK_PROBE1(log_flush, (long)(commitMs * 1000000.0));
+    if (traceApply) {
+        traceSpan(0, SPAN_LOG_FLUSH, startNs, traceNow(), 0);
+    }
+}
+
+/* Write the sampled spans of this server's run to <BankName>.trace.<pid>.json */
+void writeTrace(void) {
+    if (traceRate == 0) {
+        return;
+    }
+    
+    char tracePath[80];
+    snprintf(tracePath, sizeof(tracePath), TRACE_FILE_TEMPLATE, bankName, (long)getpid());
+    if (traceWrite(tracePath, getpid()) == -1) {
+        fprintf(stderr, "Failed to write trace %s\n", tracePath);
+        return;
+    }
+    tracePrintStats(stdout, tracePath);
 }
 
 /* Helper functions */
@@ -951,13 +2383,15 @@ void printServerStatus(void) {
     printf("Server Status:\n");
     printf("Active clients: %d\n", activeClients);
     printf("Number of accounts: %d\n", bankDb.numAccounts);
+    printf("Active accounts: %d\n", storeCountActive(&bankDb));
+    printf("Total deposits: %lld credits\n", storeTotalBalance(&bankDb));
     
     printf("Accounts:\n");
     for (int i = 0; i < bankDb.numAccounts; i++) {
-        if (bankDb.accounts[i].active) {
-            printf("%s: %d credits\n", 
-                    bankDb.accounts[i].bankId, 
-                    bankDb.accounts[i].balance);
+        if (storeIsActive(&bankDb, i)) {
+            printf(BANK_ID_FORMAT ": %d credits\n", 
+                    bankDb.ids[i], 
+                    bankDb.balances[i]);
         }
     }
-}
\ No newline at end of file
+}
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -16,50 +17,103 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
-#include <semaphore.h>
+#include <sys/pidfd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <pthread.h>
 #include <time.h>
 
 #include "bank_shared.h"
 #include "bank_utils.h"
-
-
-/* Structure to track batch operations */
-typedef struct {
-    pid_t pid;        /* Client process PID */
-    int total;        /* Total operations in batch */
-    int received;     /* Operations received so far */
-} BatchInfo;
+#include "bank_snapshot.h"
+#include "bank_scheduler.h"
+#include "bank_metrics.h"
+#include "bank_store.h"
+#include "bank_history.h"
+#include "bank_checkpoint.h"
+#include "bank_upgrade.h"
+#include "bank_replica.h"
+#include "bank_arena.h"
+#include "bank_io.h"
+#include "bank_sync.h"
+#include "bank_trace.h"
+#include "bank_probes.h"
+#include "bank_fault.h"
+
+
+/* Default admission limit on concurrent tellers */
+#define DEFAULT_MAX_TELLERS 32
+
+/* When collected teller requests are applied to the database */
+#define APPLY_ROUND 0   /* Once every teller of the round has handed in its request */
+#define APPLY_READY 1   /* As soon as any requests are ready */
 
 /* Structure for teller arguments */
 struct TellerArgs {
     ClientRequest client_req;
     int pipe_read;
     int pipe_write;
+    unsigned long traceId;  /* Request's trace ID if it is sampled, 0 otherwise */
+    long spawnNs;           /* When the server started the fork (traced only) */
+    int stall;              /* Hold the request back (teller_stall fault) */
 };
 
-/* Bank account structure */
-typedef struct {
-    char bankId[20];
-    int balance;
-    int active;
-} Account;
+/* Longest a teller waits for its client to open the response FIFO */
+#define TELLER_OPEN_TIMEOUT_MS 500
+
+/* Longest a teller may run before it is killed through its pidfd. A
+ * teller gives up on its own after about 4.5s of open, write and response
+ * timeouts, so this only catches tellers that are stuck. */
+#define TELLER_TIMEOUT_MS 5000
+
+/* Longest shutdown waits for tellers to exit */
+#define SHUTDOWN_GRACE_MS 1000
+
+/* Maximum number of accounts the bank opens */
+#define MAX_ACCOUNTS 100
 
-/* Bank database structure */
+/* Checkpoint accounts loaded per idle pass of the main loop in lazy mode */
+#define LAZY_LOAD_CHUNK 16
+
+/* Unix socket serving the metrics, next to the server FIFO */
+#define METRICS_SOCKET_TEMPLATE "%s.metrics"
+
+/* Teller request operation code for a multi-operation transaction */
+#define OP_TRANSACTION 4
+
+/* One transaction op as the apply stage sees it */
 typedef struct {
-    Account accounts[MAX_BATCH_SIZE];  /* Array of accounts (max 100 clients) */
-    int numAccounts;        /* Current number of accounts */
-} BankDatabase;
+    int op;                 /* OP_DEPOSIT, OP_WITHDRAW or OP_TRANSFER */
+    int amount;
+    int accountId;          /* Account number (transfer source), -1 if not a valid ID */
+    int toAccountId;        /* Transfer destination, -1 if not a valid ID */
+} TellerTxnOp;
 
 /* Teller to Server message for database operations */
 typedef struct {
-    int operation;          /* OP_DEPOSIT or OP_WITHDRAW */
-    char bankId[20];        /* Account ID */
+    int operation;          /* OP_DEPOSIT, OP_WITHDRAW, OP_BALANCE or OP_TRANSACTION */
+    int accountId;          /* Account number, -1 for a new client or an invalid ID */
     int amount;             /* Amount to deposit/withdraw */
     int isNewClient;        /* Flag indicating if this is a new client */
     pid_t clientPid;        /* Client PID (for response) */
     int clientIndex;        /* Client index for display */
+    int numTxnOps;          /* Number of ops in txnOps (OP_TRANSACTION only) */
+    TellerTxnOp txnOps[MAX_TXN_OPS]; /* Transaction ops, applied all-or-nothing */
+    unsigned long traceId;  /* Sampled trace ID, 0 if the request is not traced */
 } TellerRequest;
 
+/* Scratch arrays of the apply stage, one entry per request of the round */
+typedef struct {
+    int *pending;               /* Groupable ops not applied yet */
+    TellerRequest **groupReqs;  /* Ops of the account being applied */
+    ServerResponse **groupResps;
+} ApplyScratch;
+
+/* Round arena size. A full round of MAX_BATCH_SIZE requests needs about
+ * 1.2KB per request, so this leaves ample headroom. */
+#define ROUND_ARENA_SIZE (4 * 1024 * 1024)
+
 /* Function prototypes */
 
 /* Custom process creation/waiting functions */
@@ -72,7 +126,20 @@ void cleanupServer(void);
 
 /* Signal handlers */
 void handleSignal(int sig);
-void handleChildSignal(int sig);
+void reapTellers(int timeoutMs);
+void handleUpgradeSignal(int sig);
+
+/* Live upgrade */
+void liveUpgrade(void);
+void abortUpgrade(pid_t newPid, UpgradeState *state, size_t stateSize);
+void receiveHandover(void);
+void completeHandover(void);
+
+/* Follow mode */
+void initializeFollower(char *argv[], const char *name, const char *fifoName);
+void followPrimary(void);
+void handleReplicaRequest(ClientRequest *req);
+void printReplicaStatus(void);
 void setupTellerSignals(void);
 
 /* Client number handling */
@@ -80,22 +147,48 @@ int extractClientNumber(const char *bankId);
 
 /* Client connection handling */
 void waitForClients(void);
-void resetBatchInfo(BatchInfo *batch);
-void processBatch(void);
+void handleClientRequest(ClientRequest *req);
+void processBatch(ClientRequest *requests, int numRequests);
+int spawnTeller(ClientRequest *req, pid_t *tellerPid, int *pidfd, int tellerPipes[4]);
+int tellerTimeLeft(const struct timespec *started);
+void reapTeller(pid_t pid, int pidfd, const struct timespec *started, int timedOut);
+void closeTellerPipes(int tellerPipes[4]);
+void rejectBusy(ClientRequest *req);
 void processDatabaseRequest(TellerRequest *req, ServerResponse *resp, int clientNum);
+void processTransaction(TellerRequest *req, ServerResponse *resp, int clientNum);
+void applyBatch(TellerRequest *reqs, ServerResponse *resps, const int *ready, int numRequests,
+                ApplyScratch *scratch);
+void applyAccountOps(TellerRequest **reqs, ServerResponse **resps, int count, int index);
+void rejectUnknownAccount(TellerRequest *req, ServerResponse *resp);
+int answerBalanceQuery(ClientRequest *req);
+int sendClientResponse(ClientRequest *req, ServerResponse *resp);
 
 /* Teller functions */
-void *tellerProcess(void *arg, int isDeposit);
+void *tellerProcess(void *arg, int operation);
 void *depositTeller(void *arg);
 void *withdrawTeller(void *arg);
+void *transactionTeller(void *arg);
+void *balanceTeller(void *arg);
 
 /* Database operations - only accessed by main server */
 void initializeDatabase(void);
-int findAccount(const char *bankId);
+int findAccount(int accountId);
+int nextClientId(void);
 int createAccount(int amount);
-int depositToAccount(const char *bankId, int amount);
-int withdrawFromAccount(const char *bankId, int amount);
-void removeAccount(const char *bankId);
+int depositToAccount(int accountId, int amount);
+int withdrawFromAccount(int accountId, int amount);
+void removeAccount(int accountId);
+void syncSnapshotAccount(int index);
+void publishSnapshot(void);
+void stampSnapshot(void);
+void logRecord(int accountId, char opType, int amount, int balance);
+void commitLog(void);
+void writeTrace(void);
+
+/* Lazy startup from the shutdown checkpoint */
+int openLazyCheckpoint(void);
+int loadAccount(const CheckpointSlot *slot);
+void loadPendingAccounts(int maxAccounts);
 
 /* Helper functions */
 void printServerStatus(void);
@@ -104,12 +197,30 @@ void printServerStatus(void);
 extern FILE *logFile;
 extern char serverFifo[SERVER_FIFO_NAME_LEN];
 extern int serverFd, dummyFd;
-extern BankDatabase bankDb;  /* Now a regular structure, not a pointer */
+extern AccountStore bankDb;  /* Column-oriented account store */
 extern int activeClients;
 extern int lastClientId;
 extern char bankName[50];
-extern sem_t *serverSem;
-extern BatchInfo currentBatch;
-extern ClientRequest batchRequests[MAX_BATCH_SIZE];
+extern SyncRegion *syncRegion;
+extern Arena roundArena;
+extern BalanceSnapshot *balanceSnapshot;
+extern int maxTellers;
+extern int maxQueuedOps;
+extern int applyMode;
+extern HistoryIndex historyIndex;
+extern char logFileName[64];
+extern int lazyLoad;
+extern Checkpoint lazyCheckpoint;
+extern int lazyRemaining;
+extern struct timespec serverStart;
+extern volatile sig_atomic_t upgradeRequested;
+extern int takeoverFd;
+extern char **serverArgv;
+extern int followMode;
+extern Replica replica;
+extern int idFirst;
+extern int idStride;
+extern int idLast;
+extern int ioBackend;
 
 #endif /* BANK_SERVER_H */
\ No newline at end of file
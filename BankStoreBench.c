@@ -0,0 +1,85 @@
+/* BankStoreBench.c
+ * Times the account store's bulk scans over a large synthetic bank
+ *
+ * Usage: BankStoreBench [numAccounts]
+ * Prints key=value lines like bench.sh.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bank_store.h"
+#include "bank_utils.h"
+
+#define DEFAULT_ACCOUNTS 10000000
+#define HISTOGRAM_BUCKETS 16
+#define REPEATS 5
+
+/* Best of REPEATS runs of one scan, in milliseconds */
+#define TIME_SCAN(result, expr) do { \
+        best = -1.0; \
+        for (int r = 0; r < REPEATS; r++) { \
+            clock_gettime(CLOCK_MONOTONIC, &start); \
+            result = (expr); \
+            clock_gettime(CLOCK_MONOTONIC, &end); \
+            double ms = timespecDiffMs(&start, &end); \
+            if (best < 0 || ms < best) best = ms; \
+        } \
+    } while (0)
+
+int main(int argc, char *argv[]) {
+    int numAccounts = argc > 1 ? atoi(argv[1]) : DEFAULT_ACCOUNTS;
+    if (numAccounts <= 0) {
+        fprintf(stderr, "Usage: %s [numAccounts]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    
+    AccountStore store;
+    if (storeInit(&store, numAccounts) == -1) {
+        errExit("storeInit");
+    }
+    
+    /* Deterministic balances; every 10th account is closed */
+    unsigned int seed = 12345;
+    for (int i = 0; i < numAccounts; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int index = storeAdd(&store, i + 1, (seed >> 8) % 10000 + 1);
+        if (index == -1) {
+            errExit("storeAdd");
+        }
+        if (i % 10 == 9) {
+            store.balances[index] = 0;
+            storeSetActive(&store, index, 0);
+        }
+    }
+    
+    struct timespec start, end;
+    double best;
+    long long total;
+    int active, below;
+    long long buckets[HISTOGRAM_BUCKETS];
+    
+    StoreMemory mem;
+    storeMemoryUsage(&store, &mem);
+    printf("store.accounts=%d\n", numAccounts);
+    printf("store.memory_bytes=%zu\n", mem.total);
+    printf("store.bytes_per_account=%.2f\n", (double)mem.total / numAccounts);
+    
+    TIME_SCAN(total, storeTotalBalance(&store));
+    printf("store.total_balance=%lld\n", total);
+    printf("store.total_balance_ms=%.3f\n", best);
+    
+    TIME_SCAN(active, storeCountActive(&store));
+    printf("store.active=%d\n", active);
+    printf("store.count_active_ms=%.3f\n", best);
+    
+    TIME_SCAN(below, storeCountBelow(&store, 100));
+    printf("store.below_100=%d\n", below);
+    printf("store.count_below_ms=%.3f\n", best);
+    
+    TIME_SCAN(total, (storeBalanceHistogram(&store, 1000, buckets, HISTOGRAM_BUCKETS), buckets[0]));
+    printf("store.histogram_bucket0=%lld\n", total);
+    printf("store.histogram_ms=%.3f\n", best);
+    
+    storeFree(&store);
+    return 0;
+}
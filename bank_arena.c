@@ -0,0 +1,61 @@
+/* bank_arena.c
+ * Bump allocator for state that lives for one scheduling round
+ */
+#include <string.h>
+#include <sys/mman.h>
+#include "bank_arena.h"
+
+/* Map the region up front, so that allocating never calls into the heap.
+ * Returns 0 or -1. */
+int arenaInit(Arena *arena, size_t capacity) {
+    memset(arena, 0, sizeof(Arena));
+    
+    void *base = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    
+    arena->base = base;
+    arena->capacity = capacity;
+    return 0;
+}
+
+/* Returns ARENA_ALIGN aligned memory, or NULL if the region is full */
+void *arenaAlloc(Arena *arena, size_t size) {
+    size_t offset = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    
+    if (arena->base == NULL || offset > arena->capacity || size > arena->capacity - offset) {
+        arena->overflows++;
+        return NULL;
+    }
+    
+    arena->used = offset + size;
+    arena->allocs++;
+    return arena->base + offset;
+}
+
+void *arenaCalloc(Arena *arena, size_t count, size_t size) {
+    if (size != 0 && count > arena->capacity / size) {
+        arena->overflows++;
+        return NULL;
+    }
+    
+    void *ptr = arenaAlloc(arena, count * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+/* Release every allocation at once */
+void arenaReset(Arena *arena) {
+    arena->used = 0;
+    arena->allocs = 0;
+}
+
+void arenaFree(Arena *arena) {
+    if (arena->base != NULL) {
+        munmap(arena->base, arena->capacity);
+    }
+    memset(arena, 0, sizeof(Arena));
+}
@@ -0,0 +1,27 @@
+/* bank_arena.h
+ * Bump allocator for state that lives for one scheduling round
+ */
+#ifndef BANK_ARENA_H
+#define BANK_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 16
+
+/* One fixed region, mapped once. Allocations are never freed one by one;
+ * arenaReset releases all of them at once. */
+typedef struct {
+    char *base;
+    size_t capacity;
+    size_t used;
+    unsigned long allocs;       /* Allocations since the last reset */
+    unsigned long overflows;    /* Allocations refused because the region was full */
+} Arena;
+
+int arenaInit(Arena *arena, size_t capacity);
+void *arenaAlloc(Arena *arena, size_t size);
+void *arenaCalloc(Arena *arena, size_t count, size_t size);
+void arenaReset(Arena *arena);
+void arenaFree(Arena *arena);
+
+#endif /* BANK_ARENA_H */
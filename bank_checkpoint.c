@@ -0,0 +1,130 @@
+/* bank_checkpoint.c
+ * Indexed account checkpoint written at shutdown for lazy startup
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bank_checkpoint.h"
+
+/* Multiplicative hash of an account number */
+static uint32_t hashAccountId(int32_t accountId) {
+    return (uint32_t)accountId * 2654435761u;
+}
+
+/* Find the slot of an account, or the empty slot where it would go */
+static CheckpointSlot *findSlot(CheckpointSlot *slots, uint32_t tableSize, int32_t accountId) {
+    uint32_t mask = tableSize - 1;
+    uint32_t i = hashAccountId(accountId) & mask;
+    
+    while (slots[i].accountId != -1 && slots[i].accountId != accountId) {
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+/* Write every account of the store, active or closed, to a new checkpoint.
+ * The file is written under a temporary name and renamed into place, so a
+ * crash never leaves a half-written checkpoint. Returns 0 or -1. */
+int checkpointWrite(const char *name, const AccountStore *store, int lastClientId, uint64_t logSize) {
+    uint32_t tableSize = 16;
+    while (tableSize < 2 * (uint32_t)store->numAccounts) {
+        tableSize *= 2;
+    }
+    
+    CheckpointSlot *slots = calloc(tableSize, sizeof(CheckpointSlot));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < tableSize; i++) {
+        slots[i].accountId = -1;
+    }
+    
+    for (int i = 0; i < store->numAccounts; i++) {
+        CheckpointSlot *slot = findSlot(slots, tableSize, store->ids[i]);
+        slot->accountId = store->ids[i];
+        slot->balance = store->balances[i];
+        slot->active = storeIsActive(store, i);
+    }
+    
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.tableSize = tableSize;
+    header.numAccounts = store->numAccounts;
+    header.lastClientId = lastClientId;
+    header.logSize = logSize;
+    
+    char tmpName[128];
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", name);
+    
+    FILE *file = fopen(tmpName, "w");
+    if (file == NULL) {
+        free(slots);
+        return -1;
+    }
+    
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(slots, sizeof(CheckpointSlot), tableSize, file) == tableSize;
+    ok = fclose(file) == 0 && ok;
+    free(slots);
+    
+    if (!ok || rename(tmpName, name) == -1) {
+        unlink(tmpName);
+        return -1;
+    }
+    return 0;
+}
+
+/* Map a checkpoint read-only. Returns 0, or -1 if it is missing or invalid. */
+int checkpointOpen(Checkpoint *ckpt, const char *name) {
+    memset(ckpt, 0, sizeof(Checkpoint));
+    
+    int fd = open(name, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CheckpointHeader)) {
+        close(fd);
+        return -1;
+    }
+    
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    
+    CheckpointHeader *header = map;
+    if (header->magic != CHECKPOINT_MAGIC || header->version != CHECKPOINT_VERSION ||
+        header->tableSize == 0 || (header->tableSize & (header->tableSize - 1)) != 0 ||
+        sizeof(CheckpointHeader) + (size_t)header->tableSize * sizeof(CheckpointSlot) != (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    
+    ckpt->map = map;
+    ckpt->mapSize = st.st_size;
+    ckpt->header = header;
+    ckpt->slots = (CheckpointSlot *)(header + 1);
+    return 0;
+}
+
+/* Look an account up. Returns its slot or NULL if the checkpoint does not have it. */
+const CheckpointSlot *checkpointLookup(const Checkpoint *ckpt, int accountId) {
+    const CheckpointSlot *slot = findSlot(ckpt->slots, ckpt->header->tableSize, accountId);
+    return slot->accountId != -1 ? slot : NULL;
+}
+
+void checkpointClose(Checkpoint *ckpt) {
+    if (ckpt->map != NULL) {
+        munmap(ckpt->map, ckpt->mapSize);
+    }
+    memset(ckpt, 0, sizeof(Checkpoint));
+}
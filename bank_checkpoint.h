@@ -0,0 +1,47 @@
+/* bank_checkpoint.h
+ * Indexed account checkpoint written at shutdown for lazy startup
+ */
+#ifndef BANK_CHECKPOINT_H
+#define BANK_CHECKPOINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bank_store.h"
+
+#define CHECKPOINT_MAGIC 0x31544b434b4e4142ULL /* "BANKCKT1" */
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_NAME_TEMPLATE "%s.bankCkpt"
+
+/* File layout: header followed by an open addressing hash table of
+ * accounts keyed by ID, so one account can be found by touching a single
+ * page of the mapping. The checkpoint is only valid for a log of exactly
+ * logSize bytes. */
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t tableSize;         /* Slots, a power of two */
+    uint32_t numAccounts;       /* Slots in use, active or closed */
+    int32_t lastClientId;       /* Highest client number handed out */
+    uint64_t logSize;           /* Size of the log the checkpoint matches */
+} CheckpointHeader;
+
+typedef struct {
+    int32_t accountId;          /* Account number, -1 for an unused slot */
+    int32_t balance;
+    int32_t active;
+} CheckpointSlot;
+
+/* A mapped checkpoint */
+typedef struct {
+    void *map;
+    size_t mapSize;
+    CheckpointHeader *header;
+    CheckpointSlot *slots;
+} Checkpoint;
+
+int checkpointWrite(const char *name, const AccountStore *store, int lastClientId, uint64_t logSize);
+int checkpointOpen(Checkpoint *ckpt, const char *name);
+const CheckpointSlot *checkpointLookup(const Checkpoint *ckpt, int accountId);
+void checkpointClose(Checkpoint *ckpt);
+
+#endif /* BANK_CHECKPOINT_H */
@@ -0,0 +1,62 @@
+/* bank_fault.c
+ * Fault injection for the crash recovery harness
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "bank_fault.h"
+
+int faultArmed = FAULT_NONE;
+
+static long faultCountdown = 0;
+
+static const char *faultNames[FAULT_NUM_POINTS] = {
+    "log_write", "log_append", "teller_spawn", "batch_apply", "batch_reply",
+    "teller_stall"
+};
+
+/* Arm the point named by BANK_FAULT. Returns the point, FAULT_NONE if the
+ * variable is unset, or -2 if it names no known point. */
+int faultInit(void) {
+    const char *spec = getenv(FAULT_ENV);
+    if (spec == NULL || spec[0] == '\0') {
+        return FAULT_NONE;
+    }
+    
+    const char *colon = strchr(spec, ':');
+    size_t nameLen = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
+    long hit = colon != NULL ? strtol(colon + 1, NULL, 10) : 1;
+    
+    for (int i = 0; i < FAULT_NUM_POINTS; i++) {
+        if (strlen(faultNames[i]) == nameLen && strncmp(spec, faultNames[i], nameLen) == 0) {
+            faultCountdown = hit > 0 ? hit : 1;
+            faultArmed = i;
+            return i;
+        }
+    }
+    return -2;
+}
+
+const char *faultName(int point) {
+    return point >= 0 && point < FAULT_NUM_POINTS ? faultNames[point] : "none";
+}
+
+/* Count a pass through the armed point. Returns 1 on the pass that fails;
+ * children forked after it has fired never fail again. */
+int faultHit(int point) {
+    if (faultArmed != point || --faultCountdown > 0) {
+        return 0;
+    }
+    faultArmed = FAULT_NONE;
+    return 1;
+}
+
+/* Die the way a crash or the OOM killer would: no handlers, no cleanup */
+void faultCrash(int point) {
+    printf("Fault: crashing at %s\n", faultName(point));
+    fflush(stdout);
+    kill(getpid(), SIGKILL);
+    _exit(137);
+}
@@ -0,0 +1,43 @@
+/* bank_fault.h
+ * Fault injection for the crash recovery harness
+ *
+ * BANK_FAULT=<point>:<n> in the server's environment kills the server
+ * with SIGKILL the nth time it passes the named point, so recovery can be
+ * tested from a known place in the request path. The teller_stall point
+ * does not crash: the nth teller spawned waits TELLER_STALL_MS before it
+ * hands its request in, so a later teller of the round reports first.
+ * Unset, every point is one comparison.
+ */
+#ifndef BANK_FAULT_H
+#define BANK_FAULT_H
+
+#define FAULT_ENV "BANK_FAULT"
+
+/* Points a fault can be injected at */
+#define FAULT_NONE -1
+#define FAULT_LOG_WRITE 0       /* Inside a log write, after half of its bytes */
+#define FAULT_LOG_APPEND 1      /* A record buffered, not yet flushed */
+#define FAULT_TELLER_SPAWN 2    /* Between forking two tellers of a round */
+#define FAULT_BATCH_APPLY 3     /* Round applied and logged, no response sent */
+#define FAULT_BATCH_REPLY 4     /* Round's responses written */
+#define FAULT_TELLER_STALL 5    /* A teller holds its request back (no crash) */
+#define FAULT_NUM_POINTS 6
+
+/* How long a stalled teller holds its request back */
+#define TELLER_STALL_MS 300
+
+extern int faultArmed;          /* Point armed by BANK_FAULT, FAULT_NONE if unset */
+
+int faultInit(void);
+const char *faultName(int point);
+int faultHit(int point);
+void faultCrash(int point);
+
+/* Crash here if this pass is the one the fault is armed for */
+#define FAULT_POINT(point) do { \
+    if (faultArmed == (point) && faultHit(point)) { \
+        faultCrash(point); \
+    } \
+} while (0)
+
+#endif /* BANK_FAULT_H */
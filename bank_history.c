@@ -0,0 +1,372 @@
+/* bank_history.c
+ * Per-account history index over the bank log
+ */
+#define _GNU_SOURCE /* mremap */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bank_utils.h"
+#include "bank_history.h"
+
+#define HEADER(map) ((HistoryHeader *)(map))
+#define SLOTS(map) ((HistorySlot *)((char *)(map) + sizeof(HistoryHeader)))
+#define BLOCKS(map) ((HistoryBlock *)(SLOTS(map) + HEADER(map)->tableSize))
+
+static size_t historyFileSize(uint32_t tableSize, uint32_t blockCapacity) {
+    return sizeof(HistoryHeader) + (size_t)tableSize * sizeof(HistorySlot) +
+           (size_t)blockCapacity * sizeof(HistoryBlock);
+}
+
+/* Multiplicative hash of an account number */
+static uint32_t hashAccountId(int32_t accountId) {
+    return (uint32_t)accountId * 2654435761u;
+}
+
+/* Find the slot of an account, or the empty slot where it would go */
+static HistorySlot *findSlot(const void *map, int32_t accountId) {
+    uint32_t mask = HEADER(map)->tableSize - 1;
+    uint32_t i = hashAccountId(accountId) & mask;
+    HistorySlot *slots = SLOTS(map);
+    
+    while (slots[i].inUse && slots[i].accountId != accountId) {
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+/* Map the file at its current size */
+static int mapIndex(HistoryIndex *index, size_t size) {
+    if (ftruncate(index->fd, size) == -1) {
+        return -1;
+    }
+    
+    void *map = index->map == NULL ?
+                mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, index->fd, 0) :
+                mremap(index->map, index->mapSize, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    
+    index->map = map;
+    index->mapSize = size;
+    return 0;
+}
+
+/* Start an empty index, discarding whatever the file held */
+static int initIndex(HistoryIndex *index, uint32_t tableSize, uint32_t blockCapacity) {
+    if (index->map != NULL) {
+        munmap(index->map, index->mapSize);
+        index->map = NULL;
+    }
+    
+    /* Truncate first so the file reads back as zeros */
+    if (ftruncate(index->fd, 0) == -1 ||
+        mapIndex(index, historyFileSize(tableSize, blockCapacity)) == -1) {
+        return -1;
+    }
+    
+    HistoryHeader *header = HEADER(index->map);
+    header->magic = HISTORY_MAGIC;
+    header->version = HISTORY_VERSION;
+    header->tableSize = tableSize;
+    header->blockCapacity = blockCapacity;
+    return 0;
+}
+
+/* Double the account table. The blocks region is moved up unchanged,
+ * since blocks refer to each other by number, and the slots are rehashed. */
+static int growTable(HistoryIndex *index) {
+    HistoryHeader *header = HEADER(index->map);
+    uint32_t oldSize = header->tableSize;
+    size_t slotBytes = (size_t)oldSize * sizeof(HistorySlot);
+    size_t blockBytes = (size_t)header->blockCapacity * sizeof(HistoryBlock);
+    
+    HistorySlot *oldSlots = malloc(slotBytes);
+    if (oldSlots == NULL) {
+        return -1;
+    }
+    memcpy(oldSlots, SLOTS(index->map), slotBytes);
+    
+    if (mapIndex(index, historyFileSize(2 * oldSize, header->blockCapacity)) == -1) {
+        free(oldSlots);
+        return -1;
+    }
+    header = HEADER(index->map);
+    
+    char *base = (char *)SLOTS(index->map);
+    memmove(base + 2 * slotBytes, base + slotBytes, blockBytes);
+    memset(base, 0, 2 * slotBytes);
+    header->tableSize = 2 * oldSize;
+    
+    for (uint32_t i = 0; i < oldSize; i++) {
+        if (oldSlots[i].inUse) {
+            *findSlot(index->map, oldSlots[i].accountId) = oldSlots[i];
+        }
+    }
+    
+    free(oldSlots);
+    return 0;
+}
+
+static int growBlocks(HistoryIndex *index) {
+    HistoryHeader *header = HEADER(index->map);
+    uint32_t blockCapacity = 2 * header->blockCapacity;
+    
+    if (mapIndex(index, historyFileSize(header->tableSize, blockCapacity)) == -1) {
+        return -1;
+    }
+    HEADER(index->map)->blockCapacity = blockCapacity;
+    return 0;
+}
+
+/* Index the log from the covered size up to its last complete line */
+static int catchUp(HistoryIndex *index, const char *logName) {
+    FILE *log = fopen(logName, "r");
+    if (log == NULL) {
+        return 0; /* No log yet */
+    }
+    
+    HistoryHeader *header = HEADER(index->map);
+    if (fseek(log, header->logSize, SEEK_SET) == -1) {
+        fclose(log);
+        return -1;
+    }
+    
+    uint64_t offset = header->logSize;
+    char *line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    
+    while ((length = getline(&line, &lineSize, log)) > 0) {
+        /* A line without its newline is still being written */
+        if (line[length - 1] != '\n') {
+            break;
+        }
+        
+        LogRecord rec;
+        if (parseLogRecord(line, length, &rec)) {
+            historyAppend(index, rec.accountId, offset, length, 0);
+        } else {
+            HEADER(index->map)->logSize = offset + length;
+        }
+        offset += length;
+    }
+    
+    free(line);
+    fclose(log);
+    return 0;
+}
+
+/* Open the index next to the log, creating or rebuilding it as needed,
+ * and bring it up to date with the log. Returns 0 on success or -1. */
+int historyOpen(HistoryIndex *index, const char *indexName, const char *logName) {
+    memset(index, 0, sizeof(HistoryIndex));
+    snprintf(index->name, sizeof(index->name), "%s", indexName);
+    
+    index->fd = open(indexName, O_RDWR | O_CREAT, 0644);
+    if (index->fd == -1) {
+        return -1;
+    }
+    
+    struct stat indexStat, logStat;
+    if (fstat(index->fd, &indexStat) == -1) {
+        historyClose(index, NULL);
+        return -1;
+    }
+    if (stat(logName, &logStat) == -1) {
+        logStat.st_size = 0;
+    }
+    
+    /* Reuse an index that was closed cleanly and does not claim more log than exists */
+    int reuse = 0;
+    if ((size_t)indexStat.st_size >= sizeof(HistoryHeader) &&
+        mapIndex(index, indexStat.st_size) == 0) {
+        HistoryHeader *header = HEADER(index->map);
+        reuse = header->magic == HISTORY_MAGIC && header->version == HISTORY_VERSION &&
+                header->clean && !header->incomplete && header->logSize <= (uint64_t)logStat.st_size &&
+                historyFileSize(header->tableSize, header->blockCapacity) == (size_t)indexStat.st_size;
+    }
+    
+    if (!reuse && initIndex(index, HISTORY_MIN_TABLE, HISTORY_MIN_BLOCKS) == -1) {
+        historyClose(index, NULL);
+        return -1;
+    }
+    
+    if (catchUp(index, logName) == -1) {
+        historyClose(index, NULL);
+        return -1;
+    }
+    
+    /* Anything after this point may be lost in a crash */
+    HEADER(index->map)->clean = 0;
+    return 0;
+}
+
+/* Give up on indexing after a record could not be added. The index stays
+ * marked incomplete, so readers refuse it and the next open rebuilds it. */
+static void historyFail(HistoryIndex *index, const char *what) {
+    fprintf(stderr, "History index %s: %s failed (%s); it will be rebuilt on the next start\n",
+            index->name, what, strerror(errno));
+    HEADER(index->map)->incomplete = 1;
+}
+
+/* Record that a line of length bytes for an account was just appended to
+ * the log at offset. The offset comes from the writer, since other lines
+ * (diagnostics, headers) may sit between records. */
+void historyAppend(HistoryIndex *index, int accountId, uint64_t offset, int length, time_t when) {
+    if (index->map == NULL || HEADER(index->map)->incomplete) {
+        return;
+    }
+    
+    if (2 * (HEADER(index->map)->numAccounts + 1) > HEADER(index->map)->tableSize &&
+        growTable(index) == -1) {
+        historyFail(index, "growing the account table");
+        return;
+    }
+    
+    HistoryHeader *header = HEADER(index->map);
+    HistorySlot *slot = findSlot(index->map, accountId);
+    
+    if (!slot->inUse) {
+        slot->accountId = accountId;
+        slot->inUse = 1;
+        slot->lastBlock = -1;
+        header->numAccounts++;
+    }
+    
+    /* Start a new block when the account's newest one is full */
+    if (slot->numEntries % HISTORY_BLOCK_ENTRIES == 0) {
+        if (header->numBlocks == header->blockCapacity) {
+            /* The mapping may move, so find the slot again afterwards */
+            if (growBlocks(index) == -1) {
+                historyFail(index, "growing the blocks");
+                return;
+            }
+            header = HEADER(index->map);
+            slot = findSlot(index->map, accountId);
+        }
+        
+        HistoryBlock *block = &BLOCKS(index->map)[header->numBlocks];
+        block->prevBlock = slot->lastBlock;
+        block->count = 0;
+        slot->lastBlock = header->numBlocks++;
+    }
+    
+    HistoryBlock *block = &BLOCKS(index->map)[slot->lastBlock];
+    HistoryEntry *entry = &block->entries[block->count];
+    entry->seq = header->nextSeq++;
+    entry->time = when;
+    entry->offset = offset;
+    entry->length = length;
+    
+    /* Publish the entry only once it is complete */
+    __atomic_store_n(&block->count, block->count + 1, __ATOMIC_RELEASE);
+    slot->numEntries++;
+    header->logSize = offset + length;
+}
+
+/* Index whatever was written since the last record (shutdown dumps,
+ * headers) and mark the index clean, unless a record is missing from it.
+ * logName may be NULL on error paths. */
+void historyClose(HistoryIndex *index, const char *logName) {
+    if (index->map != NULL) {
+        if (logName != NULL && !HEADER(index->map)->incomplete) {
+            catchUp(index, logName);
+            HEADER(index->map)->clean = 1;
+        }
+        msync(index->map, index->mapSize, MS_SYNC);
+        munmap(index->map, index->mapSize);
+        index->map = NULL;
+    }
+    
+    if (index->fd != -1) {
+        close(index->fd);
+        index->fd = -1;
+    }
+}
+
+/* Map an index read-only. Returns NULL if it does not exist, is invalid
+ * or is missing records. */
+void *historyMap(const char *indexName, size_t *mapSize) {
+    int fd = open(indexName, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(HistoryHeader)) {
+        close(fd);
+        return NULL;
+    }
+    
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    
+    HistoryHeader *header = HEADER(map);
+    if (header->magic != HISTORY_MAGIC || header->version != HISTORY_VERSION || header->incomplete ||
+        historyFileSize(header->tableSize, header->blockCapacity) > (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    
+    *mapSize = st.st_size;
+    return map;
+}
+
+/* Collect the records of one account with fromSeq <= seq <= toSeq and
+ * fromTime <= time <= toTime from a mapped index, oldest first. Only the account's own blocks
+ * are read, newest first, and the walk stops at the first block that lies
+ * entirely before the range. If more than maxEntries match, the newest
+ * maxEntries are returned. Returns the number of matching records. */
+int historyQuery(const void *map, size_t mapSize, int accountId, uint64_t fromSeq,
+                 uint64_t toSeq, int64_t fromTime, int64_t toTime, HistoryEntry *out, int maxEntries) {
+    HistorySlot *slot = findSlot(map, accountId);
+    if (!slot->inUse) {
+        return 0;
+    }
+    
+    /* A live server may have grown the file past our mapping */
+    int32_t mappedBlocks = (mapSize - historyFileSize(HEADER(map)->tableSize, 0)) / sizeof(HistoryBlock);
+    int matched = 0;
+    HistoryBlock *blocks = BLOCKS(map);
+    
+    for (int32_t b = slot->lastBlock; b >= 0 && b < mappedBlocks; b = blocks[b].prevBlock) {
+        HistoryBlock *block = &blocks[b];
+        int count = __atomic_load_n(&block->count, __ATOMIC_ACQUIRE);
+        
+        for (int i = count - 1; i >= 0; i--) {
+            HistoryEntry *entry = &block->entries[i];
+            
+            if (entry->seq < fromSeq || (entry->time != 0 && entry->time < fromTime)) {
+                goto done; /* Everything older is out of range too */
+            }
+            if (entry->seq > toSeq || entry->time < fromTime || entry->time > toTime) {
+                continue;
+            }
+            
+            if (matched < maxEntries) {
+                out[matched] = *entry;
+            }
+            matched++;
+        }
+    }
+
+done:;
+    /* Collected newest first, return oldest first */
+    int n = matched < maxEntries ? matched : maxEntries;
+    for (int i = 0; i < n / 2; i++) {
+        HistoryEntry tmp = out[i];
+        out[i] = out[n - 1 - i];
+        out[n - 1 - i] = tmp;
+    }
+    
+    return matched;
+}
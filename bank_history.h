@@ -0,0 +1,75 @@
+/* bank_history.h
+ * Per-account history index over the bank log
+ */
+#ifndef BANK_HISTORY_H
+#define BANK_HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define HISTORY_MAGIC 0x31584449484b4e42ULL /* "BNKHIDX1" */
+#define HISTORY_VERSION 2
+#define HISTORY_BLOCK_ENTRIES 32    /* Entries per block of one account */
+#define HISTORY_MIN_TABLE 1024      /* Initial number of account slots */
+#define HISTORY_MIN_BLOCKS 256      /* Initial number of blocks */
+#define HISTORY_NAME_TEMPLATE "%s.bankIdx"
+
+/* File layout: header, account slot table, then blocks.
+ * Each account owns a chain of blocks, newest first; a block holds up to
+ * HISTORY_BLOCK_ENTRIES records in log order. Looking up an account and
+ * walking its chain only touches that account's entries. */
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t clean;             /* Set by an orderly close, cleared while the writer is open */
+    uint32_t tableSize;         /* Account slots, a power of two */
+    uint32_t numAccounts;       /* Slots in use */
+    uint32_t numBlocks;         /* Blocks in use */
+    uint32_t blockCapacity;     /* Blocks the file has room for */
+    uint64_t nextSeq;           /* Sequence number of the next record */
+    uint64_t logSize;           /* Bytes of the log covered by the index */
+    uint32_t incomplete;        /* A record could not be indexed; rebuilt on the next open */
+    uint8_t pad[12];
+} HistoryHeader;
+
+typedef struct {
+    int32_t accountId;          /* Account number */
+    uint32_t inUse;             /* 0 for an unused slot */
+    int32_t lastBlock;          /* Newest block of the account, -1 if none */
+    uint32_t numEntries;        /* Records of the account */
+} HistorySlot;
+
+typedef struct {
+    uint64_t seq;               /* Record number in the log, from 0 */
+    int64_t time;               /* When the record was written, 0 if unknown */
+    uint64_t offset;            /* Byte offset of the record line in the log */
+    uint32_t length;            /* Length of the line including the newline */
+    uint32_t pad;
+} HistoryEntry;
+
+typedef struct {
+    int32_t prevBlock;          /* Next older block of the account, -1 at the end */
+    uint32_t count;             /* Entries used */
+    HistoryEntry entries[HISTORY_BLOCK_ENTRIES];
+} HistoryBlock;
+
+/* Writer handle - the server keeps the index mapped read/write */
+typedef struct {
+    int fd;
+    void *map;
+    size_t mapSize;
+    char name[80];
+} HistoryIndex;
+
+/* Writer side */
+int historyOpen(HistoryIndex *index, const char *indexName, const char *logName);
+void historyAppend(HistoryIndex *index, int accountId, uint64_t offset, int length, time_t when);
+void historyClose(HistoryIndex *index, const char *logName);
+
+/* Reader side */
+void *historyMap(const char *indexName, size_t *mapSize);
+int historyQuery(const void *map, size_t mapSize, int accountId, uint64_t fromSeq,
+                 uint64_t toSeq, int64_t fromTime, int64_t toTime, HistoryEntry *out, int maxEntries);
+
+#endif /* BANK_HISTORY_H */
@@ -0,0 +1,498 @@
+/* bank_io.c
+ * Server I/O backends: plain system calls or batched through io_uring
+ */
+#define _GNU_SOURCE /* fopencookie */
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "bank_uring.h"
+#include "bank_io.h"
+#include "bank_fault.h"
+
+#define IO_TAG_LOG (~0ULL)      /* user_data of the log write in a batch */
+#define IO_BUF_READ 0           /* Registered buffer indices */
+#define IO_BUF_LOG 1
+
+IoStats ioStats;
+
+static Uring ring;
+static int useRing = 0;         /* Cleared in forked children, which must not touch the ring */
+static int fixedServerFd = -1;  /* Descriptor registered in IO_SLOT_SERVER */
+static int logFd = -1;
+static FILE *logStream = NULL;  /* The stdio stream over logFd */
+static off_t logEnd = 0;        /* Log offset just past the bytes handed to the backend */
+static int logFixed = 0;        /* logFd is registered in IO_SLOT_LOG */
+
+/* Requests read from the server FIFO; a partial request is carried over */
+static ClientRequest readBuf[IO_READ_BATCH];
+static size_t readCarry = 0;    /* Bytes of a partial request at carryFrom */
+static size_t carryFrom = 0;
+
+/* Log bytes waiting to go out with the next batch */
+static char logStaging[IO_LOG_STAGING];
+static size_t logStaged = 0;
+static size_t logQueued = 0;    /* Leading staged bytes of a submitted log write */
+static int logHeld = 0;
+
+static void forgetRing(void) {
+    useRing = 0;
+}
+
+/* Select the backend. Returns 0, or -1 if io_uring was asked for but is
+ * unavailable, in which case plain system calls are used. */
+int ioInit(int backend) {
+    memset(&ioStats, 0, sizeof(ioStats));
+    ioStats.backend = IO_SELECT;
+    pthread_atfork(NULL, NULL, forgetRing);
+    
+    if (backend != IO_URING) {
+        return 0;
+    }
+    
+    if (uringInit(&ring, IO_RING_ENTRIES) == -1) {
+        return -1;
+    }
+    
+    /* Reads land in and log writes leave from pinned buffers */
+    struct iovec iovs[2] = {
+        { .iov_base = readBuf, .iov_len = sizeof(readBuf) },
+        { .iov_base = logStaging, .iov_len = sizeof(logStaging) },
+    };
+    int slots[IO_NUM_SLOTS] = { -1, -1, -1 };
+    if (uringRegisterBuffers(&ring, iovs, 2) == -1 ||
+        uringRegisterFiles(&ring, slots, IO_NUM_SLOTS) == -1) {
+        uringFree(&ring);
+        return -1;
+    }
+    
+    useRing = 1;
+    ioStats.backend = IO_URING;
+    return 0;
+}
+
+void ioShutdown(void) {
+    if (useRing) {
+        ioStats.syscalls += ring.enters;
+        uringFree(&ring);
+        useRing = 0;
+    }
+}
+
+/* write() until everything is out, counting the calls */
+static ssize_t writeAll(int fd, const char *buf, size_t len) {
+    size_t done = 0;
+    
+    while (done < len) {
+        ssize_t n = write(fd, buf + done, len - done);
+        ioStats.ops++;
+        ioStats.syscalls++;
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return done > 0 ? (ssize_t)done : -1;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/* Queue the staged log bytes. Returns the number of entries queued. */
+static int queueLogWrite(void) {
+    if (logStaged == 0 || logQueued > 0) {
+        return 0;
+    }
+    
+    struct io_uring_sqe *sqe = uringGetSqe(&ring);
+    if (sqe == NULL) {
+        return 0;
+    }
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = logFixed ? IO_SLOT_LOG : logFd;
+    sqe->flags = logFixed ? IOSQE_FIXED_FILE : 0;
+    sqe->addr = (unsigned long)logStaging;
+    sqe->len = logStaged;
+    sqe->off = -1; /* Appends, the log is O_APPEND */
+    sqe->buf_index = IO_BUF_LOG;
+    sqe->user_data = IO_TAG_LOG;
+    ioStats.ops++;
+    logQueued = logStaged;
+    return 1;
+}
+
+/* The queued log write completed with res; finish it by hand if it fell
+ * short and keep whatever was staged behind it */
+static void logWriteDone(int res) {
+    size_t written = res > 0 ? (size_t)res : 0;
+    
+    if (written < logQueued) {
+        writeAll(logFd, logStaging + written, logQueued - written);
+    }
+    logStaged -= logQueued;
+    memmove(logStaging, logStaging + logQueued, logStaged);
+    logQueued = 0;
+}
+
+/* Wait for the queued log write to complete. Other completions only turn
+ * up here when the shutdown signal interrupted a batch, whose results
+ * nobody reads any more, so they are dropped. */
+static void awaitLogWrite(void) {
+    struct io_uring_cqe cqe;
+    
+    while (logQueued > 0) {
+        if (uringWaitCqe(&ring, &cqe) == -1) {
+            logWriteDone(0);
+        } else if (cqe.user_data == IO_TAG_LOG) {
+            logWriteDone(cqe.res);
+        }
+    }
+}
+
+/* Write out whatever log bytes are staged, on their own */
+static void flushLog(void) {
+    awaitLogWrite();
+    if (logStaged == 0) {
+        return;
+    }
+    
+    if (queueLogWrite() == 0) {
+        logQueued = logStaged; /* No room in the ring, write it by hand */
+        logWriteDone(0);
+    } else if (uringSubmit(&ring, 1) == 1) {
+        awaitLogWrite();
+    } else {
+        logWriteDone(0);
+    }
+}
+
+/* Stage log bytes for the ring, writing them by hand if they do not fit */
+static ssize_t stageLog(const char *buf, size_t size) {
+    if (logStaged + size > sizeof(logStaging)) {
+        flushLog();
+    }
+    if (size > sizeof(logStaging)) {
+        return writeAll(logFd, buf, size);
+    }
+    
+    memcpy(logStaging + logStaged, buf, size);
+    logStaged += size;
+    
+    /* Held bytes go out together with the round's responses */
+    if (!logHeld) {
+        flushLog();
+    }
+    return size;
+}
+
+/* stdio flushes of the log end up here */
+static ssize_t logCookieWrite(void *cookie, const char *buf, size_t size) {
+    (void)cookie;
+    
+    /* An injected crash half way through leaves a torn record behind */
+    if (faultArmed == FAULT_LOG_WRITE && faultHit(FAULT_LOG_WRITE)) {
+        flushLog();
+        writeAll(logFd, buf, size / 2);
+        faultCrash(FAULT_LOG_WRITE);
+    }
+    
+    ssize_t written = useRing ? stageLog(buf, size) : writeAll(logFd, buf, size);
+    if (written > 0) {
+        logEnd += written;
+    }
+    return written;
+}
+
+static int logCookieClose(void *cookie) {
+    (void)cookie;
+    
+    if (useRing) {
+        flushLog();
+        if (logFixed) {
+            uringUpdateFile(&ring, IO_SLOT_LOG, -1);
+            logFixed = 0;
+        }
+    }
+    int ret = close(logFd);
+    logFd = -1;
+    logStream = NULL;
+    return ret;
+}
+
+/* Open the transaction log for appending ("w" truncates it first). All
+ * writes go through the backend; stdio only formats into a large buffer. */
+FILE *ioOpenLog(const char *name, const char *mode) {
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+    if (mode[0] == 'w') {
+        flags |= O_TRUNC;
+    }
+    
+    logFd = open(name, flags, 0644);
+    if (logFd == -1) {
+        return NULL;
+    }
+    
+    struct stat st;
+    logEnd = fstat(logFd, &st) == 0 ? st.st_size : 0;
+    
+    cookie_io_functions_t functions = {
+        .read = NULL,
+        .write = logCookieWrite,
+        .seek = NULL,
+        .close = logCookieClose,
+    };
+    FILE *log = fopencookie(NULL, "a", functions);
+    if (log == NULL) {
+        close(logFd);
+        logFd = -1;
+        return NULL;
+    }
+    setvbuf(log, NULL, _IOFBF, IO_LOG_STAGING);
+    logStream = log;
+    
+    if (useRing) {
+        logFixed = uringUpdateFile(&ring, IO_SLOT_LOG, logFd) == 0;
+    }
+    return log;
+}
+
+/* Descriptor of the open log, for fstat and for closing it in a child */
+int ioLogFd(void) {
+    return logFd;
+}
+
+/* Offset in the log file at which the next byte printed to the log will
+ * land. Every line the server writes, records or not, passes through the
+ * backend, so this stays right when diagnostics are mixed in. */
+off_t ioLogOffset(void) {
+    return logStream != NULL ? logEnd + (off_t)__fpending(logStream) : logEnd;
+}
+
+/* Register the server FIFO once it is open */
+void ioAttachServerFd(int fd) {
+    if (useRing && fd != fixedServerFd && uringUpdateFile(&ring, IO_SLOT_SERVER, fd) == 0) {
+        fixedServerFd = fd;
+    }
+}
+
+/* Read as many whole requests as are waiting, up to IO_READ_BATCH, with one
+ * read. Writers send whole requests of at most PIPE_BUF bytes, which the
+ * FIFO keeps intact, so partial requests only appear if a writer misbehaves.
+ * Returns the number of requests at *requests, valid until the next call,
+ * 0 at end of file or -1 with errno set (EAGAIN when the FIFO is empty). */
+int ioReadRequests(int fd, ClientRequest **requests) {
+    char *base = (char *)readBuf;
+    
+    /* Move the partial request left over from the last call to the front */
+    if (readCarry > 0 && carryFrom > 0) {
+        memmove(base, base + carryFrom, readCarry);
+    }
+    carryFrom = 0;
+    
+    while (1) {
+        ssize_t numRead;
+        size_t room = sizeof(readBuf) - readCarry;
+        
+        if (useRing) {
+            /* The ring ignores O_NONBLOCK on pipes and waits for data
+             * instead, so only ask for what is already there */
+            int available = 0;
+            ioStats.syscalls++;
+            if (ioctl(fd, FIONREAD, &available) == -1) {
+                return -1;
+            }
+            if (available == 0) {
+                errno = EAGAIN;
+                return -1;
+            }
+            if ((size_t)available < room) {
+                room = available;
+            }
+            
+            struct io_uring_sqe *sqe = uringGetSqe(&ring);
+            struct io_uring_cqe cqe;
+            
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->fd = fd == fixedServerFd ? IO_SLOT_SERVER : fd;
+            sqe->flags = fd == fixedServerFd ? IOSQE_FIXED_FILE : 0;
+            sqe->addr = (unsigned long)(base + readCarry);
+            sqe->len = room;
+            sqe->buf_index = IO_BUF_READ;
+            ioStats.ops++;
+            
+            if (uringSubmit(&ring, 1) != 1 || uringWaitCqe(&ring, &cqe) == -1) {
+                return -1;
+            }
+            numRead = cqe.res;
+            if (numRead < 0) {
+                errno = -cqe.res;
+                numRead = -1;
+            }
+        } else {
+            numRead = read(fd, base + readCarry, room);
+            ioStats.ops++;
+            ioStats.syscalls++;
+        }
+        
+        if (numRead <= 0) {
+            return (int)numRead;
+        }
+        
+        size_t total = readCarry + numRead;
+        int count = total / sizeof(ClientRequest);
+        readCarry = total % sizeof(ClientRequest);
+        
+        if (count > 0) {
+            carryFrom = count * sizeof(ClientRequest);
+            *requests = readBuf;
+            return count;
+        }
+    }
+}
+
+/* Keep log writes staged until the next ioWriteBatch, so that the log
+ * records of a round and the responses to it are submitted together */
+void ioHoldLog(void) {
+    logHeld = 1;
+}
+
+/* Submit everything queued and collect count completions */
+static void completeBatch(IoWrite *writes, unsigned count) {
+    struct io_uring_cqe cqe;
+    
+    if (uringSubmit(&ring, count) < 0) {
+        count = 0;
+        if (logQueued > 0) {
+            logWriteDone(0);
+        }
+    }
+    for (unsigned i = 0; i < count && uringWaitCqe(&ring, &cqe) == 0; i++) {
+        if (cqe.user_data == IO_TAG_LOG) {
+            logWriteDone(cqe.res);
+        } else {
+            writes[cqe.user_data].result = cqe.res;
+        }
+    }
+}
+
+/* Perform a batch of writes. With io_uring, the held log bytes and all the
+ * writes go to the kernel in one submission; the writes are drained behind
+ * the log write, so no response leaves before its log record is written.
+ * Each entry's result is set like write() would set it (-errno on failure
+ * with io_uring, -1 with errno set otherwise). Returns 0. */
+int ioWriteBatch(IoWrite *writes, int count) {
+    logHeld = 0;
+    
+    if (!useRing) {
+        for (int i = 0; i < count; i++) {
+            writes[i].result = write(writes[i].fd, writes[i].buf, writes[i].len);
+            ioStats.ops++;
+            ioStats.syscalls++;
+        }
+        return 0;
+    }
+    
+    unsigned inFlight = queueLogWrite();
+    int drain = inFlight > 0;
+    
+    for (int i = 0; i < count; i++) {
+        writes[i].result = -ECANCELED;
+        
+        struct io_uring_sqe *sqe = uringGetSqe(&ring);
+        if (sqe == NULL) {
+            completeBatch(writes, inFlight);
+            inFlight = 0;
+            drain = 0;
+            sqe = uringGetSqe(&ring);
+        }
+        
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = writes[i].fd;
+        sqe->flags = drain ? IOSQE_IO_DRAIN : 0;
+        sqe->addr = (unsigned long)writes[i].buf;
+        sqe->len = writes[i].len;
+        sqe->user_data = i;
+        ioStats.ops++;
+        inFlight++;
+        drain = 0;
+    }
+    
+    if (inFlight > 0) {
+        completeBatch(writes, inFlight);
+    }
+    if (logStaged > 0) {
+        flushLog(); /* The log write could not be queued */
+    }
+    return 0;
+}
+
+/* Open a FIFO without blocking, write buf and close it. With io_uring the
+ * three steps are one linked submission through a direct descriptor.
+ * Returns 0 if everything was written, -1 otherwise. */
+int ioSendFile(const char *path, const void *buf, size_t len) {
+    if (!useRing) {
+        int fd = open(path, O_WRONLY | O_NONBLOCK);
+        ioStats.ops++;
+        ioStats.syscalls++;
+        if (fd == -1) {
+            return -1;
+        }
+        
+        ssize_t numWritten = write(fd, buf, len);
+        close(fd);
+        ioStats.ops += 2;
+        ioStats.syscalls += 2;
+        return numWritten == (ssize_t)len ? 0 : -1;
+    }
+    
+    struct io_uring_sqe *open = uringGetSqe(&ring);
+    open->opcode = IORING_OP_OPENAT;
+    open->fd = AT_FDCWD;
+    open->addr = (unsigned long)path;
+    open->open_flags = O_WRONLY | O_NONBLOCK;
+    open->file_index = IO_SLOT_CLIENT + 1;
+    open->flags = IOSQE_IO_LINK;
+    open->user_data = 0;
+    
+    /* A hard link, so the descriptor is closed even if the write fails */
+    struct io_uring_sqe *sqe = uringGetSqe(&ring);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = IO_SLOT_CLIENT;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->user_data = 1;
+    
+    struct io_uring_sqe *close = uringGetSqe(&ring);
+    close->opcode = IORING_OP_CLOSE;
+    close->file_index = IO_SLOT_CLIENT + 1;
+    close->user_data = 2;
+    ioStats.ops += 3;
+    
+    if (uringSubmit(&ring, 3) != 3) {
+        return -1;
+    }
+    
+    int written = -1;
+    struct io_uring_cqe cqe;
+    for (int i = 0; i < 3 && uringWaitCqe(&ring, &cqe) == 0; i++) {
+        if (cqe.user_data == 1) {
+            written = cqe.res;
+        }
+    }
+    return written == (int)len ? 0 : -1;
+}
+
+void ioPrintStats(FILE *out) {
+    unsigned long syscalls = ioStats.syscalls + (useRing ? ring.enters : 0);
+    
+    fprintf(out, "I/O: backend=%s ops=%lu syscalls=%lu ops_per_syscall=%.2f\n",
+            ioStats.backend == IO_URING ? "io_uring" : "syscalls",
+            ioStats.ops, syscalls, syscalls > 0 ? (double)ioStats.ops / syscalls : 0.0);
+}
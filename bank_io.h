@@ -0,0 +1,52 @@
+/* bank_io.h
+ * Server I/O backends: plain system calls or batched through io_uring
+ */
+#ifndef BANK_IO_H
+#define BANK_IO_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "bank_shared.h"
+
+#define IO_SELECT 0     /* One read/write system call per operation */
+#define IO_URING 1      /* Operations queued on an io_uring and submitted together */
+
+#define IO_READ_BATCH 64            /* Requests taken off the server FIFO per read */
+#define IO_LOG_STAGING (64 * 1024)  /* Log bytes buffered before they are written */
+#define IO_RING_ENTRIES 256
+
+/* Registered file slots of the io_uring backend */
+#define IO_SLOT_SERVER 0    /* Server FIFO */
+#define IO_SLOT_LOG 1       /* Transaction log */
+#define IO_SLOT_CLIENT 2    /* Client FIFO being answered, opened as a direct descriptor */
+#define IO_NUM_SLOTS 3
+
+/* One write of a batch; result is what write() would have returned */
+typedef struct {
+    int fd;
+    const void *buf;
+    size_t len;
+    ssize_t result;
+} IoWrite;
+
+typedef struct {
+    int backend;
+    unsigned long ops;          /* Reads, writes, opens and closes performed */
+    unsigned long syscalls;     /* System calls they took */
+} IoStats;
+
+extern IoStats ioStats;
+
+int ioInit(int backend);
+void ioShutdown(void);
+FILE *ioOpenLog(const char *name, const char *mode);
+int ioLogFd(void);
+off_t ioLogOffset(void);
+void ioAttachServerFd(int fd);
+int ioReadRequests(int fd, ClientRequest **requests);
+void ioHoldLog(void);
+int ioWriteBatch(IoWrite *writes, int count);
+int ioSendFile(const char *path, const void *buf, size_t len);
+void ioPrintStats(FILE *out);
+
+#endif /* BANK_IO_H */
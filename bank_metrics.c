@@ -0,0 +1,354 @@
+/* bank_metrics.c
+ * Runtime counters kept by the server
+ */
+#define _GNU_SOURCE /* accept4 */
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "bank_metrics.h"
+
+#define EXPORTER_REQUEST_WAIT_MS 50 /* How long a scraper gets to send its HTTP request */
+#define EXPORTER_BUF_SIZE 8192
+
+/* Counts until metricsInit maps the shared copy */
+static ServerMetrics localMetrics;
+ServerMetrics *serverMetrics = &localMetrics;
+
+static int exporterFd = -1;
+static char exporterPath[108];
+
+#define METRIC_ADD(field, n) __atomic_fetch_add(&serverMetrics->field, (n), __ATOMIC_RELAXED)
+#define METRIC_SET(field, v) __atomic_store_n(&serverMetrics->field, (v), __ATOMIC_RELAXED)
+#define METRIC_GET(field) __atomic_load_n(&serverMetrics->field, __ATOMIC_RELAXED)
+
+static void metricMax(unsigned long *field, unsigned long value) {
+    unsigned long current = __atomic_load_n(field, __ATOMIC_RELAXED);
+    while (value > current && 
+           !__atomic_compare_exchange_n(field, &current, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        /* current now holds what another process stored, try again */
+    }
+}
+
+static unsigned long msToNs(double ms) {
+    return ms > 0 ? (unsigned long)(ms * 1000000.0) : 0;
+}
+
+/* Move the counters to a shared mapping, before any teller is forked.
+ * Returns 0 or -1. */
+int metricsInit(void) {
+    ServerMetrics *shared = mmap(NULL, sizeof(ServerMetrics), PROT_READ | PROT_WRITE, 
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+    
+    memcpy(shared, &localMetrics, sizeof(ServerMetrics));
+    serverMetrics = shared;
+    return 0;
+}
+
+/* Account for one apply stage that held the database lock for lockHoldMs */
+void metricsRecordApply(int numOps, double lockHoldMs) {
+    unsigned long holdNs = msToNs(lockHoldMs);
+    
+    METRIC_ADD(batchesApplied, 1);
+    METRIC_ADD(opsApplied, numOps);
+    METRIC_ADD(lockAcquisitions, 1);
+    METRIC_ADD(lockHoldTotalNs, holdNs);
+    metricMax(&serverMetrics->lockHoldMaxNs, holdNs);
+    
+    int bucket = 0;
+    while (bucket < METRICS_BATCH_BUCKETS - 1 && numOps > (1 << bucket)) {
+        bucket++;
+    }
+    METRIC_ADD(batchSizeBuckets[bucket], 1);
+    METRIC_ADD(batchSizeSum, numOps);
+}
+
+/* Account for the arena use of one scheduling round, just before it is reset */
+void metricsRecordRound(unsigned long allocs, unsigned long bytes, unsigned long overflows) {
+    METRIC_ADD(rounds, 1);
+    METRIC_ADD(roundAllocs, allocs);
+    METRIC_SET(roundOverflows, overflows);
+    metricMax(&serverMetrics->roundAllocsMax, allocs);
+    metricMax(&serverMetrics->roundBytesMax, bytes);
+}
+
+/* Account for one reaped teller that lived lifetimeMs */
+void metricsRecordTeller(double lifetimeMs, int failed, int signaled, int timedOut) {
+    unsigned long lifetimeNs = msToNs(lifetimeMs);
+    
+    METRIC_ADD(tellersReaped, 1);
+    METRIC_ADD(tellersFailed, failed != 0);
+    METRIC_ADD(tellersSignaled, signaled != 0);
+    METRIC_ADD(tellersTimedOut, timedOut != 0);
+    METRIC_ADD(tellerLifetimeTotalNs, lifetimeNs);
+    metricMax(&serverMetrics->tellerLifetimeMaxNs, lifetimeNs);
+}
+
+/* Account for one answered operation of type op (OP_*) with its status */
+void metricsRecordResult(int op, int status) {
+    if (op > 0 && op < METRICS_OP_TYPES) {
+        METRIC_ADD(opsByType[op], 1);
+    }
+    if (status < 0 && -status < METRICS_ERROR_TYPES) {
+        METRIC_ADD(errorsByType[-status], 1);
+    }
+}
+
+void metricsRecordLogBytes(int bytes) {
+    if (bytes > 0) {
+        METRIC_ADD(logBytes, bytes);
+    }
+}
+
+/* Account for one commit of the log that took commitMs */
+void metricsRecordCommit(double commitMs) {
+    static const double bucketMs[METRICS_COMMIT_BUCKETS - 1] = { 0.01, 0.05, 0.1, 0.5, 1, 5, 50 };
+    
+    int bucket = 0;
+    while (bucket < METRICS_COMMIT_BUCKETS - 1 && commitMs > bucketMs[bucket]) {
+        bucket++;
+    }
+    METRIC_ADD(logCommitBuckets[bucket], 1);
+    METRIC_ADD(logCommits, 1);
+    METRIC_ADD(logCommitTotalNs, msToNs(commitMs));
+}
+
+void metricsSetGauges(long activeTellers, long queuedOps, long activeSessions) {
+    METRIC_SET(activeTellers, activeTellers);
+    METRIC_SET(queuedOps, queuedOps);
+    METRIC_SET(activeSessions, activeSessions);
+}
+
+void metricsSetActiveTellers(long activeTellers) {
+    METRIC_SET(activeTellers, activeTellers);
+}
+
+/* Append formatted text at *used, never past size */
+static void append(char *buf, size_t size, size_t *used, const char *format, ...) 
+    __attribute__((format(printf, 4, 5)));
+
+static void append(char *buf, size_t size, size_t *used, const char *format, ...) {
+    if (*used >= size) {
+        return;
+    }
+    
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + *used, size - *used, format, args);
+    va_end(args);
+    
+    if (n > 0) {
+        *used += (size_t)n < size - *used ? (size_t)n : size - *used;
+    }
+}
+
+/* One Prometheus histogram from cumulative bucket counts */
+static void appendHistogram(char *buf, size_t size, size_t *used, const char *name, 
+                            const char *const *bounds, const unsigned long *buckets, 
+                            int numBuckets, double sum) {
+    unsigned long cumulative = 0;
+    
+    append(buf, size, used, "# TYPE %s histogram\n", name);
+    for (int i = 0; i < numBuckets; i++) {
+        cumulative += __atomic_load_n(&buckets[i], __ATOMIC_RELAXED);
+        append(buf, size, used, "%s_bucket{le=\"%s\"} %lu\n", name, bounds[i], cumulative);
+    }
+    append(buf, size, used, "%s_sum %.9g\n", name, sum);
+    append(buf, size, used, "%s_count %lu\n", name, cumulative);
+}
+
+/* Render every metric in the Prometheus text format. Returns the length. */
+int metricsFormat(char *buf, size_t size) {
+    static const char *const opNames[METRICS_OP_TYPES] = 
+        { NULL, "deposit", "withdraw", NULL, "transaction", "balance" };
+    static const char *const errorNames[METRICS_ERROR_TYPES] = 
+        { NULL, "insufficient_funds", "invalid_operation", "invalid_account", "server_busy" };
+    static const char *const batchBounds[METRICS_BATCH_BUCKETS] = 
+        { "1", "2", "4", "8", "16", "32", "64", "128", "256", "+Inf" };
+    static const char *const commitBounds[METRICS_COMMIT_BUCKETS] = 
+        { "1e-05", "5e-05", "0.0001", "0.0005", "0.001", "0.005", "0.05", "+Inf" };
+    size_t used = 0;
+    
+    append(buf, size, &used, "# HELP bank_ops_total Operations answered, by type.\n");
+    append(buf, size, &used, "# TYPE bank_ops_total counter\n");
+    for (int i = 0; i < METRICS_OP_TYPES; i++) {
+        if (opNames[i] != NULL) {
+            append(buf, size, &used, "bank_ops_total{type=\"%s\"} %lu\n", opNames[i], METRIC_GET(opsByType[i]));
+        }
+    }
+    
+    append(buf, size, &used, "# HELP bank_op_errors_total Operations answered with an error, by error.\n");
+    append(buf, size, &used, "# TYPE bank_op_errors_total counter\n");
+    for (int i = 1; i < METRICS_ERROR_TYPES; i++) {
+        append(buf, size, &used, "bank_op_errors_total{error=\"%s\"} %lu\n", errorNames[i], METRIC_GET(errorsByType[i]));
+    }
+    
+    append(buf, size, &used, "# HELP bank_tellers_active Teller processes running.\n");
+    append(buf, size, &used, "# TYPE bank_tellers_active gauge\n");
+    append(buf, size, &used, "bank_tellers_active %ld\n", METRIC_GET(activeTellers));
+    append(buf, size, &used, "# HELP bank_queue_depth Operations queued for a teller.\n");
+    append(buf, size, &used, "# TYPE bank_queue_depth gauge\n");
+    append(buf, size, &used, "bank_queue_depth %ld\n", METRIC_GET(queuedOps));
+    append(buf, size, &used, "# HELP bank_sessions_active Client batches being served.\n");
+    append(buf, size, &used, "# TYPE bank_sessions_active gauge\n");
+    append(buf, size, &used, "bank_sessions_active %ld\n", METRIC_GET(activeSessions));
+    
+    append(buf, size, &used, "# HELP bank_batch_size Requests applied per database lock acquisition.\n");
+    appendHistogram(buf, size, &used, "bank_batch_size", batchBounds, 
+                    serverMetrics->batchSizeBuckets, METRICS_BATCH_BUCKETS, METRIC_GET(batchSizeSum));
+    append(buf, size, &used, "# HELP bank_lock_hold_seconds_total Time the database lock was held.\n");
+    append(buf, size, &used, "# TYPE bank_lock_hold_seconds_total counter\n");
+    append(buf, size, &used, "bank_lock_hold_seconds_total %.9f\n", METRIC_GET(lockHoldTotalNs) / 1e9);
+    
+    append(buf, size, &used, "# HELP bank_log_bytes_total Log record bytes written.\n");
+    append(buf, size, &used, "# TYPE bank_log_bytes_total counter\n");
+    append(buf, size, &used, "bank_log_bytes_total %lu\n", METRIC_GET(logBytes));
+    append(buf, size, &used, "# HELP bank_log_commit_seconds Time to flush the log at the end of an apply.\n");
+    appendHistogram(buf, size, &used, "bank_log_commit_seconds", commitBounds, 
+                    serverMetrics->logCommitBuckets, METRICS_COMMIT_BUCKETS, METRIC_GET(logCommitTotalNs) / 1e9);
+    
+    append(buf, size, &used, "# HELP bank_rounds_total Scheduling rounds that ran tellers.\n");
+    append(buf, size, &used, "# TYPE bank_rounds_total counter\n");
+    append(buf, size, &used, "bank_rounds_total %lu\n", METRIC_GET(rounds));
+    append(buf, size, &used, "# HELP bank_tellers_total Tellers reaped, by outcome.\n");
+    append(buf, size, &used, "# TYPE bank_tellers_total counter\n");
+    append(buf, size, &used, "bank_tellers_total{outcome=\"reaped\"} %lu\n", METRIC_GET(tellersReaped));
+    append(buf, size, &used, "bank_tellers_total{outcome=\"failed\"} %lu\n", METRIC_GET(tellersFailed));
+    append(buf, size, &used, "bank_tellers_total{outcome=\"signaled\"} %lu\n", METRIC_GET(tellersSignaled));
+    append(buf, size, &used, "bank_tellers_total{outcome=\"timed_out\"} %lu\n", METRIC_GET(tellersTimedOut));
+    append(buf, size, &used, "# HELP bank_scrapes_total Metrics requests served.\n");
+    append(buf, size, &used, "# TYPE bank_scrapes_total counter\n");
+    append(buf, size, &used, "bank_scrapes_total %lu\n", METRIC_GET(scrapes));
+    
+    return (int)used;
+}
+
+/* Answer one scraper: HTTP if it sent a GET, plain text otherwise */
+static void serveScrape(int fd) {
+    static char body[EXPORTER_BUF_SIZE];
+    char request[512];
+    ssize_t requestLen = 0;
+    
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, EXPORTER_REQUEST_WAIT_MS) == 1) {
+        requestLen = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT);
+    }
+    
+    METRIC_ADD(scrapes, 1);
+    int bodyLen = metricsFormat(body, sizeof(body));
+    
+    if (requestLen >= 4 && strncmp(request, "GET ", 4) == 0) {
+        char header[160];
+        int headerLen = snprintf(header, sizeof(header), 
+                                 "HTTP/1.0 200 OK\r\n"
+                                 "Content-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %d\r\n\r\n", bodyLen);
+        send(fd, header, headerLen, MSG_NOSIGNAL);
+    }
+    send(fd, body, bodyLen, MSG_NOSIGNAL);
+}
+
+static void *exporterThread(void *arg) {
+    (void)arg;
+    
+    while (1) {
+        int fd = accept4(exporterFd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return NULL;
+        }
+        serveScrape(fd);
+        close(fd);
+    }
+}
+
+/* Serve the metrics on a Unix socket at path from a thread of their own,
+ * so a scrape never runs on the main loop. Returns 0 or -1. */
+int metricsStartExporter(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    /* A socket left by a crashed or upgraded server is replaced */
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1) {
+        close(fd);
+        return -1;
+    }
+    
+    exporterFd = fd;
+    strcpy(exporterPath, path);
+    
+    /* Keep the main thread's signal handling to itself */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, exporterThread, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    
+    if (ret != 0) {
+        close(fd);
+        unlink(path);
+        exporterFd = -1;
+        errno = ret;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/* Remove the socket; the thread goes away with the process */
+void metricsStopExporter(void) {
+    if (exporterFd != -1) {
+        unlink(exporterPath);
+    }
+}
+
+void printMetrics(FILE *out) {
+    ServerMetrics *m = serverMetrics;
+    double avgHold = m->lockAcquisitions > 0 ? 
+                     m->lockHoldTotalNs / 1e6 / m->lockAcquisitions : 0.0;
+    
+    fprintf(out, "Metrics: batches=%lu ops=%lu lock_acquisitions=%lu "
+                 "lock_hold_avg=%.3fms lock_hold_max=%.3fms lock_hold_total=%.3fms\n", 
+            m->batchesApplied, m->opsApplied, 
+            m->lockAcquisitions, avgHold, 
+            m->lockHoldMaxNs / 1e6, m->lockHoldTotalNs / 1e6);
+    
+    /* Round state comes from the arena only; an overflow means a request was rejected busy */
+    fprintf(out, "Round memory: rounds=%lu arena_allocs=%lu allocs_per_round_avg=%.1f "
+                 "allocs_per_round_max=%lu arena_bytes_max=%lu arena_overflows=%lu\n",
+            m->rounds, m->roundAllocs,
+            m->rounds > 0 ? (double)m->roundAllocs / m->rounds : 0.0,
+            m->roundAllocsMax, m->roundBytesMax, m->roundOverflows);
+    
+    fprintf(out, "Tellers: reaped=%lu failed=%lu signaled=%lu timed_out=%lu "
+                 "lifetime_avg=%.3fms lifetime_max=%.3fms\n",
+            m->tellersReaped, m->tellersFailed, 
+            m->tellersSignaled, m->tellersTimedOut,
+            m->tellersReaped > 0 ? m->tellerLifetimeTotalNs / 1e6 / m->tellersReaped : 0.0,
+            m->tellerLifetimeMaxNs / 1e6);
+}
@@ -0,0 +1,64 @@
+/* bank_metrics.h
+ * Runtime counters kept by the server
+ */
+#ifndef BANK_METRICS_H
+#define BANK_METRICS_H
+
+#include <stdio.h>
+
+#define METRICS_OP_TYPES 6          /* Indexed by OP_* */
+#define METRICS_ERROR_TYPES 5       /* Indexed by -ERR_* */
+#define METRICS_BATCH_BUCKETS 10    /* Batch sizes up to 1, 2, 4, ... 256, and above */
+#define METRICS_COMMIT_BUCKETS 8    /* Log commits up to 10us, 50us, ... 50ms, and above */
+
+/* Counters live in a shared mapping, so forked tellers can count too, and
+ * are only touched with relaxed atomics: updates never take a lock and the
+ * exporter thread reads them without stopping anyone */
+typedef struct {
+    unsigned long batchesApplied;   /* Apply stages run */
+    unsigned long opsApplied;       /* Teller requests applied */
+    unsigned long lockAcquisitions; /* Database lock acquisitions */
+    unsigned long lockHoldTotalNs;  /* Total time the database lock was held */
+    unsigned long lockHoldMaxNs;    /* Longest single lock hold */
+    unsigned long rounds;           /* Scheduling rounds that ran tellers */
+    unsigned long roundAllocs;      /* Arena allocations made by those rounds */
+    unsigned long roundAllocsMax;   /* Most arena allocations in one round */
+    unsigned long roundBytesMax;    /* Most arena bytes used by one round */
+    unsigned long roundOverflows;   /* Round allocations the arena could not satisfy */
+    unsigned long tellersReaped;    /* Tellers whose exit was collected */
+    unsigned long tellersFailed;    /* Tellers that exited with a non-zero status */
+    unsigned long tellersSignaled;  /* Tellers killed by a signal */
+    unsigned long tellersTimedOut;  /* Tellers the server killed at their deadline */
+    unsigned long tellerLifetimeTotalNs; /* Fork to exit, summed over reaped tellers */
+    unsigned long tellerLifetimeMaxNs;
+    unsigned long opsByType[METRICS_OP_TYPES];      /* Operations answered */
+    unsigned long errorsByType[METRICS_ERROR_TYPES]; /* Operations answered with an error */
+    unsigned long batchSizeBuckets[METRICS_BATCH_BUCKETS];
+    unsigned long batchSizeSum;
+    unsigned long logBytes;         /* Log record bytes written */
+    unsigned long logCommits;       /* Log commits (flushes) */
+    unsigned long logCommitTotalNs;
+    unsigned long logCommitBuckets[METRICS_COMMIT_BUCKETS];
+    unsigned long scrapes;          /* Exporter requests served */
+    long activeTellers;             /* Gauges */
+    long queuedOps;
+    long activeSessions;
+} ServerMetrics;
+
+extern ServerMetrics *serverMetrics;
+
+int metricsInit(void);
+void metricsRecordApply(int numOps, double lockHoldMs);
+void metricsRecordRound(unsigned long allocs, unsigned long bytes, unsigned long overflows);
+void metricsRecordTeller(double lifetimeMs, int failed, int signaled, int timedOut);
+void metricsRecordResult(int op, int status);
+void metricsRecordLogBytes(int bytes);
+void metricsRecordCommit(double commitMs);
+void metricsSetGauges(long activeTellers, long queuedOps, long activeSessions);
+void metricsSetActiveTellers(long activeTellers);
+int metricsStartExporter(const char *path);
+void metricsStopExporter(void);
+int metricsFormat(char *buf, size_t size);
+void printMetrics(FILE *out);
+
+#endif /* BANK_METRICS_H */
@@ -0,0 +1,95 @@
+/* bank_probes.h
+ * Static tracepoints (USDT) on the server's request path, for perf and bpftrace
+ *
+ * A probe is a nop in the code plus an ELF note (.note.stapsdt) giving its
+ * name, its address and where its arguments are; a tracer that attaches
+ * patches a breakpoint over the nop. <sys/sdt.h> is used when it is
+ * installed. Without it the same notes are emitted here on x86-64, and on
+ * other targets the probes compile to nothing. Building with USDT=0
+ * removes them everywhere.
+ *
+ * Every argument is passed as a signed 64-bit value.
+ */
+#ifndef BANK_PROBES_H
+#define BANK_PROBES_H
+
+#if !defined(BANK_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BANK_USDT_SDT 1
+#endif
+#endif
+
+#if !defined(BANK_NO_USDT) && !defined(BANK_USDT_SDT) && defined(__x86_64__) && defined(__GNUC__)
+#define BANK_USDT_INLINE 1
+#endif
+
+#if defined(BANK_USDT_SDT)
+
+#define BANK_PROBE1(name, a) DTRACE_PROBE1(bank, name, (long)(a))
+#define BANK_PROBE2(name, a, b) DTRACE_PROBE2(bank, name, (long)(a), (long)(b))
+#define BANK_PROBE3(name, a, b, c) DTRACE_PROBE3(bank, name, (long)(a), (long)(b), (long)(c))
+#define BANK_PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4(bank, name, (long)(a), (long)(b), (long)(c), (long)(d))
+#define BANK_PROBE5(name, a, b, c, d, e) \
+    DTRACE_PROBE5(bank, name, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e))
+
+#elif defined(BANK_USDT_INLINE)
+
+/* The note layout of <sys/sdt.h>: probe address, the base used to detect
+ * prelinking, no semaphore, then provider, name and argument strings */
+#define BANK_SDT_NOTE(name, args) \
+    "990: nop\n" \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+    ".balign 4\n" \
+    ".4byte 992f-991f, 994f-993f, 3\n" \
+    "991: .asciz \"stapsdt\"\n" \
+    "992: .balign 4\n" \
+    "993: .8byte 990b\n" \
+    ".8byte _.stapsdt.base\n" \
+    ".8byte 0\n" \
+    ".asciz \"bank\"\n" \
+    ".asciz \"" #name "\"\n" \
+    ".asciz \"" args "\"\n" \
+    "994: .balign 4\n" \
+    ".popsection\n" \
+    ".ifndef _.stapsdt.base\n" \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n" \
+    ".hidden _.stapsdt.base\n" \
+    "_.stapsdt.base: .space 1\n" \
+    ".size _.stapsdt.base, 1\n" \
+    ".popsection\n" \
+    ".endif\n"
+
+#define BANK_PROBE1(name, a) \
+    __asm__ __volatile__ (BANK_SDT_NOTE(name, "-8@%0") :: "nor" ((long)(a)))
+#define BANK_PROBE2(name, a, b) \
+    __asm__ __volatile__ (BANK_SDT_NOTE(name, "-8@%0 -8@%1") \
+                          :: "nor" ((long)(a)), "nor" ((long)(b)))
+#define BANK_PROBE3(name, a, b, c) \
+    __asm__ __volatile__ (BANK_SDT_NOTE(name, "-8@%0 -8@%1 -8@%2") \
+                          :: "nor" ((long)(a)), "nor" ((long)(b)), "nor" ((long)(c)))
+#define BANK_PROBE4(name, a, b, c, d) \
+    __asm__ __volatile__ (BANK_SDT_NOTE(name, "-8@%0 -8@%1 -8@%2 -8@%3") \
+                          :: "nor" ((long)(a)), "nor" ((long)(b)), "nor" ((long)(c)), \
+                             "nor" ((long)(d)))
+#define BANK_PROBE5(name, a, b, c, d, e) \
+    __asm__ __volatile__ (BANK_SDT_NOTE(name, "-8@%0 -8@%1 -8@%2 -8@%3 -8@%4") \
+                          :: "nor" ((long)(a)), "nor" ((long)(b)), "nor" ((long)(c)), \
+                             "nor" ((long)(d)), "nor" ((long)(e)))
+
+#else
+
+/* Arguments are type-checked but never evaluated */
+#define BANK_PROBE1(name, a) do { if (0) { (void)(a); } } while (0)
+#define BANK_PROBE2(name, a, b) do { if (0) { (void)(a); (void)(b); } } while (0)
+#define BANK_PROBE3(name, a, b, c) do { if (0) { (void)(a); (void)(b); (void)(c); } } while (0)
+#define BANK_PROBE4(name, a, b, c, d) \
+    do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); } } while (0)
+#define BANK_PROBE5(name, a, b, c, d, e) \
+    do { if (0) { (void)(a); (void)(b); (void)(c); (void)(d); (void)(e); } } while (0)
+
+#endif
+
+#endif /* BANK_PROBES_H */
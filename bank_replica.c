@@ -0,0 +1,149 @@
+/* bank_replica.c
+ * Follower side of log shipping: tails a primary's log into an account store
+ */
+#define _GNU_SOURCE /* memrchr */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "bank_utils.h"
+#include "bank_replica.h"
+
+/* Start following a log. It does not have to exist yet. Returns 0 or -1. */
+int replicaOpen(Replica *replica, const char *logName) {
+    memset(replica, 0, sizeof(Replica));
+    snprintf(replica->logName, sizeof(replica->logName), "%s", logName);
+    replica->fd = -1;
+    replica->watchWd = -1;
+    
+    /* Without inotify the caller falls back to polling */
+    replica->watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return 0;
+}
+
+/* (Re)open the log from the start and watch it */
+static int openLog(Replica *replica, const struct stat *st) {
+    if (replica->fd != -1) {
+        close(replica->fd);
+    }
+    replica->fd = open(replica->logName, O_RDONLY | O_CLOEXEC);
+    if (replica->fd == -1) {
+        return -1;
+    }
+    replica->inode = st->st_ino;
+    replica->offset = 0;
+    
+    if (replica->watchFd != -1) {
+        if (replica->watchWd != -1) {
+            inotify_rm_watch(replica->watchFd, replica->watchWd);
+        }
+        replica->watchWd = inotify_add_watch(replica->watchFd, replica->logName,
+                                             IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+    }
+    return 0;
+}
+
+/* Apply one record the way restoreDatabaseFromLog does */
+static void applyRecord(AccountStore *store, const LogRecord *rec) {
+    int index = storeLookup(store, rec->accountId);
+    if (index == -1) {
+        index = storeAdd(store, rec->accountId, 0);
+        if (index == -1) {
+            return;
+        }
+    }
+    
+    store->balances[index] = rec->balance;
+    storeSetActive(store, index, rec->balance != 0);
+}
+
+/* Apply every complete line written since the last poll. A line still
+ * being written is left for the next poll. If the log was recreated, the
+ * store is cleared and the new log applied from the start. Returns the
+ * number of records applied. */
+int replicaPoll(Replica *replica, AccountStore *store) {
+    struct stat st;
+    if (stat(replica->logName, &st) == -1) {
+        return 0; /* The primary has not created it yet */
+    }
+    
+    if (replica->fd == -1 || st.st_ino != replica->inode || st.st_size < replica->offset) {
+        if (replica->fd != -1) {
+            storeClear(store);
+            replica->resets++;
+        }
+        if (openLog(replica, &st) == -1) {
+            return 0;
+        }
+    }
+    replica->logSize = st.st_size;
+    
+    int applied = 0;
+    static char buf[REPLICA_READ_CHUNK];
+    
+    while (replica->offset < replica->logSize) {
+        ssize_t numRead = pread(replica->fd, buf, sizeof(buf), replica->offset);
+        if (numRead <= 0) {
+            break;
+        }
+        
+        const char *last = memrchr(buf, '\n', numRead);
+        if (last == NULL) {
+            if (numRead < (ssize_t)sizeof(buf)) {
+                break; /* Torn last line */
+            }
+            replica->offset += numRead; /* Not a log line, skip it */
+            continue;
+        }
+        
+        const char *line = buf;
+        while (line <= last) {
+            const char *eol = memchr(line, '\n', last - line + 1);
+            LogRecord rec;
+            if (parseLogRecord(line, eol - line, &rec)) {
+                applyRecord(store, &rec);
+                applied++;
+            }
+            line = eol + 1;
+        }
+        replica->offset += line - buf;
+    }
+    
+    /* The log's modification time is when the primary last wrote it */
+    if (applied > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        replica->lastLagMs = timespecDiffMs(&st.st_mtim, &now);
+        if (replica->lastLagMs < 0) {
+            replica->lastLagMs = 0;
+        }
+        if (replica->lastLagMs > replica->maxLagMs) {
+            replica->maxLagMs = replica->lastLagMs;
+        }
+        replica->records += applied;
+    }
+    
+    return applied;
+}
+
+/* Discard pending inotify events; the next poll looks at the log itself */
+void replicaDrainEvents(Replica *replica) {
+    char events[4096];
+    
+    while (replica->watchFd != -1 && read(replica->watchFd, events, sizeof(events)) > 0) {
+        continue;
+    }
+}
+
+void replicaClose(Replica *replica) {
+    if (replica->fd != -1) {
+        close(replica->fd);
+        replica->fd = -1;
+    }
+    if (replica->watchFd != -1) {
+        close(replica->watchFd);
+        replica->watchFd = -1;
+    }
+}
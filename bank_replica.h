@@ -0,0 +1,34 @@
+/* bank_replica.h
+ * Follower side of log shipping: tails a primary's log into an account store
+ */
+#ifndef BANK_REPLICA_H
+#define BANK_REPLICA_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "bank_store.h"
+
+#define REPLICA_READ_CHUNK 65536    /* Bytes of log read per pread */
+#define REPLICA_POLL_MS 100         /* Log poll interval when inotify is unavailable */
+#define REPLICA_REPORT_SEC 5        /* Seconds between replication status lines */
+
+typedef struct {
+    char logName[80];
+    int fd;                     /* Primary log, -1 until it exists */
+    ino_t inode;                /* Inode of the open log, to notice a recreated log */
+    int watchFd;                /* inotify descriptor, -1 if unavailable */
+    int watchWd;                /* Watch on the log, -1 if none */
+    off_t offset;               /* Bytes applied, always at a line start */
+    off_t logSize;              /* Log size seen at the last poll */
+    long records;               /* Records applied */
+    long resets;                /* Times the log was recreated under us */
+    double lastLagMs;           /* Primary write to replica apply, for the last applied chunk */
+    double maxLagMs;
+} Replica;
+
+int replicaOpen(Replica *replica, const char *logName);
+int replicaPoll(Replica *replica, AccountStore *store);
+void replicaDrainEvents(Replica *replica);
+void replicaClose(Replica *replica);
+
+#endif /* BANK_REPLICA_H */
@@ -0,0 +1,212 @@
+/* bank_scheduler.c
+ * Deficit round robin across client sessions.
+ *
+ * Every client batch gets its own session queue. Each scheduling round
+ * visits the sessions in turn, tops up their deficit by SCHED_QUANTUM times
+ * their weight and takes that many operations from them. A small client
+ * arriving behind a bulk client is therefore served in the next round
+ * instead of after the whole bulk batch.
+ */
+#include <string.h>
+#include "bank_scheduler.h"
+#include "bank_utils.h"
+
+/* Pending operations of all sessions share one pool, linked per session */
+typedef struct {
+    ClientRequest req;
+    int next;                   /* Next pending operation of the same session, -1 at the end */
+} QueuedOp;
+
+static ClientSession sessions[MAX_SESSIONS];
+static QueuedOp queuePool[MAX_QUEUED_OPS];
+static int freeList = -1;       /* Head of the unused pool entries */
+static int poolInitialized = 0;
+static int numQueued = 0;       /* Operations waiting in any session */
+static int nextSession = 0;     /* Round robin starting point */
+
+static void initializePool(void) {
+    for (int i = 0; i < MAX_QUEUED_OPS; i++) {
+        queuePool[i].next = i + 1 < MAX_QUEUED_OPS ? i + 1 : -1;
+    }
+    freeList = 0;
+    poolInitialized = 1;
+}
+
+/* Find the session still receiving operations from this PID, or start a new one.
+ * Returns NULL when the session table is full. */
+ClientSession *getSession(pid_t pid, int batchSize, int weight) {
+    ClientSession *freeSlot = NULL;
+    
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        ClientSession *session = &sessions[i];
+        
+        if (!session->inUse) {
+            if (freeSlot == NULL) {
+                freeSlot = session;
+            }
+        } else if (session->pid == pid && !sessionReceivedAll(session)) {
+            session->lastActivity = time(NULL);
+            return session;
+        }
+    }
+    
+    if (freeSlot == NULL) {
+        return NULL;
+    }
+    
+    if (weight < 1) {
+        weight = 1;
+    } else if (weight > MAX_CLIENT_WEIGHT) {
+        weight = MAX_CLIENT_WEIGHT;
+    }
+    
+    memset(freeSlot, 0, sizeof(ClientSession));
+    freeSlot->inUse = 1;
+    freeSlot->pid = pid;
+    freeSlot->total = batchSize;
+    freeSlot->weight = weight;
+    freeSlot->head = freeSlot->tail = -1;
+    freeSlot->lastActivity = time(NULL);
+    return freeSlot;
+}
+
+int sessionReceivedAll(const ClientSession *session) {
+    return session->received + session->answered >= session->total;
+}
+
+/* Whether an operation the session has queued changes the account. A
+ * balance query behind one must wait its turn to see its effect. */
+int sessionUpdatesAccount(const ClientSession *session, int accountId) {
+    for (int slot = session->head; slot != -1; slot = queuePool[slot].next) {
+        const ClientRequest *req = &queuePool[slot].req;
+        
+        if (req->msgType == MSG_TRANSACTION) {
+            for (int i = 0; i < req->numTxnOps; i++) {
+                if (parseBankId(req->txnOps[i].bankId) == accountId ||
+                    (req->txnOps[i].op == OP_TRANSFER && parseBankId(req->txnOps[i].toBankId) == accountId)) {
+                    return 1;
+                }
+            }
+        } else if (req->op != OP_BALANCE && !req->isNewClient && parseBankId(req->bankId) == accountId) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Free sessions that have nothing left to receive or run.
+ * Sessions whose client stopped sending half way are dropped after
+ * SESSION_IDLE_TIMEOUT seconds so they cannot pin a slot forever. */
+void retireSessions(void) {
+    time_t now = time(NULL);
+    
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        ClientSession *session = &sessions[i];
+        
+        if (!session->inUse || session->pending > 0) {
+            continue;
+        }
+        
+        if (sessionReceivedAll(session) || now - session->lastActivity > SESSION_IDLE_TIMEOUT) {
+            session->inUse = 0;
+        }
+    }
+}
+
+/* Append an operation to its session queue. Returns -1 when the pool is full. */
+int enqueueRequest(ClientSession *session, const ClientRequest *req) {
+    if (!poolInitialized) {
+        initializePool();
+    }
+    
+    if (freeList == -1) {
+        return -1;
+    }
+    
+    int slot = freeList;
+    freeList = queuePool[slot].next;
+    
+    queuePool[slot].req = *req;
+    queuePool[slot].next = -1;
+    
+    if (session->tail == -1) {
+        session->head = slot;
+    } else {
+        queuePool[session->tail].next = slot;
+    }
+    session->tail = slot;
+    
+    session->pending++;
+    session->received++;
+    numQueued++;
+    return 0;
+}
+
+static void dequeueRequest(ClientSession *session, ClientRequest *out) {
+    int slot = session->head;
+    
+    *out = queuePool[slot].req;
+    session->head = queuePool[slot].next;
+    if (session->head == -1) {
+        session->tail = -1;
+    }
+    
+    queuePool[slot].next = freeList;
+    freeList = slot;
+    
+    session->pending--;
+    numQueued--;
+}
+
+/* Pick up to maxOps operations for the next round using deficit round robin.
+ * Returns the number of operations copied into round. */
+int scheduleRound(ClientRequest *round, int maxOps) {
+    int count = 0;
+    int start = nextSession;
+    
+    /* Keep making passes over the sessions until the round is full */
+    while (count < maxOps && numQueued > 0) {
+        for (int visited = 0; visited < MAX_SESSIONS && count < maxOps; visited++) {
+            ClientSession *session = &sessions[(start + visited) % MAX_SESSIONS];
+            
+            if (!session->inUse || session->pending == 0) {
+                continue;
+            }
+            
+            session->deficit += SCHED_QUANTUM * session->weight;
+            
+            while (session->deficit > 0 && session->pending > 0 && count < maxOps) {
+                dequeueRequest(session, &round[count++]);
+                session->deficit--;
+            }
+            
+            /* An emptied queue does not bank credit for later */
+            if (session->pending == 0) {
+                session->deficit = 0;
+            }
+        }
+    }
+    
+    /* Start the next round with the following session */
+    nextSession = (start + 1) % MAX_SESSIONS;
+    return count;
+}
+
+int schedulerHasWork(void) {
+    return numQueued > 0;
+}
+
+int queuedOps(void) {
+    return numQueued;
+}
+
+int activeSessions(void) {
+    int count = 0;
+    
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].inUse) {
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,44 @@
+/* bank_scheduler.h
+ * Fair scheduling of queued operations across concurrent client sessions
+ */
+#ifndef BANK_SCHEDULER_H
+#define BANK_SCHEDULER_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "bank_shared.h"
+
+#define MAX_SESSIONS 64         /* Client batches tracked at the same time */
+#define MAX_QUEUED_OPS 2048     /* Capacity of the shared operation queue */
+#define SCHED_QUANTUM 4         /* Operations a weight-1 session may run per round */
+#define MAX_CLIENT_WEIGHT 8     /* Upper bound on a client's requested weight */
+#define SESSION_IDLE_TIMEOUT 30 /* Seconds before an incomplete, idle session is dropped */
+
+/* One client batch, keyed by the client's PID */
+typedef struct {
+    int inUse;                  /* Slot is allocated */
+    pid_t pid;                  /* Client process PID */
+    int total;                  /* Total operations announced by the client */
+    int received;               /* Operations queued for tellers so far */
+    int answered;               /* Operations answered inline (balance queries, busy rejections) */
+    int weight;                 /* Share of each round relative to other sessions */
+    int deficit;                /* Deficit round robin credit, in operations */
+    int head, tail;             /* Pending operations, linked through the queue pool */
+    int pending;                /* Number of pending operations */
+    time_t lastActivity;        /* Last time a request arrived for this session */
+} ClientSession;
+
+/* Session management */
+ClientSession *getSession(pid_t pid, int batchSize, int weight);
+int sessionReceivedAll(const ClientSession *session);
+int sessionUpdatesAccount(const ClientSession *session, int accountId);
+void retireSessions(void);
+
+/* Queueing and scheduling */
+int enqueueRequest(ClientSession *session, const ClientRequest *req);
+int scheduleRound(ClientRequest *round, int maxOps);
+int schedulerHasWork(void);
+int queuedOps(void);
+int activeSessions(void);
+
+#endif /* BANK_SCHEDULER_H */
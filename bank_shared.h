@@ -5,7 +5,6 @@
 #define BANK_SHARED_H
 
 #include <sys/types.h>
-#include <semaphore.h>
 
 /* FIFO paths - using /tmp directory for WSL compatibility */
 #define SERVER_FIFO_TEMPLATE "/tmp/%s"
@@ -19,12 +18,36 @@
 /* Operation codes */
 #define OP_DEPOSIT  1
 #define OP_WITHDRAW 2
+#define OP_TRANSFER 3   /* Only valid inside a transaction */
+#define OP_BALANCE  5   /* Read-only balance query, answered without a teller */
 
 /* Special message types */
 #define MSG_OPERATION 0
 #define MSG_BATCH_INFO 1
+#define MSG_TRANSACTION 2
+
+/* Trace IDs are made by the client from its PID, a per-process batch
+ * counter and the operation's index, so every operation of a batch shares
+ * TRACE_BATCH and one sampling decision covers the whole batch */
+#define TRACE_ID(pid, batch, index) \
+    (((unsigned long)(pid) << 32) | (((unsigned long)(batch) & 0xffff) << 16) | ((unsigned long)(index) & 0xffff))
+#define TRACE_PID(id) ((pid_t)((id) >> 32))
+#define TRACE_BATCH(id) ((id) >> 16)
+
+/* Maximum number of operations in one transaction message.
+ * Kept small so a ClientRequest stays below PIPE_BUF and FIFO writes remain atomic. */
+#define MAX_TXN_OPS 8
 
 /* Message structures */
+
+/* One step of a multi-operation transaction */
+typedef struct {
+    int op;                     /* OP_DEPOSIT, OP_WITHDRAW or OP_TRANSFER */
+    int amount;                 /* Amount to deposit/withdraw/transfer */
+    char bankId[20];            /* Account the operation applies to (transfer source) */
+    char toBankId[20];          /* Transfer destination account */
+} TransactionOp;
+
 typedef struct {
     pid_t pid;                  /* Client's PID */
     int msgType;                /* Message type (operation or batch info) */
@@ -34,6 +57,12 @@ typedef struct {
     int isNewClient;            /* Flag indicating if this is a new client */
     int batchSize;              /* Number of operations in this batch */
     int operationIndex;         /* Index of this operation in the batch (1-based) */
+    int weight;                 /* Requested scheduling weight (0 = default) */
+    int numTxnOps;              /* Number of ops in txnOps (MSG_TRANSACTION only) */
+    TransactionOp txnOps[MAX_TXN_OPS]; /* Ops applied atomically as one transaction */
+    unsigned long traceId;      /* Unique per operation, 0 if the client sets none */
+    long sentNs;                /* Client's CLOCK_MONOTONIC when it wrote the request */
+    long receivedNs;            /* Server's when it read it (set by the server) */
 } ClientRequest;
 
 typedef struct {
@@ -42,11 +71,16 @@ typedef struct {
     char bankId[20];            /* Bank ID assigned to the client */
     char message[100];          /* Status or error message */
     int clientIndex;            /* Client index number for display */
+    int numTxnOps;              /* Number of ops in the transaction (0 for single ops) */
+    int failedOp;               /* 1-based index of the op that aborted the transaction */
+    int txnBalances[MAX_TXN_OPS]; /* Balance of each op's account after the op */
+    unsigned long traceId;      /* Echoed from the request */
 } ServerResponse;
 
 /* Error codes */
 #define ERR_INSUFFICIENT_FUNDS -1
 #define ERR_INVALID_OPERATION -2
 #define ERR_INVALID_ACCOUNT -3
+#define ERR_SERVER_BUSY -4      /* Admission limits reached, retry later */
 
 #endif /* BANK_SHARED_H */
\ No newline at end of file
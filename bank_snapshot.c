@@ -0,0 +1,171 @@
+/* bank_snapshot.c
+ * Seqlock-protected balance snapshot shared between the server and readers
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bank_shared.h"
+#include "bank_snapshot.h"
+
+static void snapshotName(char *name, size_t size, const char *fifoName) {
+    /* Use only the last path component so "/tmp/X" and "X" map to the same object */
+    const char *base = strrchr(fifoName, '/');
+    snprintf(name, size, SNAPSHOT_NAME_TEMPLATE, base ? base + 1 : fifoName);
+}
+
+/* Create (or reuse after a crash) the shared snapshot - server side */
+BalanceSnapshot *createSnapshot(const char *fifoName) {
+    char name[SNAPSHOT_NAME_LEN];
+    snapshotName(name, sizeof(name), fifoName);
+    
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+    
+    if (ftruncate(fd, sizeof(BalanceSnapshot)) == -1) {
+        close(fd);
+        return NULL;
+    }
+    
+    BalanceSnapshot *snap = mmap(NULL, sizeof(BalanceSnapshot), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+    close(fd);
+    if (snap == MAP_FAILED) {
+        return NULL;
+    }
+    
+    memset(snap, 0, sizeof(BalanceSnapshot));
+    return snap;
+}
+
+/* Map an existing snapshot read-only - reader side */
+BalanceSnapshot *openSnapshot(const char *fifoName) {
+    char name[SNAPSHOT_NAME_LEN];
+    snapshotName(name, sizeof(name), fifoName);
+    
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    
+    BalanceSnapshot *snap = mmap(NULL, sizeof(BalanceSnapshot), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return snap == MAP_FAILED ? NULL : snap;
+}
+
+void closeSnapshot(BalanceSnapshot *snap) {
+    if (snap != NULL) {
+        munmap(snap, sizeof(BalanceSnapshot));
+    }
+}
+
+void destroySnapshot(BalanceSnapshot *snap, const char *fifoName) {
+    char name[SNAPSHOT_NAME_LEN];
+    snapshotName(name, sizeof(name), fifoName);
+    
+    closeSnapshot(snap);
+    shm_unlink(name);
+}
+
+/* Writer side - the server is the only writer, so no lock is needed */
+void snapshotBeginWrite(BalanceSnapshot *snap) {
+    __atomic_store_n(&snap->seq, snap->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void snapshotEndWrite(BalanceSnapshot *snap) {
+    __atomic_store_n(&snap->seq, snap->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Must be called between snapshotBeginWrite() and snapshotEndWrite() */
+void snapshotStoreAccount(BalanceSnapshot *snap, int index, int accountId, int balance, int active) {
+    if (index < 0 || index >= MAX_BATCH_SIZE) {
+        return;
+    }
+    
+    SnapshotEntry *entry = &snap->accounts[index];
+    entry->accountId = accountId;
+    entry->balance = balance;
+    entry->active = active;
+    
+    if (index >= snap->numAccounts) {
+        snap->numAccounts = index + 1;
+    }
+}
+
+/* Must be called between snapshotBeginWrite() and snapshotEndWrite() */
+void snapshotStoreLogState(BalanceSnapshot *snap, uint64_t logSize, int unloaded) {
+    snap->logSize = logSize;
+    snap->unloaded = unloaded;
+}
+
+/* Look up an active account's balance without taking any lock.
+ * Returns 0 on success or ERR_INVALID_ACCOUNT. */
+int snapshotLookup(BalanceSnapshot *snap, int accountId, int *balance) {
+    unsigned int seq;
+    int found, value;
+    
+    do {
+        /* Wait out an in-progress write */
+        while ((seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE)) & 1) {
+            ;
+        }
+        
+        found = 0;
+        value = 0;
+        int numAccounts = snap->numAccounts;
+        if (numAccounts > MAX_BATCH_SIZE) {
+            numAccounts = MAX_BATCH_SIZE;
+        }
+        
+        for (int i = 0; i < numAccounts; i++) {
+            SnapshotEntry *entry = &snap->accounts[i];
+            if (entry->active && entry->accountId == accountId) {
+                found = 1;
+                value = entry->balance;
+                break;
+            }
+        }
+        
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&snap->seq, __ATOMIC_RELAXED) != seq);
+    
+    if (!found) {
+        return ERR_INVALID_ACCOUNT;
+    }
+    
+    *balance = value;
+    return 0;
+}
+
+/* Copy every entry, and the log state they belong to, in one consistent
+ * read without taking any lock. Returns the number of entries copied into out. */
+int snapshotReadAll(BalanceSnapshot *snap, SnapshotEntry *out, int maxEntries, SnapshotLogState *state) {
+    unsigned int seq;
+    int numAccounts;
+    
+    do {
+        while ((seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE)) & 1) {
+            ;
+        }
+        
+        numAccounts = snap->numAccounts;
+        if (numAccounts > MAX_BATCH_SIZE) {
+            numAccounts = MAX_BATCH_SIZE;
+        }
+        if (numAccounts > maxEntries) {
+            numAccounts = maxEntries;
+        }
+        memcpy(out, snap->accounts, numAccounts * sizeof(SnapshotEntry));
+        state->logSize = snap->logSize;
+        state->unloaded = snap->unloaded;
+        
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&snap->seq, __ATOMIC_RELAXED) != seq);
+    
+    return numAccounts;
+}
@@ -0,0 +1,55 @@
+/* bank_snapshot.h
+ * Seqlock-protected balance snapshot shared between the server and readers
+ */
+#ifndef BANK_SNAPSHOT_H
+#define BANK_SNAPSHOT_H
+
+#include <stdint.h>
+#include "bank_utils.h"
+
+/* Shared memory object name, derived from the server FIFO name */
+#define SNAPSHOT_NAME_TEMPLATE "/bank_snap_%s"
+#define SNAPSHOT_NAME_LEN 80
+
+/* One account as seen by readers */
+typedef struct {
+    int accountId;              /* Account number */
+    int balance;
+    int active;
+} SnapshotEntry;
+
+/* Snapshot of the account table.
+ * The server is the only writer; it makes seq odd while updating and even
+ * again when done. Readers retry until they see the same even seq before
+ * and after copying, so they never block the writer or take any lock. */
+typedef struct {
+    unsigned int seq;           /* Sequence counter, odd while a write is in progress */
+    int numAccounts;            /* Number of used entries */
+    uint64_t logSize;           /* Log bytes the balances account for */
+    int unloaded;               /* Accounts not loaded yet after a lazy start, so not here */
+    SnapshotEntry accounts[MAX_BATCH_SIZE];
+} BalanceSnapshot;
+
+/* Where the snapshot stands relative to the log, read with the entries */
+typedef struct {
+    uint64_t logSize;
+    int unloaded;
+} SnapshotLogState;
+
+/* Mapping management */
+BalanceSnapshot *createSnapshot(const char *fifoName);
+BalanceSnapshot *openSnapshot(const char *fifoName);
+void closeSnapshot(BalanceSnapshot *snap);
+void destroySnapshot(BalanceSnapshot *snap, const char *fifoName);
+
+/* Writer side - server only */
+void snapshotBeginWrite(BalanceSnapshot *snap);
+void snapshotEndWrite(BalanceSnapshot *snap);
+void snapshotStoreAccount(BalanceSnapshot *snap, int index, int accountId, int balance, int active);
+void snapshotStoreLogState(BalanceSnapshot *snap, uint64_t logSize, int unloaded);
+
+/* Reader side - lock free */
+int snapshotLookup(BalanceSnapshot *snap, int accountId, int *balance);
+int snapshotReadAll(BalanceSnapshot *snap, SnapshotEntry *out, int maxEntries, SnapshotLogState *state);
+
+#endif /* BANK_SNAPSHOT_H */
@@ -0,0 +1,341 @@
+/* bank_store.c
+ * Column-oriented account store
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bank_utils.h"
+#include "bank_store.h"
+
+#define ACTIVE_WORDS(n) (((n) + 63) / 64)
+
+/* Make the ID index cover account numbers up to id */
+static int indexGrow(AccountStore *store, int id) {
+    int newCapacity = store->idCapacity > 0 ? store->idCapacity : 64;
+    while (newCapacity <= id) {
+        newCapacity *= 2;
+    }
+    
+    int *indexById = realloc(store->indexById, newCapacity * sizeof(int));
+    if (indexById == NULL) {
+        return -1;
+    }
+    memset(indexById + store->idCapacity, 0xff, (newCapacity - store->idCapacity) * sizeof(int));
+    store->indexById = indexById;
+    store->idCapacity = newCapacity;
+    return 0;
+}
+
+/* Resize the columns to newCapacity accounts, rounded up to whole bitmap
+ * words. The padding is zeroed so the scans can read every lane of a word. */
+static int storeGrow(AccountStore *store, int newCapacity) {
+    newCapacity = ACTIVE_WORDS(newCapacity) * 64;
+    int oldWords = ACTIVE_WORDS(store->capacity);
+    int newWords = ACTIVE_WORDS(newCapacity);
+    
+    int *balances = realloc(store->balances, newCapacity * sizeof(int));
+    if (balances == NULL) {
+        return -1;
+    }
+    memset(balances + store->capacity, 0, (newCapacity - store->capacity) * sizeof(int));
+    store->balances = balances;
+    
+    int *ids = realloc(store->ids, newCapacity * sizeof(int));
+    if (ids == NULL) {
+        return -1;
+    }
+    memset(ids + store->capacity, 0, (newCapacity - store->capacity) * sizeof(int));
+    store->ids = ids;
+    
+    uint64_t *activeBits = realloc(store->activeBits, newWords * sizeof(uint64_t));
+    if (activeBits == NULL) {
+        return -1;
+    }
+    memset(activeBits + oldWords, 0, (newWords - oldWords) * sizeof(uint64_t));
+    store->activeBits = activeBits;
+    store->capacity = newCapacity;
+    return 0;
+}
+
+int storeInit(AccountStore *store, int capacity) {
+    memset(store, 0, sizeof(AccountStore));
+    if (storeGrow(store, capacity > 0 ? capacity : 64) == -1) {
+        return -1;
+    }
+    return indexGrow(store, capacity > 0 ? capacity : 64);
+}
+
+void storeFree(AccountStore *store) {
+    free(store->balances);
+    free(store->activeBits);
+    free(store->ids);
+    free(store->indexById);
+    memset(store, 0, sizeof(AccountStore));
+}
+
+/* Drop every account but keep the allocated columns */
+void storeClear(AccountStore *store) {
+    memset(store->activeBits, 0, ACTIVE_WORDS(store->capacity) * sizeof(uint64_t));
+    memset(store->indexById, 0xff, store->idCapacity * sizeof(int));
+    store->numAccounts = 0;
+}
+
+/* Append a new active account. Returns its index, or -1 if out of memory
+ * or the number is outside 0..STORE_MAX_ID. */
+int storeAdd(AccountStore *store, int id, int balance) {
+    if (id < 0 || id > STORE_MAX_ID) {
+        return -1;
+    }
+    if (store->numAccounts == store->capacity &&
+        storeGrow(store, 2 * store->capacity) == -1) {
+        return -1;
+    }
+    if (id >= store->idCapacity && indexGrow(store, id) == -1) {
+        return -1;
+    }
+    
+    int index = store->numAccounts++;
+    store->ids[index] = id;
+    store->balances[index] = balance;
+    storeSetActive(store, index, 1);
+    store->indexById[id] = index;
+    
+    return index;
+}
+
+/* Memory held by the store, split by column */
+void storeMemoryUsage(const AccountStore *store, StoreMemory *mem) {
+    mem->balances = (size_t)store->capacity * sizeof(int);
+    mem->ids = (size_t)store->capacity * sizeof(int);
+    mem->activeBits = (size_t)ACTIVE_WORDS(store->capacity) * sizeof(uint64_t);
+    mem->index = (size_t)store->idCapacity * sizeof(int);
+    mem->total = mem->balances + mem->ids + mem->activeBits + mem->index;
+}
+
+void storePrintMemory(const AccountStore *store, FILE *out) {
+    StoreMemory mem;
+    storeMemoryUsage(store, &mem);
+    
+    fprintf(out, "Memory: accounts=%d balances=%zuB ids=%zuB active=%zuB index=%zuB "
+                 "total=%zuB bytes_per_account=%.2f\n",
+            store->numAccounts, mem.balances, mem.ids, mem.activeBits, mem.index, mem.total,
+            store->numAccounts > 0 ? (double)mem.total / store->numAccounts : 0.0);
+}
+
+/* Find an account by number, active or closed. Returns its index or -1. */
+int storeLookup(const AccountStore *store, int id) {
+    if (id < 0 || id >= store->idCapacity) {
+        return -1;
+    }
+    return store->indexById[id];
+}
+
+/* The scans below walk the active bitmap one 64-bit word at a time and
+ * skip empty words. Within a word, each byte of the bitmap selects a row
+ * of eight all-ones/all-zeros lane masks, so the inner loop over eight
+ * balances has no branches and the compiler turns it into SIMD code.
+ * The columns are allocated in whole words (see storeGrow), so the last
+ * partial word reads zeroed padding, which its clear bits mask out. */
+static int32_t laneMasks[256][8];
+static int laneMasksReady = 0;
+
+static void initLaneMasks(void) {
+    for (int byte = 0; byte < 256; byte++) {
+        for (int lane = 0; lane < 8; lane++) {
+            laneMasks[byte][lane] = -((byte >> lane) & 1);
+        }
+    }
+    laneMasksReady = 1;
+}
+
+long long storeTotalBalance(const AccountStore *store) {
+    long long total = 0;
+    int numWords = ACTIVE_WORDS(store->numAccounts);
+    
+    if (!laneMasksReady) {
+        initLaneMasks();
+    }
+    
+    for (int w = 0; w < numWords; w++) {
+        uint64_t bits = store->activeBits[w];
+        if (bits == 0) {
+            continue;
+        }
+        
+        const int *block = store->balances + (w << 6);
+        long long sum = 0;
+        for (int g = 0; g < 8; g++) {
+            const int32_t *mask = laneMasks[(bits >> (g * 8)) & 0xff];
+            const int *lanes = block + g * 8;
+            for (int k = 0; k < 8; k++) {
+                sum += lanes[k] & mask[k];
+            }
+        }
+        total += sum;
+    }
+    return total;
+}
+
+int storeCountActive(const AccountStore *store) {
+    int count = 0;
+    int numWords = ACTIVE_WORDS(store->numAccounts);
+    
+    for (int w = 0; w < numWords; w++) {
+        count += __builtin_popcountll(store->activeBits[w]);
+    }
+    return count;
+}
+
+/* Histogram bucket of a balance, clamped to [0, numBuckets - 1] */
+static inline int balanceBucket(int balance, int bucketWidth, int numBuckets) {
+    int bucket = balance / bucketWidth;
+    if (bucket < 0) {
+        return 0;
+    }
+    return bucket < numBuckets ? bucket : numBuckets - 1;
+}
+
+/* Count active accounts per balance range of bucketWidth credits.
+ * Balances past the last bucket are counted in the last bucket, negative
+ * ones in the first. */
+void storeBalanceHistogram(const AccountStore *store, int bucketWidth, long long *buckets, int numBuckets) {
+    /* Four interleaved partial histograms so consecutive increments of the
+     * same bucket do not serialize on one counter */
+    long long *partial = calloc(4 * numBuckets, sizeof(long long));
+    int numWords = ACTIVE_WORDS(store->numAccounts);
+    
+    memset(buckets, 0, numBuckets * sizeof(long long));
+    if (partial == NULL || bucketWidth <= 0 || numBuckets <= 0) {
+        free(partial);
+        return;
+    }
+    
+    for (int w = 0; w < numWords; w++) {
+        uint64_t bits = store->activeBits[w];
+        const int *block = store->balances + (w << 6);
+        
+        if (bits == ~(uint64_t)0) {
+            for (int j = 0; j < 64; j++) {
+                partial[(j & 3) * numBuckets + balanceBucket(block[j], bucketWidth, numBuckets)]++;
+            }
+        } else {
+            while (bits) {
+                partial[balanceBucket(block[__builtin_ctzll(bits)], bucketWidth, numBuckets)]++;
+                bits &= bits - 1;
+            }
+        }
+    }
+    
+    for (int lane = 0; lane < 4; lane++) {
+        for (int b = 0; b < numBuckets; b++) {
+            buckets[b] += partial[lane * numBuckets + b];
+        }
+    }
+    free(partial);
+}
+
+/* Number of active accounts with a balance below threshold */
+int storeCountBelow(const AccountStore *store, int threshold) {
+    int count = 0;
+    int numWords = ACTIVE_WORDS(store->numAccounts);
+    
+    if (!laneMasksReady) {
+        initLaneMasks();
+    }
+    
+    for (int w = 0; w < numWords; w++) {
+        uint64_t bits = store->activeBits[w];
+        if (bits == 0) {
+            continue;
+        }
+        
+        const int *block = store->balances + (w << 6);
+        int sum = 0;
+        for (int g = 0; g < 8; g++) {
+            const int32_t *mask = laneMasks[(bits >> (g * 8)) & 0xff];
+            const int *lanes = block + g * 8;
+            for (int k = 0; k < 8; k++) {
+                sum += (lanes[k] < threshold) & mask[k];
+            }
+        }
+        count += sum;
+    }
+    return count;
+}
+
+/* Collect up to maxIndices active accounts below threshold.
+ * Returns the total number of matches, which may exceed maxIndices. */
+int storeListBelow(const AccountStore *store, int threshold, int *indices, int maxIndices) {
+    int count = 0;
+    int numWords = ACTIVE_WORDS(store->numAccounts);
+    
+    for (int w = 0; w < numWords; w++) {
+        uint64_t bits = store->activeBits[w];
+        const int *block = store->balances + (w << 6);
+        
+        while (bits) {
+            int j = __builtin_ctzll(bits);
+            if (block[j] < threshold) {
+                if (count < maxIndices) {
+                    indices[count] = (w << 6) + j;
+                }
+                count++;
+            }
+            bits &= bits - 1;
+        }
+    }
+    return count;
+}
+
+/* Function to restore database from log file.
+ * Every record carries the account's balance after the operation, so the
+ * last record of an account decides its state. Returns the number of
+ * active accounts. */
+int restoreDatabaseFromLog(const char *filename, AccountStore *store) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        return 0; /* File doesn't exist, nothing to restore */
+    }
+    
+    char line[256];
+    
+    /* Reset the database */
+    storeClear(store);
+    
+    /* Process each line */
+    while (fgets(line, sizeof(line), file)) {
+        /* Skip header lines and end marker */
+        size_t length = strlen(line);
+        if (line[0] == '#' || length <= 1) {
+            continue;
+        }
+        
+        /* A last line without its newline is a torn write and never applied */
+        if (line[length - 1] != '\n') {
+            continue;
+        }
+        
+        /* Parse BankID_XX D/W amount balance */
+        LogRecord rec;
+        
+        if (parseLogRecord(line, length, &rec)) {
+            int index = storeLookup(store, rec.accountId);
+            
+            /* Create new account if needed */
+            if (index == -1) {
+                index = storeAdd(store, rec.accountId, 0);
+                if (index == -1) {
+                    fprintf(stderr, "Out of memory restoring accounts\n");
+                    break;
+                }
+            }
+            
+            /* Update balance to the final value from log; a zero balance closes the account */
+            store->balances[index] = rec.balance;
+            storeSetActive(store, index, rec.balance != 0);
+        }
+    }
+    
+    fclose(file);
+    return storeCountActive(store);
+}
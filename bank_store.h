@@ -0,0 +1,75 @@
+/* bank_store.h
+ * Column-oriented account store
+ */
+#ifndef BANK_STORE_H
+#define BANK_STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define BANK_ID_LEN 20
+
+/* Largest account number the store takes. The ID index is a plain array
+ * indexed by account number, so this bounds its size (512MB). */
+#define STORE_MAX_ID ((1 << 27) - 1)
+
+/* Accounts are kept as parallel columns instead of an array of structs.
+ * Bulk scans only walk the balance column and the active bitmap, so they
+ * stream 4 bytes (plus one bit) per account instead of the whole record
+ * and the compiler can vectorize them. Accounts are identified by their
+ * number (the n of BankID_n); the ID string is only rendered for output.
+ * Account numbers are handed out densely, so the index from number to
+ * account is a plain array instead of a hash table. */
+typedef struct {
+    int numAccounts;            /* Accounts ever created (active or closed) */
+    int capacity;               /* Allocated length of the columns */
+    int *balances;              /* Balance column */
+    uint64_t *activeBits;       /* Active bitmap, one bit per account */
+    int *ids;                   /* Account number column */
+    int *indexById;             /* Account index by account number, -1 = none */
+    int idCapacity;             /* Length of indexById */
+} AccountStore;
+
+/* Bytes allocated by a store */
+typedef struct {
+    size_t balances;
+    size_t ids;
+    size_t activeBits;
+    size_t index;
+    size_t total;
+} StoreMemory;
+
+/* Store management */
+int storeInit(AccountStore *store, int capacity);
+void storeFree(AccountStore *store);
+void storeClear(AccountStore *store);
+int storeAdd(AccountStore *store, int id, int balance);
+int storeLookup(const AccountStore *store, int id);
+void storeMemoryUsage(const AccountStore *store, StoreMemory *mem);
+void storePrintMemory(const AccountStore *store, FILE *out);
+
+static inline int storeIsActive(const AccountStore *store, int index) {
+    return (store->activeBits[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void storeSetActive(AccountStore *store, int index, int active) {
+    uint64_t bit = (uint64_t)1 << (index & 63);
+    
+    if (active) {
+        store->activeBits[index >> 6] |= bit;
+    } else {
+        store->activeBits[index >> 6] &= ~bit;
+    }
+}
+
+/* Bulk scans over active accounts */
+long long storeTotalBalance(const AccountStore *store);
+int storeCountActive(const AccountStore *store);
+void storeBalanceHistogram(const AccountStore *store, int bucketWidth, long long *buckets, int numBuckets);
+int storeCountBelow(const AccountStore *store, int threshold);
+int storeListBelow(const AccountStore *store, int threshold, int *indices, int maxIndices);
+
+/* Rebuild the store from a bank log */
+int restoreDatabaseFromLog(const char *filename, AccountStore *store);
+
+#endif /* BANK_STORE_H */
@@ -0,0 +1,95 @@
+/* bank_sync.c
+ * Process-shared robust mutexes in one mapping created at startup
+ */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "bank_sync.h"
+
+static int initLock(pthread_mutex_t *lock) {
+    pthread_mutexattr_t attr;
+    
+    if (pthread_mutexattr_init(&attr) != 0) {
+        return -1;
+    }
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    
+    int ret = pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return ret == 0 ? 0 : -1;
+}
+
+/* Map the lock region and set up its mutexes. Returns NULL on failure. */
+SyncRegion *syncCreate(void) {
+    SyncRegion *sync = mmap(NULL, sizeof(SyncRegion), PROT_READ | PROT_WRITE, 
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sync == MAP_FAILED) {
+        return NULL;
+    }
+    memset(sync, 0, sizeof(SyncRegion));
+    
+    if (initLock(&sync->fifoLock) == -1 || initLock(&sync->dbLock) == -1) {
+        munmap(sync, sizeof(SyncRegion));
+        return NULL;
+    }
+    return sync;
+}
+
+void syncDestroy(SyncRegion *sync) {
+    if (sync == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&sync->fifoLock);
+    pthread_mutex_destroy(&sync->dbLock);
+    munmap(sync, sizeof(SyncRegion));
+}
+
+/* Take a lock of the region. Uncontended, this stays in user space. If the
+ * previous holder died with the lock held, the lock is marked consistent
+ * and taken over. Returns 0, 1 after such a recovery, or -1. */
+int syncLock(SyncRegion *sync, pthread_mutex_t *lock) {
+    int ret = pthread_mutex_trylock(lock);
+    if (ret == EBUSY) {
+        __atomic_add_fetch(&sync->contended, 1, __ATOMIC_RELAXED);
+        ret = pthread_mutex_lock(lock);
+    }
+    
+    if (ret == EOWNERDEAD) {
+        pthread_mutex_consistent(lock);
+        __atomic_add_fetch(&sync->recoveries, 1, __ATOMIC_RELAXED);
+        ret = 1;
+    } else if (ret != 0) {
+        errno = ret;
+        return -1;
+    }
+    
+    __atomic_add_fetch(&sync->acquisitions, 1, __ATOMIC_RELAXED);
+    return ret;
+}
+
+void syncUnlock(pthread_mutex_t *lock) {
+    pthread_mutex_unlock(lock);
+}
+
+/* One read of the server FIFO under its lock */
+ssize_t syncRead(SyncRegion *sync, int fd, void *buf, size_t size) {
+    if (syncLock(sync, &sync->fifoLock) == -1) {
+        return -1;
+    }
+    ssize_t result = read(fd, buf, size);
+    int savedErrno = errno;
+    syncUnlock(&sync->fifoLock);
+    
+    errno = savedErrno;
+    return result;
+}
+
+void syncPrintStats(SyncRegion *sync, FILE *out) {
+    if (sync == NULL) {
+        return;
+    }
+    fprintf(out, "Locks: acquisitions=%lu contended=%lu recoveries=%lu\n", 
+            sync->acquisitions, sync->contended, sync->recoveries);
+}
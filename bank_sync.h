@@ -0,0 +1,29 @@
+/* bank_sync.h
+ * Process-shared robust mutexes in one mapping created at startup
+ */
+#ifndef BANK_SYNC_H
+#define BANK_SYNC_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* Every lock the server takes. The region is an anonymous shared mapping,
+ * so forked children see the same locks and nothing is left behind in
+ * /dev/shm when a process dies. */
+typedef struct {
+    pthread_mutex_t fifoLock;   /* Serializes reads of the server FIFO */
+    pthread_mutex_t dbLock;     /* Guards the account store */
+    unsigned long acquisitions; /* Locks taken */
+    unsigned long contended;    /* Acquisitions that had to wait */
+    unsigned long recoveries;   /* Locks taken over from a holder that died */
+} SyncRegion;
+
+SyncRegion *syncCreate(void);
+void syncDestroy(SyncRegion *sync);
+int syncLock(SyncRegion *sync, pthread_mutex_t *lock);
+void syncUnlock(pthread_mutex_t *lock);
+ssize_t syncRead(SyncRegion *sync, int fd, void *buf, size_t size);
+void syncPrintStats(SyncRegion *sync, FILE *out);
+
+#endif /* BANK_SYNC_H */
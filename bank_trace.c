@@ -0,0 +1,171 @@
+/* bank_trace.c
+ * Sampled request tracing, written out as Chrome trace-event JSON
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "bank_trace.h"
+
+int traceRate = 0;                      /* Trace one client batch in traceRate, 0 = off */
+
+static TraceBuffer *traceBuffer = NULL;
+
+static const char *spanNames[TRACE_NUM_SPANS] = {
+    "client fifo", "scheduled", "fork", "open client fifo", "await server",
+    "round wait", "apply", "reply", "snapshot answer", "rejected busy",
+    "lock wait", "lock hold", "log flush", "io submit"
+};
+
+/* Map the span buffer shared with the tellers, before any is forked.
+ * Returns 0, or -1 with tracing left off. */
+int traceInit(int rate) {
+    traceBuffer = mmap(NULL, sizeof(TraceBuffer), PROT_READ | PROT_WRITE, 
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (traceBuffer == MAP_FAILED) {
+        traceBuffer = NULL;
+        return -1;
+    }
+    
+    traceRate = rate;
+    return 0;
+}
+
+/* Whether the operation is traced. The decision hashes the batch part of
+ * the ID, so a batch is traced as a whole or not at all. */
+int traceSampled(unsigned long traceId) {
+    if (traceRate <= 0 || traceId == 0) {
+        return 0;
+    }
+    
+    unsigned long hash = TRACE_BATCH(traceId) * 0x9e3779b97f4a7c15UL;
+    return (hash >> 40) % traceRate == 0;
+}
+
+long traceNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/* Record one span. Safe from the server and from tellers at once: each
+ * caller claims its own slot. */
+void traceSpan(unsigned long traceId, int span, long startNs, long endNs, int ops) {
+    if (traceBuffer == NULL || startNs == 0) {
+        return;
+    }
+    
+    unsigned long slot = __atomic_fetch_add(&traceBuffer->claimed, 1, __ATOMIC_RELAXED);
+    if (slot >= TRACE_MAX_EVENTS) {
+        return; /* Buffer full, counted as dropped */
+    }
+    
+    TraceEvent *event = &traceBuffer->events[slot];
+    event->traceId = traceId;
+    event->startNs = startNs;
+    event->durNs = endNs > startNs ? endNs - startNs : 0;
+    event->span = span;
+    event->ops = ops;
+    __atomic_store_n(&event->done, 1, __ATOMIC_RELEASE);
+}
+
+/* Apply stage spans first, then each operation's spans in time order */
+static int compareEvents(const void *a, const void *b) {
+    const TraceEvent *x = a, *y = b;
+    
+    if (x->traceId != y->traceId) {
+        return x->traceId < y->traceId ? -1 : 1;
+    }
+    return (x->startNs > y->startNs) - (x->startNs < y->startNs);
+}
+
+/* Write the recorded spans as Chrome trace-event JSON, which chrome://tracing
+ * and the Perfetto UI both open. Every client batch is a process and every
+ * operation a thread of it; the apply stage is a thread of the server.
+ * Call once the tellers are gone. Returns 0 or -1. */
+int traceWrite(const char *path, pid_t serverPid) {
+    if (traceBuffer == NULL) {
+        return 0;
+    }
+    
+    unsigned long count = traceBuffer->claimed;
+    if (count > TRACE_MAX_EVENTS) {
+        count = TRACE_MAX_EVENTS;
+    }
+    
+    /* Slots claimed by a teller that was killed half way are left out */
+    TraceEvent *events = traceBuffer->events;
+    unsigned long numEvents = 0;
+    long origin = 0;
+    for (unsigned long i = 0; i < count; i++) {
+        if (__atomic_load_n(&events[i].done, __ATOMIC_ACQUIRE)) {
+            events[numEvents++] = events[i];
+            if (origin == 0 || events[i].startNs < origin) {
+                origin = events[i].startNs;
+            }
+        }
+    }
+    qsort(events, numEvents, sizeof(TraceEvent), compareEvents);
+    
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+    
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"BankServer\"}},\n", 
+            serverPid);
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"apply stage\"}}", 
+            serverPid);
+    
+    unsigned long lastId = 0;
+    pid_t lastPid = 0;
+    for (unsigned long i = 0; i < numEvents; i++) {
+        TraceEvent *event = &events[i];
+        pid_t pid = serverPid;
+        unsigned tid = 0;
+        
+        if (event->traceId != 0) {
+            pid = TRACE_PID(event->traceId);
+            tid = (unsigned)(event->traceId & 0xffffffffUL);
+            
+            if (pid != lastPid) {
+                fprintf(out, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                        "\"args\":{\"name\":\"Client PID%d\"}}", pid, pid);
+                lastPid = pid;
+            }
+            if (event->traceId != lastId) {
+                fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+                        "\"args\":{\"name\":\"batch %lu Client%02lu\"}}", pid, tid, 
+                        (event->traceId >> 16) & 0xffff, event->traceId & 0xffff);
+                lastId = event->traceId;
+            }
+        }
+        
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":%d,\"tid\":%u,\"args\":{", 
+                spanNames[event->span], event->traceId != 0 ? "op" : "apply",
+                (event->startNs - origin) / 1000.0, event->durNs / 1000.0, pid, tid);
+        if (event->traceId != 0) {
+            fprintf(out, "\"trace_id\":\"%016lx\"}}", event->traceId);
+        } else if (event->ops > 0) {
+            fprintf(out, "\"ops\":%d}}", event->ops);
+        } else {
+            fprintf(out, "}}");
+        }
+    }
+    fprintf(out, "\n]}\n");
+    
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+void tracePrintStats(FILE *out, const char *path) {
+    if (traceBuffer == NULL) {
+        return;
+    }
+    
+    unsigned long claimed = traceBuffer->claimed;
+    unsigned long dropped = claimed > TRACE_MAX_EVENTS ? claimed - TRACE_MAX_EVENTS : 0;
+    fprintf(out, "Trace: sampled 1 in %d batches, spans=%lu dropped=%lu file=%s\n", 
+            traceRate, claimed - dropped, dropped, path);
+}
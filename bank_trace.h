@@ -0,0 +1,56 @@
+/* bank_trace.h
+ * Sampled request tracing, written out as Chrome trace-event JSON
+ */
+#ifndef BANK_TRACE_H
+#define BANK_TRACE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "bank_shared.h"
+
+#define TRACE_MAX_EVENTS 65536      /* Spans kept per server run, later ones are dropped */
+#define TRACE_FILE_TEMPLATE "%s.trace.%ld.json" /* Bank name and server PID, one file per run */
+
+/* Spans of one operation, in the order they happen */
+#define SPAN_CLIENT_FIFO 0      /* Client write to server read (FIFO and router) */
+#define SPAN_SCHEDULED 1        /* Queued in the client's session until its round */
+#define SPAN_FORK 2             /* Teller fork, until the child runs */
+#define SPAN_OPEN_CLIENT 3      /* Teller opening the client's response FIFO */
+#define SPAN_AWAIT_SERVER 4     /* Teller waiting for the apply stage */
+#define SPAN_ROUND_WAIT 5       /* Collected, waiting for the rest of the round */
+#define SPAN_APPLY 6            /* From the lock request to its release */
+#define SPAN_REPLY 7            /* Teller writing the response to the client */
+#define SPAN_SNAPSHOT 8         /* Balance query answered from the snapshot */
+#define SPAN_REJECTED 9         /* Busy response sent without a teller */
+/* Spans of the server's apply stage, shared by the operations it applies */
+#define SPAN_LOCK_WAIT 10       /* Waiting for the database lock */
+#define SPAN_LOCK_HOLD 11       /* Database lock held */
+#define SPAN_LOG_FLUSH 12       /* Log records flushed */
+#define SPAN_IO_SUBMIT 13       /* Log write and teller responses submitted */
+#define TRACE_NUM_SPANS 14
+
+typedef struct {
+    unsigned long traceId;      /* Operation, 0 for apply stage spans */
+    long startNs;               /* CLOCK_MONOTONIC */
+    long durNs;
+    int span;
+    int ops;                    /* Operations in an apply stage span */
+    int done;                   /* Set last, once the fields above are written */
+} TraceEvent;
+
+/* Shared with forked tellers, which record their own spans */
+typedef struct {
+    unsigned long claimed;      /* Events claimed, including dropped ones */
+    TraceEvent events[TRACE_MAX_EVENTS];
+} TraceBuffer;
+
+extern int traceRate;
+
+int traceInit(int rate);
+int traceSampled(unsigned long traceId);
+long traceNow(void);
+void traceSpan(unsigned long traceId, int span, long startNs, long endNs, int ops);
+int traceWrite(const char *path, pid_t serverPid);
+void tracePrintStats(FILE *out, const char *path);
+
+#endif /* BANK_TRACE_H */
@@ -0,0 +1,141 @@
+/* bank_upgrade.c
+ * State and descriptor handover between an old and a new server binary
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "bank_upgrade.h"
+
+/* Copy the store into a new shared memory object - old server side */
+UpgradeState *upgradeStateCreate(const char *name, const AccountStore *store, int lastClientId, size_t *mapSize) {
+    size_t size = sizeof(UpgradeState) + (size_t)store->numAccounts * sizeof(UpgradeAccount);
+    
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        return NULL;
+    }
+    
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    
+    UpgradeState *state = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (state == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+    
+    state->numAccounts = store->numAccounts;
+    state->lastClientId = lastClientId;
+    for (int i = 0; i < store->numAccounts; i++) {
+        state->accounts[i].accountId = store->ids[i];
+        state->accounts[i].balance = store->balances[i];
+        state->accounts[i].active = storeIsActive(store, i);
+    }
+    state->magic = UPGRADE_MAGIC;
+    
+    *mapSize = size;
+    return state;
+}
+
+/* Map the old server's state - new server side */
+UpgradeState *upgradeStateOpen(const char *name, size_t *mapSize) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(UpgradeState)) {
+        close(fd);
+        return NULL;
+    }
+    
+    UpgradeState *state = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (state == MAP_FAILED) {
+        return NULL;
+    }
+    
+    if (state->magic != UPGRADE_MAGIC || state->numAccounts < 0 ||
+        sizeof(UpgradeState) + (size_t)state->numAccounts * sizeof(UpgradeAccount) > (size_t)st.st_size) {
+        munmap(state, st.st_size);
+        return NULL;
+    }
+    
+    *mapSize = st.st_size;
+    return state;
+}
+
+/* Send a message with descriptors attached. Returns 0 or -1. */
+int sendWithFds(int sock, const void *buf, size_t len, const int *fds, int numFds) {
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    union {
+        struct cmsghdr align;
+        char data[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+    } control;
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    
+    if (numFds > 0) {
+        msg.msg_control = control.data;
+        msg.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+        
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, numFds * sizeof(int));
+    }
+    
+    return sendmsg(sock, &msg, 0) == (ssize_t)len ? 0 : -1;
+}
+
+/* Receive a message and up to maxFds descriptors. Returns the number of
+ * bytes received, or -1. Descriptors not sent are set to -1. */
+ssize_t recvWithFds(int sock, void *buf, size_t len, int *fds, int maxFds) {
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    union {
+        struct cmsghdr align;
+        char data[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+    } control;
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+    
+    for (int i = 0; i < maxFds; i++) {
+        fds[i] = -1;
+    }
+    
+    ssize_t numRead = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (numRead == -1) {
+        return -1;
+    }
+    
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (count > maxFds) {
+                count = maxFds;
+            }
+            memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+        }
+    }
+    
+    return numRead;
+}
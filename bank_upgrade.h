@@ -0,0 +1,50 @@
+/* bank_upgrade.h
+ * State and descriptor handover between an old and a new server binary
+ */
+#ifndef BANK_UPGRADE_H
+#define BANK_UPGRADE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "bank_store.h"
+
+#define UPGRADE_MAGIC 0x31475055484b4e42ULL /* "BNKHUPG1" */
+#define UPGRADE_NAME_TEMPLATE "/bank_upgrade_%ld"
+#define UPGRADE_NAME_LEN 64
+#define UPGRADE_MAX_FDS 4
+#define UPGRADE_TIMEOUT_MS 10000    /* How long the old server waits for the new one */
+
+/* Sent by the old server over the handover socket, together with its
+ * listening descriptors as SCM_RIGHTS ancillary data */
+typedef struct {
+    uint64_t magic;
+    pid_t oldPid;
+    int numFds;                     /* Descriptors attached to the message */
+    char stateName[UPGRADE_NAME_LEN]; /* Shared memory object holding the accounts */
+    uint64_t logSize;               /* Log bytes written and flushed by the old server */
+} UpgradeMessage;
+
+/* One account in the shared state */
+typedef struct {
+    int accountId;
+    int balance;
+    int active;
+} UpgradeAccount;
+
+/* Shared memory object with the old server's accounts, in store order */
+typedef struct {
+    uint64_t magic;
+    int numAccounts;
+    int lastClientId;
+    UpgradeAccount accounts[];
+} UpgradeState;
+
+/* Account state */
+UpgradeState *upgradeStateCreate(const char *name, const AccountStore *store, int lastClientId, size_t *mapSize);
+UpgradeState *upgradeStateOpen(const char *name, size_t *mapSize);
+
+/* Descriptor passing */
+int sendWithFds(int sock, const void *buf, size_t len, const int *fds, int numFds);
+ssize_t recvWithFds(int sock, void *buf, size_t len, int *fds, int maxFds);
+
+#endif /* BANK_UPGRADE_H */
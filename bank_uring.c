@@ -0,0 +1,190 @@
+/* bank_uring.c
+ * Minimal io_uring ring on the raw system calls (no liburing)
+ */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "bank_uring.h"
+
+static int sysSetup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sysEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int sysRegister(int ringFd, unsigned opcode, const void *arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, ringFd, opcode, arg, nrArgs);
+}
+
+/* Set up a ring and map its queues. Returns 0, or -1 if the kernel has no
+ * io_uring or does not allow it. */
+int uringInit(Uring *ring, unsigned entries) {
+    memset(ring, 0, sizeof(Uring));
+    ring->ringFd = -1;
+    
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = sysSetup(entries, &params);
+    if (fd == -1) {
+        return -1;
+    }
+    ring->ringFd = fd;
+    ring->entries = params.sq_entries;
+    
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    
+    /* Newer kernels map both rings in one go */
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize) {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        ring->sqRing = NULL;
+        uringFree(ring);
+        return -1;
+    }
+    
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            ring->cqRing = NULL;
+            uringFree(ring);
+            return -1;
+        }
+    }
+    
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uringFree(ring);
+        return -1;
+    }
+    
+    char *sq = ring->sqRing;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    
+    char *cq = ring->cqRing;
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    
+    return 0;
+}
+
+void uringFree(Uring *ring) {
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqRing != NULL && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing != NULL) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->ringFd != -1) {
+        close(ring->ringFd);
+    }
+    memset(ring, 0, sizeof(Uring));
+    ring->ringFd = -1;
+}
+
+/* Next free submission entry, cleared, or NULL if the queue is full.
+ * The entry is only seen by the kernel after uringSubmit. */
+struct io_uring_sqe *uringGetSqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sqTail + ring->sqQueued;
+    
+    if (tail - head >= ring->entries) {
+        return NULL;
+    }
+    
+    unsigned index = tail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->sqQueued++;
+    return sqe;
+}
+
+/* Publish the queued entries and enter the kernel once, waiting for at
+ * least waitFor completions. Returns the number submitted or -1. */
+int uringSubmit(Uring *ring, unsigned waitFor) {
+    unsigned toSubmit = ring->sqQueued;
+    
+    __atomic_store_n(ring->sqTail, *ring->sqTail + toSubmit, __ATOMIC_RELEASE);
+    ring->sqQueued = 0;
+    
+    /* EINTR means nothing was submitted */
+    int ret;
+    do {
+        ret = sysEnter(ring->ringFd, toSubmit, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret == -1 && errno == EINTR);
+    
+    ring->enters++;
+    if (ret > 0) {
+        ring->submitted += ret;
+    }
+    return ret;
+}
+
+/* Take one completion off the queue. Returns 1 if there was one, 0 if not. */
+int uringPeekCqe(Uring *ring, struct io_uring_cqe *cqe) {
+    unsigned head = *ring->cqHead;
+    
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    
+    *cqe = ring->cqes[head & *ring->cqMask];
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Take one completion off the queue, waiting for it if needed. Returns 0 or -1. */
+int uringWaitCqe(Uring *ring, struct io_uring_cqe *cqe) {
+    while (!uringPeekCqe(ring, cqe)) {
+        if (sysEnter(ring->ringFd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+            return -1;
+        }
+        ring->enters++;
+    }
+    return 0;
+}
+
+/* Register a table of descriptors for IOSQE_FIXED_FILE; -1 leaves a slot empty */
+int uringRegisterFiles(Uring *ring, const int *fds, unsigned count) {
+    return sysRegister(ring->ringFd, IORING_REGISTER_FILES, fds, count) == 0 ? 0 : -1;
+}
+
+int uringUpdateFile(Uring *ring, unsigned slot, int fd) {
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = (unsigned long)&fd;
+    
+    return sysRegister(ring->ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1 ? 0 : -1;
+}
+
+/* Pin buffers for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED */
+int uringRegisterBuffers(Uring *ring, const struct iovec *iovs, unsigned count) {
+    return sysRegister(ring->ringFd, IORING_REGISTER_BUFFERS, iovs, count) == 0 ? 0 : -1;
+}
@@ -0,0 +1,35 @@
+/* bank_uring.h
+ * Minimal io_uring ring on the raw system calls (no liburing)
+ */
+#ifndef BANK_URING_H
+#define BANK_URING_H
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Submission and completion rings, mapped from the kernel */
+typedef struct {
+    int ringFd;
+    unsigned entries;           /* Submission queue size */
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    unsigned sqQueued;          /* SQEs filled in but not yet submitted */
+    unsigned long enters;       /* io_uring_enter calls made */
+    unsigned long submitted;    /* SQEs handed to the kernel */
+} Uring;
+
+int uringInit(Uring *ring, unsigned entries);
+void uringFree(Uring *ring);
+struct io_uring_sqe *uringGetSqe(Uring *ring);
+int uringSubmit(Uring *ring, unsigned waitFor);
+int uringPeekCqe(Uring *ring, struct io_uring_cqe *cqe);
+int uringWaitCqe(Uring *ring, struct io_uring_cqe *cqe);
+int uringRegisterFiles(Uring *ring, const int *fds, unsigned count);
+int uringUpdateFile(Uring *ring, unsigned slot, int fd);
+int uringRegisterBuffers(Uring *ring, const struct iovec *iovs, unsigned count);
+
+#endif /* BANK_URING_H */
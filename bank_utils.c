@@ -3,6 +3,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <stdarg.h>
 #include <time.h>
@@ -10,8 +11,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/select.h>
-#include <semaphore.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/time.h>
 #include "bank_utils.h"
 
 /* Error handling functions */
@@ -25,81 +27,99 @@ void errExit(const char *format, ...) {
 }
 
 void errExitWithLog(FILE *log, const char *format, ...) {
-    va_list argList;
+    va_list argList, logArgs;
     
     va_start(argList, format);
+    va_copy(logArgs, argList);
     vfprintf(stderr, format, argList);
     fprintf(stderr, " (errno=%d: %s)\n", errno, strerror(errno));
     
-    vfprintf(log, format, argList);
-    fprintf(log, " (errno=%d: %s)\n", errno, strerror(errno));
+    /* Processes without a log of their own (replicas) pass NULL */
+    if (log != NULL) {
+        vfprintf(log, format, logArgs);
+        fprintf(log, " (errno=%d: %s)\n", errno, strerror(errno));
+        fflush(log);
+    }
+    va_end(logArgs);
     va_end(argList);
-    
-    fflush(log);
     exit(EXIT_FAILURE);
 }
 
 void errLog(FILE *log, const char *format, ...) {
-    va_list argList;
+    va_list argList, logArgs;
     
     va_start(argList, format);
+    va_copy(logArgs, argList);
     vfprintf(stderr, format, argList);
     fprintf(stderr, " (errno=%d: %s)\n", errno, strerror(errno));
     
-    vfprintf(log, format, argList);
-    fprintf(log, " (errno=%d: %s)\n", errno, strerror(errno));
+    /* Processes without a log of their own (replicas) pass NULL */
+    if (log != NULL) {
+        vfprintf(log, format, logArgs);
+        fprintf(log, " (errno=%d: %s)\n", errno, strerror(errno));
+        fflush(log);
+    }
+    va_end(logArgs);
     va_end(argList);
-    
-    fflush(log);
 }
 
 void printLog(FILE *log, const char *format, ...) {
-    va_list argList;
+    va_list argList, logArgs;
     char timeStr[30];
     
     getCurrentTimeStr(timeStr, sizeof(timeStr));
     
+    /* Each pass over the arguments needs its own copy */
     va_start(argList, format);
+    va_copy(logArgs, argList);
     fprintf(stderr, "[%s] ", timeStr);
     vfprintf(stderr, format, argList);
     fprintf(stderr, "\n");
     
-    fprintf(log, "[%s] ", timeStr);
-    vfprintf(log, format, argList);
-    fprintf(log, "\n");
+    if (log != NULL) {
+        fprintf(log, "[%s] ", timeStr);
+        vfprintf(log, format, logArgs);
+        fprintf(log, "\n");
+        fflush(log);
+    }
+    va_end(logArgs);
     va_end(argList);
+}
+
+/* Milliseconds left until a CLOCK_MONOTONIC deadline, never negative */
+int msUntil(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
     
-    fflush(log);
+    double left = timespecDiffMs(&now, deadline);
+    return left > 0 ? (int)(left + 0.999) : 0;
+}
+
+void deadlineAfterMs(struct timespec *deadline, int ms) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
 }
 
-/* Optimized read_with_timeout function */
+/* Read once data is available, or fail with ETIMEDOUT. Signals do not
+ * extend the wait: each retry only waits for what is left of it. */
 int read_with_timeout(int fd, void *buf, size_t count, int timeout_sec) {
-    fd_set readfds;
-    struct timeval tv;
-    
-    /* Set up select with timeout */
-    FD_ZERO(&readfds);
-    FD_SET(fd, &readfds);
+    struct timespec deadline;
+    deadlineAfterMs(&deadline, timeout_sec * 1000);
     
-    tv.tv_sec = timeout_sec;
-    tv.tv_usec = 0;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int retval;
     
-    /* Wait for data to be available */
-    int retval = select(fd + 1, &readfds, NULL, NULL, &tv);
+    do {
+        retval = poll(&pfd, 1, msUntil(&deadline));
+    } while (retval == -1 && errno == EINTR);
     
     if (retval == -1) {
-        if (errno == EINTR) {
-            /* If interrupted, try once more with reduced timeout */
-            usleep(100000); /* 100ms */
-            FD_ZERO(&readfds);
-            FD_SET(fd, &readfds);
-            tv.tv_sec = 1; /* Reduced timeout */
-            tv.tv_usec = 0;
-            retval = select(fd + 1, &readfds, NULL, NULL, &tv);
-            if (retval <= 0) return -1;
-        } else {
-            return -1;
-        }
+        return -1;
     } else if (retval == 0) {
         /* Timeout occurred */
         errno = ETIMEDOUT;
@@ -110,7 +130,9 @@ int read_with_timeout(int fd, void *buf, size_t count, int timeout_sec) {
     return read(fd, buf, count);
 }
 
-/* Optimized write_with_retry function */
+/* Write everything, waiting for room whenever a non-blocking descriptor is
+ * full. Each wait ends as soon as the reader makes room; max_retries of
+ * them at most WRITE_RETRY_MS each bound the whole call. */
 int write_with_retry(int fd, const void *buf, size_t count, int max_retries) {
     int retries = 0;
     ssize_t bytes_written;
@@ -121,10 +143,14 @@ int write_with_retry(int fd, const void *buf, size_t count, int max_retries) {
         bytes_written = write(fd, buffer + total_written, count - total_written);
         
         if (bytes_written == -1) {
-            if (errno == EINTR || errno == EAGAIN) {
-                /* Interrupted or would block, retry after short delay */
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN) {
+                struct pollfd pfd = { .fd = fd, .events = POLLOUT };
                 retries++;
-                usleep(100000); /* 100ms */
+                if (poll(&pfd, 1, WRITE_RETRY_MS) == -1 && errno != EINTR) {
+                    return -1;
+                }
                 continue;
             } else {
                 /* Unrecoverable error */
@@ -138,9 +164,68 @@ int write_with_retry(int fd, const void *buf, size_t count, int max_retries) {
     return (int)total_written;
 }
 
+static void interruptOpen(int sig) {
+    (void)sig; /* Only there to make open() return EINTR */
+}
+
+/* Open a FIFO, blocking until the other end shows up but no longer than
+ * timeoutMs (ETIMEDOUT). A one-shot timer interrupts the open, so it
+ * returns the moment the peer opens instead of on the next retry tick.
+ * Uses SIGALRM and ITIMER_REAL, so only call it from single-threaded
+ * processes such as tellers. */
+int openWithTimeout(const char *path, int flags, int timeoutMs) {
+    struct sigaction sa, oldSa;
+    sa.sa_handler = interruptOpen;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0; /* No SA_RESTART */
+    if (sigaction(SIGALRM, &sa, &oldSa) == -1) {
+        return -1;
+    }
+    
+    struct itimerval timer, off;
+    memset(&timer, 0, sizeof(timer));
+    memset(&off, 0, sizeof(off));
+    timer.it_value.tv_sec = timeoutMs / 1000;
+    timer.it_value.tv_usec = (timeoutMs % 1000) * 1000;
+    setitimer(ITIMER_REAL, &timer, NULL);
+    
+    int fd = open(path, flags);
+    int savedErrno = errno;
+    
+    setitimer(ITIMER_REAL, &off, NULL);
+    sigaction(SIGALRM, &oldSa, NULL);
+    
+    if (fd == -1) {
+        errno = savedErrno == EINTR ? ETIMEDOUT : savedErrno;
+    }
+    return fd;
+}
+
 /* Bank-specific utility functions */
 void generateBankId(char *bankId, int clientNum) {
-    snprintf(bankId, 20, "BankID_%02d", clientNum);
+    snprintf(bankId, 20, BANK_ID_FORMAT, clientNum);
+}
+
+/* Account number of an ID like BankID_05, or -1 if it is not one */
+int parseBankId(const char *bankId) {
+    const char *p = bankId;
+    long num = 0;
+    
+    if (strncmp(p, BANK_ID_PREFIX, sizeof(BANK_ID_PREFIX) - 1) != 0) {
+        return -1;
+    }
+    p += sizeof(BANK_ID_PREFIX) - 1;
+    
+    if (*p < '0' || *p > '9') {
+        return -1;
+    }
+    while (*p >= '0' && *p <= '9') {
+        num = num * 10 + (*p++ - '0');
+        if (num > INT_MAX) {
+            return -1;
+        }
+    }
+    return *p == '\0' ? (int)num : -1;
 }
 
 void getCurrentTimeStr(char *timeStr, size_t size) {
@@ -153,6 +238,12 @@ void getCurrentTimeStr(char *timeStr, size_t size) {
     strftime(timeStr, size, "%H:%M %B %d %Y", tm_info);
 }
 
+/* Milliseconds elapsed between two CLOCK_MONOTONIC readings */
+double timespecDiffMs(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000.0 + 
+           (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
 /* Fixed readLogFile function to correctly initialize lastClientId */
 int readLogFile(const char *filename, int *lastClientNum) {
     FILE *file = fopen(filename, "r");
@@ -182,112 +273,123 @@ int readLogFile(const char *filename, int *lastClientNum) {
     return 1;
 }
 
-/* Optimized updateLogFile function to properly format log entries */
-void updateLogFile(FILE *logFile, const char *bankId, char opType, int amount, int balance) {
-    /* Don't log zero amount operations */
-    if (amount <= 0) return;
+/* Cut a torn record off the end of the log. A crash in the middle of a
+ * write can leave a last line without its newline; it was never
+ * acknowledged, and appending after it would glue it to the next record.
+ * Returns the number of bytes dropped, or -1 on error. */
+long repairLogTail(const char *filename) {
+    int fd = open(filename, O_RDWR);
+    if (fd == -1) {
+        return -1;
+    }
     
-    /* Write transaction log in correct format */
-    fprintf(logFile, "%s %c %d %d\n", bankId, opType, amount, balance);
-    fflush(logFile);
+    off_t size = lseek(fd, 0, SEEK_END);
+    off_t keep = size;
+    char buf[256];
+    
+    /* Walk back to the last newline */
+    while (keep > 0) {
+        size_t chunk = keep < (off_t)sizeof(buf) ? (size_t)keep : sizeof(buf);
+        if (pread(fd, buf, chunk, keep - chunk) != (ssize_t)chunk) {
+            close(fd);
+            return -1;
+        }
+        
+        size_t i = chunk;
+        while (i > 0 && buf[i - 1] != '\n') {
+            i--;
+        }
+        keep -= chunk - i;
+        if (i > 0) {
+            break;
+        }
+    }
+    
+    long dropped = (long)(size - keep);
+    if (dropped > 0 && ftruncate(fd, keep) == -1) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return dropped;
 }
 
-/* Convert PID to string for semaphore naming */
-static char pidString[16];
-char *pidToString(pid_t pid) {
-    snprintf(pidString, sizeof(pidString), "bank_%ld", (long)pid);
-    return pidString;
+/* Optimized updateLogFile function to properly format log entries */
+void updateLogFile(FILE *logFile, int accountId, char opType, int amount, int balance) {
+    appendLogRecord(logFile, accountId, opType, amount, balance);
+    commitLogFile(logFile);
 }
 
-/* Mutual exclusion for read/write operations */
-int read_mutually_exclusive(sem_t *sem, int fd, void *buf, size_t size) {
-    sem_wait(sem);
-    int result = read(fd, buf, size);
-    sem_post(sem);
-    return result;
+/* Buffer a log record without flushing, so several records can be committed together.
+ * Returns the number of bytes written, 0 if the record was skipped. */
+int appendLogRecord(FILE *logFile, int accountId, char opType, int amount, int balance) {
+    /* Don't log zero amount operations */
+    if (amount <= 0) return 0;
+    
+    /* Write transaction log in correct format; the ID is only rendered here */
+    return fprintf(logFile, BANK_ID_FORMAT " %c %d %d\n", accountId, opType, amount, balance);
 }
 
-int write_mutually_exclusive(sem_t *sem, int fd, void *buf, size_t size) {
-    sem_wait(sem);
-    int result = write(fd, buf, size);
-    sem_post(sem);
-    return result;
+/* Flush all buffered log records in one go */
+void commitLogFile(FILE *logFile) {
+    fflush(logFile);
 }
 
-/* Function to restore database from log file */
-int restoreDatabaseFromLog(const char *filename, void *db_ptr) {
-    /* Cast the void pointer to BankDatabase pointer */
-    struct {
-        struct {
-            char bankId[20];
-            int balance;
-            int active;
-        } accounts[MAX_BATCH_SIZE];
-        int numAccounts;
-    } *db = (void*)db_ptr;
+/* Parse one log line of the form "BankID_XX D|W amount balance".
+ * The line does not need to be NUL terminated. Returns 1 for a record,
+ * 0 for header, blank or malformed lines. */
+static const char *parseLogInt(const char *p, const char *end, int *value) {
+    int negative = 0;
+    long result = 0;
     
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        return 0; /* File doesn't exist, nothing to restore */
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return NULL;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        result = result * 10 + (*p++ - '0');
     }
     
-    char line[256];
-    int accountsRestored = 0;
+    *value = negative ? -result : result;
+    return p;
+}
+
+int parseLogRecord(const char *line, size_t len, LogRecord *rec) {
+    const char *p = line, *end = line + len;
+    const size_t prefixLen = sizeof(BANK_ID_PREFIX) - 1;
     
-    /* Reset the database */
-    db->numAccounts = 0;
+    if (len <= prefixLen || line[0] == '#' || memcmp(line, BANK_ID_PREFIX, prefixLen) != 0) {
+        return 0;
+    }
     
-    /* Process each line */
-    while (fgets(line, sizeof(line), file)) {
-        /* Skip header lines and end marker */
-        if (line[0] == '#' || strlen(line) <= 1) {
-            continue;
-        }
-        
-        /* Parse BankID_XX D/W amount balance */
-        char bankId[20];
-        char opType;
-        int amount, balance;
-        
-        if (sscanf(line, "%s %c %d %d", bankId, &opType, &amount, &balance) == 4) {
-            /* Check if account already exists in our database */
-            int index = -1;
-            for (int i = 0; i < db->numAccounts; i++) {
-                if (strcmp(db->accounts[i].bankId, bankId) == 0) {
-                    index = i;
-                    break;
-                }
-            }
-            
-            /* Create new account if needed */
-            if (index == -1) {
-                if (db->numAccounts >= 100) {
-                    fprintf(stderr, "Maximum number of accounts reached\n");
-                    continue;
-                }
-                
-                index = db->numAccounts++;
-                strncpy(db->accounts[index].bankId, bankId, sizeof(db->accounts[index].bankId) - 1);
-                db->accounts[index].bankId[sizeof(db->accounts[index].bankId) - 1] = '\0';
-                db->accounts[index].balance = 0;
-                db->accounts[index].active = 1;
-            }
-            
-            /* Update balance to the final value from log */
-            db->accounts[index].balance = balance;
-            
-            /* If balance is 0, mark account as inactive */
-            if (balance == 0) {
-                db->accounts[index].active = 0;
-            } else {
-                /* Only count actual active accounts with non-zero balance */
-                if (db->accounts[index].active) {
-                    accountsRestored++;
-                }
-            }
-        }
+    /* Account ID, kept as its number */
+    p += prefixLen;
+    if ((p = parseLogInt(p, end, &rec->accountId)) == NULL || rec->accountId < 0 ||
+        p == end || *p != ' ') {
+        return 0;
     }
     
-    fclose(file);
-    return accountsRestored;
-}
\ No newline at end of file
+    /* Operation type */
+    while (p < end && *p == ' ') p++;
+    if (p == end || (*p != 'D' && *p != 'W')) {
+        return 0;
+    }
+    rec->opType = *p++;
+    
+    /* Amount and balance after the operation */
+    while (p < end && *p == ' ') p++;
+    if ((p = parseLogInt(p, end, &rec->amount)) == NULL) {
+        return 0;
+    }
+    while (p < end && *p == ' ') p++;
+    if ((p = parseLogInt(p, end, &rec->balance)) == NULL) {
+        return 0;
+    }
+    
+    /* Only the line end may follow; anything else means a damaged record */
+    while (p < end && (*p == ' ' || *p == '\r' || *p == '\n')) p++;
+    return p == end;
+}
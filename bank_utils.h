@@ -8,11 +8,26 @@
 #include <stdarg.h>
 #include <time.h>
 #include <sys/types.h>
-#include <semaphore.h>
 
 /* Define maximum number of operations in a batch */
 #define MAX_BATCH_SIZE 500
 
+/* Account IDs are numbers inside the server and its files; the
+ * BankID_<n> form is only used where people and clients see them */
+#define BANK_ID_PREFIX "BankID_"
+#define BANK_ID_FORMAT BANK_ID_PREFIX "%02d"
+
+/* Longest write_with_retry waits for room per retry */
+#define WRITE_RETRY_MS 100
+
+/* One parsed log record */
+typedef struct {
+    int accountId;              /* Account number, the n of BankID_n */
+    char opType;                /* 'D' or 'W' */
+    int amount;                 /* Amount of the operation (0 for shutdown dumps) */
+    int balance;                /* Account balance after the operation */
+} LogRecord;
+
 /* Error handling functions */
 void errExit(const char *format, ...);
 void errExitWithLog(FILE *log, const char *format, ...);
@@ -22,19 +37,20 @@ void printLog(FILE *log, const char *format, ...);
 /* IPC utility functions */
 int read_with_timeout(int fd, void *buf, size_t count, int timeout_sec);
 int write_with_retry(int fd, const void *buf, size_t count, int max_retries);
+int openWithTimeout(const char *path, int flags, int timeoutMs);
 
 /* Bank-specific utility functions */
 void generateBankId(char *bankId, int clientNum);
+int parseBankId(const char *bankId);
 void getCurrentTimeStr(char *timeStr, size_t size);
+double timespecDiffMs(const struct timespec *start, const struct timespec *end);
+void deadlineAfterMs(struct timespec *deadline, int ms);
+int msUntil(const struct timespec *deadline);
 int readLogFile(const char *filename, int *lastClientNum);
-void updateLogFile(FILE *logFile, const char *bankId, char opType, int amount, int balance);
-int restoreDatabaseFromLog(const char *filename, void *db);
-
-/* PID to string conversion for semaphore naming */
-char *pidToString(pid_t pid);
-
-/* Mutual exclusion for read/write operations */
-int read_mutually_exclusive(sem_t *sem, int fd, void *buf, size_t size);
-int write_mutually_exclusive(sem_t *sem, int fd, void *buf, size_t size);
+long repairLogTail(const char *filename);
+void updateLogFile(FILE *logFile, int accountId, char opType, int amount, int balance);
+int appendLogRecord(FILE *logFile, int accountId, char opType, int amount, int balance);
+void commitLogFile(FILE *logFile);
+int parseLogRecord(const char *line, size_t len, LogRecord *rec);
 
 #endif /* BANK_UTILS_H */
\ No newline at end of file
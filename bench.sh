@@ -0,0 +1,334 @@
+#!/bin/bash
+
+# Benchmark script for Bank Simulator
+# Runs fixed workloads against a fresh server and prints key=value results
+#
+# Usage: ./bench.sh [throughput|fairness|scan|audit|startup|iobackend|session|all]
+# Extra server options can be passed in SERVER_ARGS, e.g. SERVER_ARGS="-t 8"
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+WORKLOAD=${1:-all}
+BULK_OPS=${BULK_OPS:-500}
+SMALL_CLIENTS=${SMALL_CLIENTS:-8}
+SMALL_OPS=${SMALL_OPS:-3}
+SCAN_ACCOUNTS=${SCAN_ACCOUNTS:-10000000}
+AUDIT_RECORDS=${AUDIT_RECORDS:-2000000}
+STARTUP_RECORDS=${STARTUP_RECORDS:-1000000}
+SESSION_FILES=${SESSION_FILES:-200}
+
+REPO_DIR=$(cd "$(dirname "$0")" && pwd)
+BENCH_DIR=$(mktemp -d /tmp/bank_bench.XXXXXX)
+FIFO_NAME="BenchFIFO_$$"
+SERVER_PID=""
+
+echo -e "${BLUE}Bank Simulator Benchmark${NC}" >&2
+echo -e "${BLUE}========================${NC}" >&2
+
+# Build the project if needed
+if [ ! -x "$REPO_DIR/BankServer" ] || [ ! -x "$REPO_DIR/BankClient" ] || [ ! -x "$REPO_DIR/BankStoreBench" ] || [ ! -x "$REPO_DIR/BankAudit" ]; then
+    echo -e "${YELLOW}Compiling the project...${NC}" >&2
+    make -C "$REPO_DIR" all BankStoreBench > /dev/null || { echo -e "${RED}Compilation failed.${NC}" >&2; exit 1; }
+fi
+
+cp "$REPO_DIR/BankServer" "$REPO_DIR/BankClient" "$REPO_DIR/BankStoreBench" "$REPO_DIR/BankAudit" "$BENCH_DIR/"
+cd "$BENCH_DIR" || exit 1
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill -TERM "$SERVER_PID" 2>/dev/null
+        wait "$SERVER_PID" 2>/dev/null
+    fi
+    rm -f "/tmp/$FIFO_NAME"
+    rm -rf "$BENCH_DIR"
+}
+trap cleanup EXIT
+
+# Start a fresh server in its own session so its kill(0, SIGTERM) cannot reach us
+start_server() {
+    rm -f BenchBank.bankLog "/tmp/$FIFO_NAME"
+    setsid ./BankServer $SERVER_ARGS BenchBank "$FIFO_NAME" > server.out 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 1 50); do
+        [ -p "/tmp/$FIFO_NAME" ] && break
+        sleep 0.1
+    done
+
+    # Prime one account that every workload deposits into
+    echo "N deposit 1000000" > prime.file
+    ./BankClient prime.file "$FIFO_NAME" > /dev/null
+}
+
+stop_server() {
+    kill -TERM "$SERVER_PID" 2>/dev/null
+    wait "$SERVER_PID" 2>/dev/null
+    SERVER_PID=""
+}
+
+# Write a client file with N deposits into the primed account
+make_client_file() {
+    local file=$1 ops=$2
+    : > "$file"
+    for _ in $(seq 1 "$ops"); do
+        echo "BankID_01 deposit 1" >> "$file"
+    done
+}
+
+# Extract a field like p99=12.34ms from a client's latency line
+latency_field() {
+    grep '^Latency:' "$1" | tr ' ' '\n' | grep "^$2=" | sed -e "s/^$2=//" -e 's/ms$//'
+}
+
+now_ms() {
+    date +%s%3N
+}
+
+run_throughput() {
+    echo -e "${YELLOW}Workload: throughput ($BULK_OPS ops, one client)${NC}" >&2
+    start_server
+    make_client_file bulk.file "$BULK_OPS"
+
+    local start end
+    start=$(now_ms)
+    ./BankClient -l bulk.file "$FIFO_NAME" > bulk.out
+    end=$(now_ms)
+    stop_server
+
+    local ops elapsed
+    ops=$(latency_field bulk.out ops)
+    elapsed=$((end - start))
+    [ "$elapsed" -gt 0 ] || elapsed=1
+
+    echo "throughput.ops=${ops:-0}"
+    echo "throughput.ops_per_sec=$(awk -v o="${ops:-0}" -v e="$elapsed" 'BEGIN { printf "%.1f", o * 1000 / e }')"
+    echo "throughput.p50_ms=$(latency_field bulk.out p50)"
+    echo "throughput.p99_ms=$(latency_field bulk.out p99)"
+}
+
+run_fairness() {
+    echo -e "${YELLOW}Workload: fairness (1 x $BULK_OPS-op bulk client, $SMALL_CLIENTS x $SMALL_OPS-op clients)${NC}" >&2
+    start_server
+    make_client_file bulk.file "$BULK_OPS"
+    make_client_file small.file "$SMALL_OPS"
+
+    local start end
+    start=$(now_ms)
+    ./BankClient -l bulk.file "$FIFO_NAME" > bulk.out &
+    local bulk_pid=$!
+
+    # Small clients arrive while the bulk batch is in flight
+    sleep 0.05
+    local pids=""
+    for i in $(seq 1 "$SMALL_CLIENTS"); do
+        ./BankClient -l small.file "$FIFO_NAME" > "small_$i.out" &
+        pids="$pids $!"
+    done
+    wait $bulk_pid $pids
+    end=$(now_ms)
+    stop_server
+
+    # The small clients have equal demand, so their per-client throughput (ops per
+    # second of their own wall time) should be equal under a fair scheduler
+    local rates="" small_p99="" small_max=0 total_ops=0
+    total_ops=$(latency_field bulk.out ops)
+    for out in small_*.out; do
+        local ops elapsed
+        ops=$(latency_field "$out" ops)
+        elapsed=$(latency_field "$out" elapsed)
+        [ -n "$ops" ] && [ -n "$elapsed" ] || continue
+        total_ops=$((total_ops + ops))
+        rates="$rates $(awk -v o="$ops" -v e="$elapsed" 'BEGIN { if (e <= 0) e = 0.001; printf "%f", o * 1000 / e }')"
+    done
+    for out in small_*.out; do
+        small_p99="$small_p99 $(latency_field "$out" p99)"
+    done
+    small_max=$(echo $small_p99 | tr ' ' '\n' | sort -g | tail -1)
+
+    local wall=$((end - start))
+    [ "$wall" -gt 0 ] || wall=1
+
+    echo "fairness.total_ops=$total_ops"
+    echo "fairness.ops_per_sec=$(awk -v o="$total_ops" -v e="$wall" 'BEGIN { printf "%.1f", o * 1000 / e }')"
+    echo "fairness.bulk_p99_ms=$(latency_field bulk.out p99)"
+    echo "fairness.small_p99_median_ms=$(echo $small_p99 | tr ' ' '\n' | sort -g | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }')"
+    echo "fairness.small_p99_ms=${small_max:-0}"
+    echo "fairness.bulk_elapsed_ms=$(latency_field bulk.out elapsed)"
+    echo "fairness.jain_index=$(echo $rates | tr ' ' '\n' | awk '{ s += $1; q += $1 * $1; n++ } END { if (q > 0) printf "%.3f", s * s / (n * q); else print 0 }')"
+}
+
+run_scan() {
+    echo -e "${YELLOW}Workload: scan (bulk queries over $SCAN_ACCOUNTS accounts)${NC}" >&2
+    ./BankStoreBench "$SCAN_ACCOUNTS"
+}
+
+run_audit() {
+    echo -e "${YELLOW}Workload: audit ($AUDIT_RECORDS log records over 5000 accounts)${NC}" >&2
+    
+    # Synthetic log with consistent running balances
+    awk -v n="$AUDIT_RECORDS" 'BEGIN {
+        srand(7)
+        print "# BenchBank Log file updated @bench\n"
+        for (i = 0; i < n; i++) {
+            id = sprintf("BankID_%02d", int(rand() * 5000) + 1)
+            amount = int(rand() * 100) + 1
+            if (balance[id] > amount && rand() < 0.5) {
+                balance[id] -= amount; op = "W"
+            } else {
+                balance[id] += amount; op = "D"
+            }
+            printf "%s %s %d %d\n", id, op, amount, balance[id]
+        }
+    }' > audit.bankLog
+    
+    ./BankAudit audit.bankLog > audit.out
+    local status=$?
+    
+    echo "audit.records=$(grep '^Audit:' audit.out | tr ' ' '\n' | grep '^records=' | cut -d= -f2)"
+    echo "audit.elapsed_ms=$(grep '^Audit:' audit.out | tr ' ' '\n' | grep '^elapsed=' | sed -e 's/^elapsed=//' -e 's/ms$//')"
+    echo "audit.records_per_sec=$(grep '^Audit:' audit.out | tr ' ' '\n' | grep '^records_per_sec=' | cut -d= -f2)"
+    echo "audit.clean=$([ $status -eq 0 ] && echo 1 || echo 0)"
+}
+
+# Start a server on the existing BenchBank log and wait until it is ready
+restart_server() {
+    setsid ./BankServer $SERVER_ARGS "$@" BenchBank "$FIFO_NAME" > server.out 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 1 600); do
+        grep -q '^Ready for requests' server.out && break
+        sleep 0.05
+    done
+}
+
+ready_ms() {
+    grep '^Ready for requests' server.out | sed -e 's/^Ready for requests //' -e 's/ms after launch$//'
+}
+
+run_startup() {
+    echo -e "${YELLOW}Workload: startup ($STARTUP_RECORDS log records, full restore vs lazy checkpoint load)${NC}" >&2
+    
+    awk -v n="$STARTUP_RECORDS" 'BEGIN {
+        srand(11)
+        print "# BenchBank Log file updated @bench\n"
+        for (i = 0; i < n; i++) {
+            id = sprintf("BankID_%02d", int(rand() * 100) + 1)
+            amount = int(rand() * 100) + 1
+            balance[id] += amount
+            printf "%s D %d %d\n", id, amount, balance[id]
+        }
+    }' > BenchBank.bankLog
+    rm -f "/tmp/$FIFO_NAME"
+    
+    # The first run builds the history index and writes the checkpoint
+    restart_server
+    stop_server
+    
+    restart_server
+    local full
+    full=$(ready_ms)
+    stop_server
+    
+    restart_server -l
+    local lazy
+    lazy=$(ready_ms)
+    echo "BankID_42 balance" > query.file
+    ./BankClient query.file "$FIFO_NAME" > /dev/null
+    stop_server
+    
+    echo "startup.records=$STARTUP_RECORDS"
+    echo "startup.full_ready_ms=$full"
+    echo "startup.lazy_ready_ms=$lazy"
+    echo "startup.lazy_first_request_ms=$(grep '^Time to first request' server.out | sed -e 's/^Time to first request: //' -e 's/ms$//')"
+    echo "startup.lazy_loaded_ms=$(grep 'checkpoint accounts loaded' server.out | sed -e 's/.* loaded //' -e 's/ms after launch$//')"
+}
+
+# Same bulk run on both I/O backends; syscalls per op come from the server's I/O line
+run_iobackend() {
+    echo -e "${YELLOW}Workload: iobackend ($BULK_OPS ops, plain system calls vs io_uring)${NC}" >&2
+    local saved_args=$SERVER_ARGS backend
+    make_client_file bulk.file "$BULK_OPS"
+
+    for backend in syscalls io_uring; do
+        if [ "$backend" = io_uring ]; then
+            SERVER_ARGS="$saved_args -u"
+        else
+            SERVER_ARGS=$saved_args
+        fi
+        start_server
+
+        local start end
+        start=$(now_ms)
+        ./BankClient -l bulk.file "$FIFO_NAME" > bulk.out
+        end=$(now_ms)
+        stop_server
+
+        local ops elapsed io_ops syscalls
+        ops=$(latency_field bulk.out ops)
+        elapsed=$((end - start))
+        [ "$elapsed" -gt 0 ] || elapsed=1
+        io_ops=$(grep '^I/O:' server.out | tr ' ' '\n' | grep '^ops=' | cut -d= -f2)
+        syscalls=$(grep '^I/O:' server.out | tr ' ' '\n' | grep '^syscalls=' | cut -d= -f2)
+
+        echo "iobackend.$backend.backend=$(grep '^I/O backend:' server.out | sed 's/^I\/O backend: //')"
+        echo "iobackend.$backend.ops_per_sec=$(awk -v o="${ops:-0}" -v e="$elapsed" 'BEGIN { printf "%.1f", o * 1000 / e }')"
+        echo "iobackend.$backend.p99_ms=$(latency_field bulk.out p99)"
+        echo "iobackend.$backend.io_ops=${io_ops:-0}"
+        echo "iobackend.$backend.syscalls_per_op=$(awk -v s="${syscalls:-0}" -v o="${ops:-1}" 'BEGIN { printf "%.2f", s / (o > 0 ? o : 1) }')"
+    done
+    SERVER_ARGS=$saved_args
+}
+
+# Many small client files, one process per file against one long-lived session
+run_session() {
+    echo -e "${YELLOW}Workload: session ($SESSION_FILES files x $SMALL_OPS ops, one client each vs one session)${NC}" >&2
+    start_server
+    make_client_file small.file "$SMALL_OPS"
+    : > session.in
+    for _ in $(seq 1 "$SESSION_FILES"); do
+        echo "RUN small.file" >> session.in
+    done
+
+    local start end oneshot session
+    start=$(now_ms)
+    for _ in $(seq 1 "$SESSION_FILES"); do
+        ./BankClient small.file "$FIFO_NAME" > /dev/null
+    done
+    end=$(now_ms)
+    oneshot=$((end - start))
+
+    start=$(now_ms)
+    ./BankClient -s "$FIFO_NAME" < session.in > session.out
+    end=$(now_ms)
+    session=$((end - start))
+    stop_server
+
+    [ "$oneshot" -gt 0 ] || oneshot=1
+    [ "$session" -gt 0 ] || session=1
+    echo "session.files=$SESSION_FILES"
+    echo "session.oneshot_ms=$oneshot"
+    echo "session.session_ms=$session"
+    echo "session.oneshot_ms_per_file=$(awk -v t="$oneshot" -v n="$SESSION_FILES" 'BEGIN { printf "%.2f", t / n }')"
+    echo "session.session_ms_per_file=$(awk -v t="$session" -v n="$SESSION_FILES" 'BEGIN { printf "%.2f", t / n }')"
+    echo "session.answered=$(grep '^Session:' session.out | tr ' ' '\n' | grep '^answered=' | cut -d= -f2)"
+}
+
+case "$WORKLOAD" in
+    throughput) run_throughput ;;
+    fairness)   run_fairness ;;
+    scan)       run_scan ;;
+    audit)      run_audit ;;
+    startup)    run_startup ;;
+    iobackend)  run_iobackend ;;
+    session)    run_session ;;
+    all)        run_throughput; run_fairness; run_scan; run_audit; run_startup; run_iobackend; run_session ;;
+    *)
+        echo -e "${RED}Unknown workload: $WORKLOAD${NC}" >&2
+        exit 1
+        ;;
+esac
+
+echo -e "${GREEN}Benchmark complete.${NC}" >&2
@@ -0,0 +1,195 @@
+#!/bin/bash
+
+# Performance regression check for Bank Simulator
+# Runs a fixed set of benchmark workloads several times and compares the
+# medians with the committed baseline (perf_baseline.txt). A metric fails
+# when it is worse than the baseline by more than its tolerance, or by more
+# than the run-to-run noise of either side, whichever is larger.
+# The server workloads are bound by process creation, which varies a lot
+# between hosts and over time on a shared one, so their metrics are first
+# corrected by how fast this host spawns processes compared with the host
+# the baseline was measured on.
+#
+# Usage: ./perfcheck.sh [--update]
+#   --update   Measure and rewrite the baseline instead of checking it
+# Environment: RUNS (default 5), TOLERANCE_SCALE (multiplies every
+# tolerance, default 1), BASELINE (default perf_baseline.txt) and REPORT
+# (diff report file, default perfcheck_report.txt)
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+REPO_DIR=$(cd "$(dirname "$0")" && pwd)
+BASELINE=${BASELINE:-$REPO_DIR/perf_baseline.txt}
+REPORT=${REPORT:-$REPO_DIR/perfcheck_report.txt}
+RUNS=${RUNS:-5}
+TOLERANCE_SCALE=${TOLERANCE_SCALE:-1}
+WORK_DIR=$(mktemp -d /tmp/bank_perfcheck.XXXXXX)
+
+# Fixed workload sizes, so runs stay comparable with the baseline
+export BULK_OPS=500 SMALL_CLIENTS=8 SMALL_OPS=3 SESSION_FILES=100
+export AUDIT_RECORDS=200000 SCAN_ACCOUNTS=2000000
+export SERVER_ARGS=""
+
+WORKLOADS="throughput fairness session audit scan"
+
+# Checked metrics: name, which direction is better, tolerance in percent,
+# and whether the metric is corrected for the host's process spawn time
+METRICS="
+throughput.ops_per_sec higher 15 host
+throughput.p99_ms lower 25 host
+fairness.ops_per_sec higher 15 host
+fairness.small_p99_ms lower 30 host
+session.oneshot_ms_per_file lower 15 host
+session.session_ms_per_file lower 15 host
+audit.records_per_sec higher 10 -
+store.histogram_ms lower 25 -
+"
+CALIBRATION_SPAWNS=300
+
+cleanup() {
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+echo -e "${BLUE}Bank Simulator Performance Check${NC}"
+echo -e "${BLUE}================================${NC}"
+
+echo -e "${YELLOW}Compiling the project...${NC}"
+make -C "$REPO_DIR" all BankStoreBench > /dev/null
+if [ $? -ne 0 ]; then
+    echo -e "${RED}Compilation failed. Exiting.${NC}"
+    exit 1
+fi
+
+# Microseconds to fork and exec a trivial program on this host
+spawn_us() {
+    local start end
+    start=$(date +%s%N)
+    for _ in $(seq 1 "$CALIBRATION_SPAWNS"); do
+        /bin/true
+    done
+    end=$(date +%s%N)
+    echo $(( (end - start) / (CALIBRATION_SPAWNS * 1000) ))
+}
+
+# Collect "metric value" samples from every run
+: > "$WORK_DIR/samples"
+for run in $(seq 1 "$RUNS"); do
+    echo -e "${YELLOW}Run $run of $RUNS: $WORKLOADS${NC}"
+    echo "host.spawn_us $(spawn_us)" >> "$WORK_DIR/samples"
+    for workload in $WORKLOADS; do
+        "$REPO_DIR/bench.sh" "$workload" 2> /dev/null | tr '=' ' ' >> "$WORK_DIR/samples"
+    done
+done
+
+# Median and median absolute deviation of each checked metric
+summarize() {
+    { echo "host.spawn_us"; echo "$METRICS"; } | while read -r metric _; do
+        [ -n "$metric" ] || continue
+        grep "^$metric " "$WORK_DIR/samples" | awk '{ print $2 }' | sort -g | awk -v m="$metric" '
+            { v[NR] = $1 }
+            END {
+                if (NR == 0) { print m, "missing", "missing", 0; exit }
+                med = (NR % 2) ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2
+                for (i = 1; i <= NR; i++) { d[i] = v[i] > med ? v[i] - med : med - v[i] }
+                for (i = 2; i <= NR; i++) {
+                    x = d[i]
+                    for (j = i - 1; j >= 1 && d[j] > x; j--) { d[j + 1] = d[j] }
+                    d[j + 1] = x
+                }
+                mad = (NR % 2) ? d[(NR + 1) / 2] : (d[NR / 2] + d[NR / 2 + 1]) / 2
+                printf "%s %g %g %d\n", m, med, mad, NR
+            }'
+    done
+}
+summarize > "$WORK_DIR/current"
+
+if [ "$1" = "--update" ]; then
+    {
+        echo "# Baseline for ./perfcheck.sh: metric median mad runs"
+        echo "# Measured on $(uname -sr), $(nproc) CPU(s), $(date -u +%Y-%m-%d)"
+        cat "$WORK_DIR/current"
+    } > "$BASELINE"
+    echo -e "${GREEN}Baseline written to $BASELINE${NC}"
+    cat "$BASELINE"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo -e "${RED}No baseline at $BASELINE, run ./perfcheck.sh --update first.${NC}"
+    exit 1
+fi
+
+# How much slower this host spawns processes than the baseline host
+base_spawn=$(grep '^host.spawn_us ' "$BASELINE" | cut -d' ' -f2)
+cur_spawn=$(grep '^host.spawn_us ' "$WORK_DIR/current" | cut -d' ' -f2)
+host_factor=$(awk -v b="$base_spawn" -v c="$cur_spawn" 'BEGIN { printf "%.3f", (b > 0 && c > 0) ? c / b : 1 }')
+
+# Compare each metric with the baseline. The allowed change is the
+# metric's tolerance, or three times the larger of the two noise levels
+# (MAD scaled to a standard deviation) if the runs are noisier than that.
+echo "$METRICS" | while read -r metric better tolerance correct; do
+    [ -n "$metric" ] || continue
+    base=$(grep "^$metric " "$BASELINE" | cut -d' ' -f2-)
+    cur=$(grep "^$metric " "$WORK_DIR/current" | cut -d' ' -f2-)
+    echo "$metric $better $tolerance $correct ${base:-missing missing 0} $cur"
+done | awk -v scale="$TOLERANCE_SCALE" -v factor="$host_factor" '
+    BEGIN {
+        printf "%-28s %12s %12s %12s %9s %9s  %s\n", "metric", "baseline", "current", "corrected", 
+               "change", "allowed", "result"
+        failed = 0
+    }
+    {
+        metric = $1; better = $2; tol = $3 * scale; correct = $4
+        base = $5; baseMad = $6; cur = $8; curMad = $9
+        if (base == "missing" || cur == "missing") {
+            printf "%-28s %12s %12s %12s %9s %9s  %s\n", metric, base, cur, "-", "-", "-", "MISSING"
+            failed++
+            next
+        }
+        raw = cur
+        if (correct == "host") {
+            cur = better == "higher" ? cur * factor : cur / factor
+            curMad = better == "higher" ? curMad * factor : curMad / factor
+        }
+        change = base != 0 ? (cur - base) * 100 / base : 0
+        noise = 3 * 1.4826 * (baseMad > curMad ? baseMad : curMad)
+        allowed = base != 0 ? noise * 100 / base : 0
+        if (allowed < tol) allowed = tol
+        worse = better == "higher" ? -change : change
+        if (worse > allowed) {
+            result = "REGRESSED"
+            failed++
+        } else if (-worse > allowed) {
+            result = "improved"
+        } else {
+            result = "ok"
+        }
+        printf "%-28s %12g %12g %12g %+8.1f%% %8.1f%%  %s\n", metric, base, raw, cur, change, allowed, result
+    }
+    END {
+        print ""
+        if (failed > 0) {
+            printf "perfcheck: FAIL, %d of %d metrics regressed or missing\n", failed, NR
+            exit 1
+        }
+        printf "perfcheck: PASS, %d metrics within thresholds\n", NR
+    }' > "$REPORT"
+status=$?
+
+grep '^# Measured' "$BASELINE" | sed 's/^# /Baseline /' >> "$REPORT"
+echo "Current on $(uname -sr), $(nproc) CPU(s), $RUNS runs" >> "$REPORT"
+echo "Host spawn time ${cur_spawn}us against ${base_spawn}us, factor $host_factor applied to host-bound metrics" >> "$REPORT"
+cat "$REPORT"
+
+if [ $status -eq 0 ]; then
+    echo -e "${GREEN}No performance regressions.${NC}"
+else
+    echo -e "${RED}Performance regressions found, see $REPORT.${NC}"
+fi
+exit $status
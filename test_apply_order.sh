@@ -0,0 +1,133 @@
+#!/bin/bash
+
+# Apply order test for Bank Simulator
+# Runs the server in ready mode (-a ready), where each teller's request is
+# applied as soon as it is handed in, and sends batches of deposit and
+# withdraw pairs on one account. Every withdrawal only succeeds if the
+# deposit before it in the batch was applied first, so an operation
+# applied ahead of an earlier one on the same account shows up as a
+# failed withdrawal, and as a final balance that does not add up.
+#
+# BANK_FAULT=teller_stall makes the teller of one deposit hand its request
+# in late, so the tellers after it in its round report first; the server
+# must hold their requests back until the deposit is in.
+#
+# Usage: ./test_apply_order.sh
+# Environment: PAIRS (deposit/withdraw pairs per batch, default 30),
+# BATCHES (default 5) and SERVER_ARGS (extra server options)
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+PAIRS=${PAIRS:-30}
+BATCHES=${BATCHES:-5}
+INITIAL_BALANCE=10
+AMOUNT=100
+# Opening the account takes the first teller, so the sixth serves the
+# third deposit of the first batch. The first request of a batch may be
+# read, and run, in a round of its own; this one is always mid-round.
+STALL_TELLER=6
+
+REPO_DIR=$(cd "$(dirname "$0")" && pwd)
+TEST_DIR=$(mktemp -d /tmp/bank_order.XXXXXX)
+FIFO_NAME="OrderFIFO_$$"
+BANK=OrderBank
+LOG="$BANK.bankLog"
+SERVER_PID=""
+
+echo -e "${BLUE}Bank Simulator Apply Order Test${NC}"
+echo -e "${BLUE}===============================${NC}"
+
+echo -e "${YELLOW}Compiling the project...${NC}"
+make -C "$REPO_DIR" all > /dev/null
+if [ $? -ne 0 ]; then
+    echo -e "${RED}Compilation failed. Exiting.${NC}"
+    exit 1
+fi
+
+cp "$REPO_DIR/BankServer" "$REPO_DIR/BankClient" "$TEST_DIR/"
+cd "$TEST_DIR" || exit 1
+
+# The server is disowned so its exit is not reported as a job status
+wait_server() {
+    while kill -0 "$SERVER_PID" 2>/dev/null; do
+        sleep 0.05
+    done
+    SERVER_PID=""
+}
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill -KILL -- "-$SERVER_PID" 2>/dev/null
+        wait_server
+    fi
+    rm -f "/tmp/$FIFO_NAME" "/tmp/$FIFO_NAME.metrics"
+    rm -rf "$TEST_DIR"
+}
+trap cleanup EXIT
+
+# Start the server in its own session so its kill(0, SIGTERM) cannot reach us
+start_server() {
+    BANK_FAULT=teller_stall:$STALL_TELLER setsid ./BankServer -a ready $SERVER_ARGS "$BANK" "$FIFO_NAME" > server.out 2>&1 &
+    SERVER_PID=$!
+    disown "$SERVER_PID"
+    for _ in $(seq 1 100); do
+        grep -q '^Ready for requests' server.out && return 0
+        kill -0 "$SERVER_PID" 2>/dev/null || return 1
+        sleep 0.05
+    done
+    return 1
+}
+
+rm -f "$LOG" "/tmp/$FIFO_NAME"
+start_server || { echo -e "${RED}Server did not start.${NC}"; cat server.out; exit 1; }
+
+echo "N deposit $INITIAL_BALANCE" > open.file
+./BankClient open.file "$FIFO_NAME" > open.out
+account=$(grep -o 'BankID_[0-9]*' open.out | head -1)
+if [ -z "$account" ]; then
+    echo -e "${RED}Could not open the test account.${NC}"
+    exit 1
+fi
+
+: > pairs.file
+for _ in $(seq 1 "$PAIRS"); do
+    echo "$account deposit $AMOUNT" >> pairs.file
+    echo "$account withdraw $AMOUNT" >> pairs.file
+done
+
+failed=0
+for batch in $(seq 1 "$BATCHES"); do
+    ./BankClient pairs.file "$FIFO_NAME" > "batch$batch.out" 2>&1
+    wrong=$(grep -c 'WRONG' "batch$batch.out")
+    served=$(grep -c 'served\.\.' "batch$batch.out")
+    if [ "$wrong" -ne 0 ] || [ "$served" -ne $((2 * PAIRS)) ]; then
+        echo -e "${RED}Batch $batch: $served of $((2 * PAIRS)) operations served, $wrong failed${NC}"
+        grep 'WRONG' "batch$batch.out" | head -3
+        failed=$((failed + 1))
+    else
+        echo -e "${GREEN}Batch $batch: all $((2 * PAIRS)) operations served in order${NC}"
+    fi
+done
+
+echo "$account balance" > balance.file
+./BankClient balance.file "$FIFO_NAME" > balance.out
+balance=$(grep -o 'has [0-9]* credits' balance.out | grep -o '[0-9]*')
+if [ "$balance" != "$INITIAL_BALANCE" ]; then
+    echo -e "${RED}Final balance ${balance:-missing}, expected $INITIAL_BALANCE${NC}"
+    failed=$((failed + 1))
+fi
+
+kill -TERM "$SERVER_PID"
+wait_server
+
+if [ $failed -eq 0 ]; then
+    echo -e "${GREEN}Apply order test passed.${NC}"
+    exit 0
+fi
+echo -e "${RED}Apply order test failed.${NC}"
+exit 1
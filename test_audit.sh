@@ -0,0 +1,130 @@
+#!/bin/bash
+
+# Ledger audit test for Bank Simulator
+# Runs BankAudit on generated logs with shutdown dumps ("D 0 balance")
+# whose balances differ from what the records before them add up to.
+# A dump is a checkpoint: the audit must accept it and check the records
+# after it against the dumped balance, also when the log is split into
+# several chunks and a dump straddles a chunk boundary. Each log has a
+# twin whose records ignore the dump, which the audit must flag.
+#
+# Usage: ./test_audit.sh
+# Environment: RECORDS (records in the chunked log, default 80000)
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+RECORDS=${RECORDS:-80000}
+
+REPO_DIR=$(cd "$(dirname "$0")" && pwd)
+TEST_DIR=$(mktemp -d /tmp/bank_audit.XXXXXX)
+
+echo -e "${BLUE}Bank Simulator Ledger Audit Test${NC}"
+echo -e "${BLUE}================================${NC}"
+
+echo -e "${YELLOW}Compiling the project...${NC}"
+make -C "$REPO_DIR" all > /dev/null
+if [ $? -ne 0 ]; then
+    echo -e "${RED}Compilation failed. Exiting.${NC}"
+    exit 1
+fi
+
+cp "$REPO_DIR/BankAudit" "$TEST_DIR/"
+cd "$TEST_DIR" || exit 1
+trap 'rm -rf "$TEST_DIR"' EXIT
+
+failures=0
+
+# Audit a log with 4 workers and compare the number of divergent accounts
+check_audit() {
+    local name=$1 log=$2 expected=$3
+    local divergent
+    divergent=$(./BankAudit -j 4 "$log" | grep -o 'divergent=[0-9]*' | cut -d= -f2)
+    if [ "$divergent" = "$expected" ]; then
+        echo -e "${GREEN}$name: $expected divergent accounts, as expected${NC}"
+        return
+    fi
+    echo -e "${RED}$name: ${divergent:-no result} divergent accounts, expected $expected${NC}"
+    ./BankAudit -j 4 "$log" | grep 'diverges' | head -5
+    failures=$((failures + 1))
+}
+
+# BankID_01 is dumped with a balance its records never reached, BankID_02
+# is closed (not dumped) and opened again, BankID_03 carries on unchanged
+cat > dump.bankLog << 'EOF'
+BankID_01 D 100 100
+BankID_02 D 50 50
+BankID_03 D 30 30
+BankID_02 W 50 0
+# DumpBank Log file updated @12:00 October 18 2026
+
+BankID_01 D 0 70
+BankID_03 D 0 30
+
+## end of log.
+
+BankID_01 W 20 50
+BankID_02 D 40 40
+BankID_03 D 5 35
+EOF
+check_audit "Dump with a changed balance" dump.bankLog 0
+
+# The same, but BankID_01 carries on from its balance before the dump
+sed 's/^BankID_01 W 20 50$/BankID_01 W 20 80/' dump.bankLog > stale.bankLog
+check_audit "Record ignoring the dump" stale.bankLog 1
+
+# A long log of fixed-width records for 50 accounts, with a dump of every
+# account centred on each quarter of the file, where -j 4 splits it. Each
+# dump raises every balance by 7 unless shift is 0.
+generate_log() {
+    awk -v records="$RECORDS" -v shift="$1" 'BEGIN {
+        accounts = 50
+        # Output lines include the dumps (a header and a line per account)
+        lines = records + 3 * (accounts + 1)
+        for (q = 1; q <= 3; q++) {
+            dumpAt[int(lines * q / 4) - accounts / 2 - (q - 1) * (accounts + 1)] = 1
+        }
+        for (i = 0; i < records; i++) {
+            if (i in dumpAt) {
+                print "# ChunkBank Log file updated @12:00 October 18 2026"
+                for (a = 1; a <= accounts; a++) {
+                    if (a in bal) {
+                        printf "BankID_%02d D 0 %d\n", a, bal[a] + 7
+                        bal[a] += shift
+                    }
+                }
+            }
+            a = i % accounts + 1
+            if (!(a in bal)) {
+                bal[a] = 5000
+                printf "BankID_%02d D 5000 5000\n", a
+            } else if (up[a]) {
+                bal[a] -= 5
+                up[a] = 0
+                printf "BankID_%02d W 5 %d\n", a, bal[a]
+            } else {
+                bal[a] += 5
+                up[a] = 1
+                printf "BankID_%02d D 5 %d\n", a, bal[a]
+            }
+        }
+    }'
+}
+
+generate_log 7 > chunked.bankLog
+generate_log 0 > chunked_stale.bankLog
+chunks=$(./BankAudit -j 4 chunked.bankLog | grep -o 'in [0-9]* chunks')
+echo -e "${YELLOW}Chunked log: $(wc -l < chunked.bankLog) lines audited $chunks${NC}"
+check_audit "Dumps across chunk boundaries" chunked.bankLog 0
+check_audit "Records ignoring the dumps" chunked_stale.bankLog 50
+
+if [ $failures -eq 0 ]; then
+    echo -e "${GREEN}Ledger audit test passed.${NC}"
+    exit 0
+fi
+echo -e "${RED}Ledger audit test failed in $failures check(s).${NC}"
+exit 1
@@ -0,0 +1,306 @@
+#!/bin/bash
+
+# Crash recovery test for Bank Simulator
+# Runs a deposit/withdraw load, kills the server with SIGKILL at a random
+# point, restarts it and checks what it recovered from the log:
+#  - every acknowledged operation is in the recovered balances (operations
+#    that were sent but never acknowledged may or may not be)
+#  - no torn log record was applied: every record line is complete and the
+#    audit finds every account's balances consistent
+# It also reports how long the restarted server took to be ready and how
+# fast it replayed the log.
+#
+# The crash points come from the server's fault injection (BANK_FAULT):
+#   log_write     half way through writing log records (tears a record)
+#   log_append    after a record is buffered, before it is flushed
+#   teller_spawn  between forking two tellers of a round
+#   batch_apply   after a round is applied and logged, before any response
+#   batch_reply   after a round's responses went out
+#   timer         no fault, a plain SIGKILL at a random time
+#
+# Usage: ./test_crash_recovery.sh
+# Environment: ROUNDS (default 10), ACCOUNTS (load clients, one account
+# each, default 4), OPS (operations per client and round, default 200),
+# PRELOAD_RECORDS (records written to the log up front so the replay has
+# something to chew on, default 100000), SEED (for $RANDOM) and
+# SERVER_ARGS (extra server options, e.g. "-u" for io_uring)
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+ROUNDS=${ROUNDS:-10}
+ACCOUNTS=${ACCOUNTS:-4}
+OPS=${OPS:-200}
+PRELOAD_RECORDS=${PRELOAD_RECORDS:-100000}
+INITIAL_BALANCE=1000000
+RANDOM=${SEED:-$$}
+
+POINTS="log_write log_append teller_spawn batch_apply batch_reply timer"
+
+REPO_DIR=$(cd "$(dirname "$0")" && pwd)
+TEST_DIR=$(mktemp -d /tmp/bank_crash.XXXXXX)
+FIFO_NAME="CrashFIFO_$$"
+BANK=CrashBank
+LOG="$BANK.bankLog"
+SERVER_PID=""
+
+echo -e "${BLUE}Bank Simulator Crash Recovery Test${NC}"
+echo -e "${BLUE}==================================${NC}"
+
+echo -e "${YELLOW}Compiling the project...${NC}"
+make -C "$REPO_DIR" all > /dev/null
+if [ $? -ne 0 ]; then
+    echo -e "${RED}Compilation failed. Exiting.${NC}"
+    exit 1
+fi
+
+cp "$REPO_DIR/BankServer" "$REPO_DIR/BankClient" "$REPO_DIR/BankAudit" "$TEST_DIR/"
+cd "$TEST_DIR" || exit 1
+
+# The server runs as the leader of its own session, so the group also
+# takes the tellers a crashed server leaves behind
+kill_server_group() {
+    if [ -n "$SERVER_PID" ]; then
+        kill -KILL -- "-$SERVER_PID" 2>/dev/null
+        wait_server
+    fi
+}
+
+# The server is disowned so its SIGKILL is not reported as a job status;
+# the shell still reaps it
+wait_server() {
+    while kill -0 "$SERVER_PID" 2>/dev/null; do
+        sleep 0.05
+    done
+    SERVER_PID=""
+}
+
+cleanup() {
+    kill_server_group
+    rm -f "/tmp/$FIFO_NAME" "/tmp/$FIFO_NAME.metrics"
+    rm -rf "$TEST_DIR"
+}
+trap cleanup EXIT
+
+# Start the server, in its own session so its kill(0, SIGTERM) cannot reach
+# us, with an optional fault armed
+start_server() {
+    local fault=$1 out=$2
+    if [ -n "$fault" ]; then
+        BANK_FAULT=$fault setsid ./BankServer $SERVER_ARGS "$BANK" "$FIFO_NAME" > "$out" 2>&1 &
+    else
+        setsid ./BankServer $SERVER_ARGS "$BANK" "$FIFO_NAME" > "$out" 2>&1 &
+    fi
+    SERVER_PID=$!
+    disown "$SERVER_PID"
+    for _ in $(seq 1 100); do
+        grep -q '^Ready for requests' "$out" && return 0
+        kill -0 "$SERVER_PID" 2>/dev/null || return 1
+        sleep 0.05
+    done
+    return 1
+}
+
+stop_server() {
+    kill -TERM "$SERVER_PID" 2>/dev/null
+    wait_server
+}
+
+# Balances in the last shutdown dump of the log, "account balance" per line
+dumped_balances() {
+    awk '/^# / { delete bal } $1 ~ /^BankID_/ && $3 == 0 { bal[$1] = $4 }
+         END { for (id in bal) print id, bal[id] }' "$LOG"
+}
+
+# Lines that are neither headers, blank, server error lines nor complete records
+damaged_lines() {
+    grep -v -E '^(#.*|\[.*|)$|^BankID_[0-9]+ [DW] [0-9]+ -?[0-9]+$' "$LOG" | wc -l
+}
+
+# Random hit count for a fault point, within what one round of load passes.
+# A batch round applies up to 32 operations and logs one net record per
+# account it touched.
+fault_hit() {
+    case "$1" in
+        log_write|batch_apply|batch_reply) echo $(( RANDOM % 12 + 1 )) ;;
+        log_append) echo $(( RANDOM % (ACCOUNTS * OPS / 8 + 1) + 1 )) ;;
+        *) echo $(( RANDOM % (ACCOUNTS * OPS * 3 / 4 + 1) + 1 )) ;;
+    esac
+}
+
+# Median of the numbers on stdin, printed with the given format
+median() {
+    sort -g | awk -v fmt="$1" '{ v[NR] = $1 }
+        END { printf fmt "\n", NR == 0 ? 0 : (NR % 2) ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2 }'
+}
+
+# Open the accounts the load works on, then grow the log with records of
+# other accounts so the replay has a realistic amount of work
+rm -f "$LOG" "/tmp/$FIFO_NAME"
+start_server "" server.out || { echo -e "${RED}Server did not start.${NC}"; exit 1; }
+: > prime.file
+for a in $(seq 1 "$ACCOUNTS"); do
+    echo "N deposit $INITIAL_BALANCE" >> prime.file
+done
+./BankClient prime.file "$FIFO_NAME" > /dev/null
+stop_server
+awk -v n="$PRELOAD_RECORDS" -v first="$((ACCOUNTS + 1))" 'BEGIN {
+    srand(7)
+    for (i = 0; i < n; i++) {
+        id = first + int(rand() * 100)
+        amount = int(rand() * 100) + 1
+        balance[id] += amount
+        printf "BankID_%02d D %d %d\n", id, amount, balance[id]
+    }
+}' >> "$LOG"
+
+declare -a low high
+for a in $(seq 1 "$ACCOUNTS"); do
+    low[a]=$INITIAL_BALANCE
+    high[a]=$INITIAL_BALANCE
+    : > "load$a.file"
+    if [ $((a % 2)) -eq 1 ]; then
+        op=deposit
+    else
+        op=withdraw
+    fi
+    for _ in $(seq 1 "$OPS"); do
+        printf "BankID_%02d %s 1\n" "$a" "$op" >> "load$a.file"
+    done
+done
+
+failures=0
+crashes=0
+torn=0
+acked_total=0
+: > ready_ms
+: > replay_rate
+
+for round in $(seq 1 "$ROUNDS"); do
+    set -- $POINTS
+    shift $((RANDOM % $#))
+    point=$1
+    fault=""
+    if [ "$point" != timer ]; then
+        fault="$point:$(fault_hit "$point")"
+    fi
+
+    # Load, until the fault fires or the timer runs out
+    # A fault may also fire while the server starts up, before any load
+    if ! start_server "$fault" crash.out && ! grep -q '^Fault: crashing' crash.out; then
+        echo -e "${RED}Round $round: server did not start.${NC}"
+        failures=$((failures + 1))
+        break
+    fi
+    client_pids=""
+    for a in $(seq 1 "$ACCOUNTS"); do
+        stdbuf -oL ./BankClient "load$a.file" "$FIFO_NAME" > "load$a.out" 2>&1 &
+        client_pids="$client_pids $!"
+    done
+
+    if [ "$point" = timer ]; then
+        delay=$((RANDOM % 1000))
+        sleep "$(printf '0.%03d' "$delay")"
+    fi
+    while kill -0 "$SERVER_PID" 2>/dev/null && [ "$point" != timer ]; do
+        running=0
+        for pid in $client_pids; do
+            kill -0 "$pid" 2>/dev/null && running=1
+        done
+        [ $running -eq 1 ] || break
+        sleep 0.05
+    done
+    if grep -q '^Fault: crashing' crash.out; then
+        how="$fault"
+    elif [ "$point" = timer ]; then
+        how="SIGKILL after ${delay}ms"
+    else
+        how="$fault (not reached, SIGKILL after load)"
+    fi
+    kill -KILL "$SERVER_PID" 2>/dev/null
+    crashes=$((crashes + 1))
+
+    # Tellers still answer what they got; clients waiting on requests the
+    # server never read are stopped, which keeps their output
+    sleep 2
+    for pid in $client_pids; do
+        kill -TERM "$pid" 2>/dev/null
+    done
+    wait $client_pids 2>/dev/null
+    kill_server_group
+
+    # What each client saw acknowledged bounds what the log must hold
+    acked_round=0
+    for a in $(seq 1 "$ACCOUNTS"); do
+        acked=$(grep -c ' served\.\. ' "load$a.out")
+        acked_round=$((acked_round + acked))
+        if [ $((a % 2)) -eq 1 ]; then
+            low[a]=$((low[a] + acked))
+            high[a]=$((high[a] + OPS))
+        else
+            low[a]=$((low[a] - OPS))
+            high[a]=$((high[a] - acked))
+        fi
+    done
+    acked_total=$((acked_total + acked_round))
+
+    # Recover
+    records=$(grep -c '^BankID_' "$LOG")
+    start_server "" recover.out || { echo -e "${RED}Round $round: server did not recover.${NC}"; cat recover.out; failures=$((failures + 1)); break; }
+    stop_server
+    ready=$(grep '^Ready for requests' recover.out | sed -e 's/^Ready for requests //' -e 's/ms after launch$//')
+    replay=$(grep '^Replayed' recover.out | sed -e 's/.* in //' -e 's/ms$//')
+    echo "$ready" >> ready_ms
+    rate=$(awk -v r="$records" -v ms="$replay" 'BEGIN { printf "%.0f", (ms > 0) ? r * 1000 / ms : 0 }')
+    echo "$rate" >> replay_rate
+    dropped=$(grep 'torn record' recover.out | sed -e 's/.*dropped //' -e 's/ bytes$//')
+    [ -n "$dropped" ] && torn=$((torn + 1))
+
+    # Every acknowledged operation must be there
+    problems=""
+    dumped_balances > balances
+    for a in $(seq 1 "$ACCOUNTS"); do
+        id=$(printf "BankID_%02d" "$a")
+        balance=$(awk -v id="$id" '$1 == id { print $2 }' balances)
+        if [ -z "$balance" ] || [ "$balance" -lt "${low[a]}" ] || [ "$balance" -gt "${high[a]}" ]; then
+            problems="$problems $id=${balance:-missing} (expected ${low[a]}..${high[a]})"
+        else
+            low[a]=$balance
+            high[a]=$balance
+        fi
+    done
+
+    # No torn record applied: all record lines complete, all balances consistent
+    damaged=$(damaged_lines)
+    [ "$damaged" -eq 0 ] || problems="$problems $damaged damaged log lines"
+    divergent=$(./BankAudit "$LOG" | grep '^Audit:' | tr ' ' '\n' | grep '^divergent=' | cut -d= -f2)
+    [ "${divergent:-1}" -eq 0 ] || problems="$problems audit divergent=${divergent:-failed}"
+
+    summary="$how: $acked_round acked, ready ${ready}ms, replayed $records records in ${replay}ms"
+    [ -n "$dropped" ] && summary="$summary, dropped a torn record of $dropped bytes"
+    if [ -z "$problems" ]; then
+        echo -e "${GREEN}Round $round: $summary${NC}"
+    else
+        echo -e "${RED}Round $round: $summary; FAILED:$problems${NC}"
+        failures=$((failures + 1))
+    fi
+done
+
+echo "recovery.rounds=$ROUNDS"
+echo "recovery.crashes=$crashes"
+echo "recovery.torn_tails=$torn"
+echo "recovery.acked_ops=$acked_total"
+echo "recovery.ready_ms=$(median %.3f < ready_ms)"
+echo "recovery.replay_records_per_sec=$(median %.0f < replay_rate)"
+echo "recovery.failures=$failures"
+
+if [ $failures -eq 0 ]; then
+    echo -e "${GREEN}Crash recovery test passed: no acknowledged operation lost, no torn record applied.${NC}"
+    exit 0
+fi
+echo -e "${RED}Crash recovery test failed in $failures round(s).${NC}"
+exit 1
@@ -0,0 +1,162 @@
+#!/bin/bash
+
+# History index test for Bank Simulator
+# Makes tellers fail so the server writes "ERROR:" lines into the log
+# between records, then checks that BankHistory still reads exactly the
+# account's record lines:
+#  - while the server runs, from the offsets indexed live
+#  - after shutdown, once the index has caught up with the final dump
+#
+# A client is killed half way through a long batch; its response FIFOs
+# stay behind with nobody reading them, so the tellers answering it give
+# up and exit with a non-zero status.
+#
+# Usage: ./test_history.sh
+# Environment: OPS (operations in the batch that is cut short, default
+# 20000) and SERVER_ARGS (extra server options, e.g. "-u" for io_uring)
+
+# Colors for output
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[0;33m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+OPS=${OPS:-20000}
+
+REPO_DIR=$(cd "$(dirname "$0")" && pwd)
+TEST_DIR=$(mktemp -d /tmp/bank_history.XXXXXX)
+FIFO_NAME="HistoryFIFO_$$"
+BANK=HistoryBank
+LOG="$BANK.bankLog"
+ACCOUNT=BankID_01
+SERVER_PID=""
+client_pid=""
+
+echo -e "${BLUE}Bank Simulator History Index Test${NC}"
+echo -e "${BLUE}=================================${NC}"
+
+echo -e "${YELLOW}Compiling the project...${NC}"
+make -C "$REPO_DIR" all > /dev/null
+if [ $? -ne 0 ]; then
+    echo -e "${RED}Compilation failed. Exiting.${NC}"
+    exit 1
+fi
+
+cp "$REPO_DIR/BankServer" "$REPO_DIR/BankClient" "$REPO_DIR/BankHistory" "$TEST_DIR/"
+cd "$TEST_DIR" || exit 1
+
+# The server is disowned so its exit is not reported as a job status
+wait_server() {
+    while kill -0 "$SERVER_PID" 2>/dev/null; do
+        sleep 0.05
+    done
+    SERVER_PID=""
+}
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill -KILL -- "-$SERVER_PID" 2>/dev/null
+        wait_server
+    fi
+    # The killed client leaves its response FIFOs behind
+    [ -n "$client_pid" ] && rm -f /tmp/bank_cl_"$client_pid"_*
+    rm -f "/tmp/$FIFO_NAME" "/tmp/$FIFO_NAME.metrics"
+    rm -rf "$TEST_DIR"
+}
+trap cleanup EXIT
+
+# Start the server in its own session so its kill(0, SIGTERM) cannot reach us
+start_server() {
+    setsid ./BankServer $SERVER_ARGS "$BANK" "$FIFO_NAME" > server.out 2>&1 &
+    SERVER_PID=$!
+    disown "$SERVER_PID"
+    for _ in $(seq 1 100); do
+        grep -q '^Ready for requests' server.out && return 0
+        kill -0 "$SERVER_PID" 2>/dev/null || return 1
+        sleep 0.05
+    done
+    return 1
+}
+
+# The record lines BankHistory shows, without sequence number and time
+history_lines() {
+    ./BankHistory -n 1000000 "$BANK" "$ACCOUNT" | grep -v '^History:' | sed -E 's/^ *[0-9]+  .{19}  //'
+}
+
+# Compare the account's history with its record lines in the log
+check_history() {
+    local when=$1
+    history_lines > history.txt
+    grep "^$ACCOUNT " "$LOG" > expected.txt
+    if cmp -s history.txt expected.txt; then
+        echo -e "${GREEN}$when: history matches the log ($(wc -l < expected.txt) records)${NC}"
+        return 0
+    fi
+    echo -e "${RED}$when: history does not match the log${NC}"
+    diff expected.txt history.txt | head -10
+    return 1
+}
+
+failures=0
+rm -f "$LOG" "$BANK.bankIdx" "/tmp/$FIFO_NAME"
+start_server || { echo -e "${RED}Server did not start.${NC}"; cat server.out; exit 1; }
+
+echo "N deposit 1000" > open.file
+./BankClient open.file "$FIFO_NAME" > open.out
+
+# Cut a long batch short so its tellers fail
+: > load.file
+for _ in $(seq 1 "$OPS"); do
+    echo "$ACCOUNT deposit 1" >> load.file
+done
+./BankClient load.file "$FIFO_NAME" > load.out 2>&1 &
+client_pid=$!
+
+# Kill the client once the server has logged the first round of its
+# batch; the rounds after that still have tellers to answer it
+for _ in $(seq 1 200); do
+    [ "$(grep -c "^$ACCOUNT " "$LOG")" -gt 1 ] && break
+    sleep 0.05
+done
+kill -KILL "$client_pid" 2>/dev/null
+wait "$client_pid" 2>/dev/null
+client_status=$?
+if [ "$(grep -c "^$ACCOUNT " "$LOG")" -le 1 ]; then
+    echo -e "${RED}The server logged nothing of the client's batch within 10s.${NC}"
+    exit 1
+fi
+if [ "$client_status" -ne 137 ]; then
+    echo -e "${RED}The client finished its batch before it was killed (raise OPS).${NC}"
+    exit 1
+fi
+
+# Wait for the stranded tellers to give up, until no new error turns up
+errors=-1
+for _ in $(seq 1 30); do
+    count=$(grep -c 'ERROR: Teller' "$LOG")
+    [ "$count" -eq "$errors" ] && break
+    errors=$count
+    sleep 1
+done
+if [ "$errors" -eq 0 ]; then
+    echo -e "${RED}No teller failed after the client was killed.${NC}"
+    exit 1
+fi
+echo -e "${YELLOW}$errors teller error lines in the log${NC}"
+
+# Records written after the error lines must be found where they are
+echo "$ACCOUNT deposit 5" > after.file
+./BankClient after.file "$FIFO_NAME" > after.out
+check_history "Live" || failures=$((failures + 1))
+
+kill -TERM "$SERVER_PID"
+wait_server
+check_history "After shutdown" || failures=$((failures + 1))
+
+if [ $failures -eq 0 ]; then
+    echo -e "${GREEN}History index test passed.${NC}"
+    exit 0
+fi
+echo -e "${RED}History index test failed in $failures check(s).${NC}"
+exit 1
@@ -1,7 +1,14 @@
 #!/bin/bash
 
-# Semaphore leak test script for Bank Simulator
-# This script specifically tests for leaked semaphores
+# Semaphore test script for Bank Simulator
+# The server's locks live in an anonymous shared mapping, so it creates no
+# named semaphores and there is nothing left to leak or clean up. This
+# script stays as the check for that: it fails if any bank semaphore
+# (/dev/shm/sem.bank_*) exists after the server starts, while clients run
+# against it, after a graceful stop or after the server is killed with
+# SIGKILL.
+#
+# Usage: ./test_semaphore_leaks.sh
 
 # Colors for output
 RED='\033[0;31m'
@@ -10,220 +17,119 @@ YELLOW='\033[0;33m'
 BLUE='\033[0;34m'
 NC='\033[0m' # No Color
 
-echo -e "${BLUE}Bank Simulator Semaphore Leak Test${NC}"
-echo -e "${BLUE}=================================${NC}"
+REPO_DIR=$(cd "$(dirname "$0")" && pwd)
+TEST_DIR=$(mktemp -d /tmp/bank_sem.XXXXXX)
+FIFO_NAME="SemFIFO_$$"
+BANK=SemBank
+SERVER_PID=""
+
+echo -e "${BLUE}Bank Simulator Semaphore Test${NC}"
+echo -e "${BLUE}=============================${NC}"
 
-# Check if we have permission to check semaphores
 if [ ! -d "/dev/shm" ] || [ ! -r "/dev/shm" ]; then
-    echo -e "${RED}Cannot access /dev/shm - may need root permissions to check semaphores${NC}"
-    echo -e "${YELLOW}Continuing with limited semaphore testing...${NC}"
+    echo -e "${RED}Cannot read /dev/shm, where named semaphores would appear.${NC}"
+    exit 1
 fi
 
-# Clean up previous builds and test leftovers
-echo -e "${YELLOW}Cleaning up previous builds and test artifacts...${NC}"
-make clean
-make clean_fifos
-
-# Clean up any leftover semaphores
-echo -e "${YELLOW}Removing any leftover semaphores...${NC}"
-find /dev/shm -name "sem.bank_*" -delete 2>/dev/null
-
-# Compile the project
 echo -e "${YELLOW}Compiling the project...${NC}"
-make all
-
+make -C "$REPO_DIR" all > /dev/null
 if [ $? -ne 0 ]; then
-    echo -e "${RED}Compilation failed. Exiting tests.${NC}"
+    echo -e "${RED}Compilation failed. Exiting.${NC}"
     exit 1
 fi
 
-# Kill any running bank processes
-killall -9 BankServer BankClient 2>/dev/null
+cp "$REPO_DIR/BankServer" "$REPO_DIR/BankClient" "$REPO_DIR"/Client?.file "$TEST_DIR/"
+cd "$TEST_DIR" || exit 1
 
-# Function to count semaphores
-count_sems() {
-    SEM_COUNT=$(find /dev/shm -name "sem.bank_*" 2>/dev/null | wc -l)
-    echo $SEM_COUNT
+# The server is disowned so its exit is not reported as a job status
+wait_server() {
+    while kill -0 "$SERVER_PID" 2>/dev/null; do
+        sleep 0.05
+    done
+    SERVER_PID=""
 }
 
-# Create a directory for logs
-mkdir -p sem_logs
-
-# Test 1: Check semaphores during normal operation
-echo -e "\n${BLUE}Test 1: Check Semaphores During Normal Operation${NC}"
-
-# Count initial semaphores
-INITIAL_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Initial semaphore count: $INITIAL_SEM_COUNT${NC}"
-
-# Start server
-echo -e "${YELLOW}Starting server...${NC}"
-./BankServer AdaBank ServerFIFO_Name > sem_logs/server.log 2>&1 &
-SERVER_PID=$!
-sleep 2
-
-# Count semaphores after server start
-SERVER_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after server start: $SERVER_SEM_COUNT${NC}"
-echo -e "${YELLOW}List of semaphores after server start:${NC}"
-find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-
-# Run client1
-echo -e "${YELLOW}Running client1...${NC}"
-./BankClient Client1.file ServerFIFO_Name > sem_logs/client1.log 2>&1
-
-# Count semaphores after client1
-AFTER_CLIENT1_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after client1: $AFTER_CLIENT1_SEM_COUNT${NC}"
-echo -e "${YELLOW}List of semaphores after client1:${NC}"
-find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-
-# Run client2
-echo -e "${YELLOW}Running client2...${NC}"
-./BankClient Client2.file ServerFIFO_Name > sem_logs/client2.log 2>&1
-
-# Count semaphores after client2
-AFTER_CLIENT2_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after client2: $AFTER_CLIENT2_SEM_COUNT${NC}"
-echo -e "${YELLOW}List of semaphores after client2:${NC}"
-find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-
-# Run client3
-echo -e "${YELLOW}Running client3...${NC}"
-./BankClient Client3.file ServerFIFO_Name > sem_logs/client3.log 2>&1
-
-# Count semaphores after client3
-AFTER_CLIENT3_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after client3: $AFTER_CLIENT3_SEM_COUNT${NC}"
-echo -e "${YELLOW}List of semaphores after client3:${NC}"
-find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-
-# Kill server gracefully
-echo -e "${YELLOW}Terminating server...${NC}"
-kill -TERM $SERVER_PID
-wait $SERVER_PID 2>/dev/null
-sleep 1
-
-# Count semaphores after server termination
-AFTER_SERVER_TERM_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after server termination: $AFTER_SERVER_TERM_SEM_COUNT${NC}"
-if [ "$AFTER_SERVER_TERM_SEM_COUNT" -gt "$INITIAL_SEM_COUNT" ]; then
-    echo -e "${RED}Semaphore leak detected! $AFTER_SERVER_TERM_SEM_COUNT semaphores remain:${NC}"
-    find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-else
-    echo -e "${GREEN}No semaphore leak detected after normal operation${NC}"
-fi
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill -KILL -- "-$SERVER_PID" 2>/dev/null
+        wait_server
+    fi
+    rm -f "/tmp/$FIFO_NAME" "/tmp/$FIFO_NAME.metrics"
+    rm -rf "$TEST_DIR"
+}
+trap cleanup EXIT
+
+# Start the server in its own session so its kill(0, SIGTERM) cannot reach us
+start_server() {
+    setsid ./BankServer "$BANK" "$FIFO_NAME" > server.out 2>&1 &
+    SERVER_PID=$!
+    disown "$SERVER_PID"
+    for _ in $(seq 1 100); do
+        grep -q '^Ready for requests' server.out && return 0
+        kill -0 "$SERVER_PID" 2>/dev/null || return 1
+        sleep 0.05
+    done
+    return 1
+}
 
-# Clean up any leftover semaphores
-find /dev/shm -name "sem.bank_*" -delete 2>/dev/null
-
-# Test 2: Check semaphores after server crash
-echo -e "\n${BLUE}Test 2: Check Semaphores After Server Crash${NC}"
-
-# Count initial semaphores
-INITIAL_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Initial semaphore count: $INITIAL_SEM_COUNT${NC}"
-
-# Start server
-echo -e "${YELLOW}Starting server...${NC}"
-./BankServer AdaBank ServerFIFO_Name > sem_logs/server_crash.log 2>&1 &
-SERVER_PID=$!
-sleep 2
-
-# Count semaphores after server start
-SERVER_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after server start: $SERVER_SEM_COUNT${NC}"
-echo -e "${YELLOW}List of semaphores after server start:${NC}"
-find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-
-# Start a client
-echo -e "${YELLOW}Starting client...${NC}"
-./BankClient Client1.file ServerFIFO_Name > sem_logs/crash_client.log 2>&1 &
-CLIENT_PID=$!
-sleep 1
-
-# Force kill server
-echo -e "${YELLOW}Force killing server...${NC}"
-kill -9 $SERVER_PID
-sleep 1
-
-# Count semaphores after server crash
-AFTER_CRASH_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after server crash: $AFTER_CRASH_SEM_COUNT${NC}"
-if [ "$AFTER_CRASH_SEM_COUNT" -gt "$INITIAL_SEM_COUNT" ]; then
-    echo -e "${RED}Semaphore leak detected after crash! $AFTER_CRASH_SEM_COUNT semaphores remain:${NC}"
-    find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-else
-    echo -e "${GREEN}No semaphore leak detected after server crash${NC}"
-fi
+failures=0
+
+# Fail the check if any bank semaphore exists
+check_none() {
+    local when=$1
+    local sems
+    sems=$(find /dev/shm -name "sem.bank_*" 2>/dev/null | sort)
+    if [ -z "$sems" ]; then
+        echo -e "${GREEN}$when: no named semaphores${NC}"
+        return
+    fi
+    echo -e "${RED}$when: $(echo "$sems" | wc -l) named semaphore(s):${NC}"
+    echo "$sems"
+    failures=$((failures + 1))
+}
 
-# Kill client if still running
-kill -9 $CLIENT_PID 2>/dev/null
-
-# Clean up any leftover semaphores
-find /dev/shm -name "sem.bank_*" -delete 2>/dev/null
-
-# Test 3: Check semaphores during concurrent operations
-echo -e "\n${BLUE}Test 3: Check Semaphores During Concurrent Operations${NC}"
-
-# Count initial semaphores
-INITIAL_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Initial semaphore count: $INITIAL_SEM_COUNT${NC}"
-
-# Start server
-echo -e "${YELLOW}Starting server...${NC}"
-./BankServer AdaBank ServerFIFO_Name > sem_logs/server_concurrent.log 2>&1 &
-SERVER_PID=$!
-sleep 2
-
-# Start clients concurrently
-echo -e "${YELLOW}Starting clients concurrently...${NC}"
-./BankClient Client1.file ServerFIFO_Name > sem_logs/concurrent_client1.log 2>&1 &
-CLIENT1_PID=$!
-./BankClient Client2.file ServerFIFO_Name > sem_logs/concurrent_client2.log 2>&1 &
-CLIENT2_PID=$!
-./BankClient Client3.file ServerFIFO_Name > sem_logs/concurrent_client3.log 2>&1 &
-CLIENT3_PID=$!
-
-# Check semaphores during concurrent operation
-sleep 1
-DURING_CONCURRENT_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count during concurrent operations: $DURING_CONCURRENT_SEM_COUNT${NC}"
-echo -e "${YELLOW}List of semaphores during concurrent operations:${NC}"
-find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-
-# Wait for clients to finish
-wait $CLIENT1_PID 2>/dev/null
-wait $CLIENT2_PID 2>/dev/null
-wait $CLIENT3_PID 2>/dev/null
-sleep 2
-
-# Check semaphores after clients finish
-AFTER_CLIENTS_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after clients finish: $AFTER_CLIENTS_SEM_COUNT${NC}"
-echo -e "${YELLOW}List of semaphores after clients finish:${NC}"
-find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-
-# Kill server gracefully
-echo -e "${YELLOW}Terminating server...${NC}"
-kill -TERM $SERVER_PID
-wait $SERVER_PID 2>/dev/null
-sleep 1
-
-# Count semaphores after server termination
-AFTER_CONCURRENT_SEM_COUNT=$(count_sems)
-echo -e "${BLUE}Semaphore count after concurrent test: $AFTER_CONCURRENT_SEM_COUNT${NC}"
-if [ "$AFTER_CONCURRENT_SEM_COUNT" -gt "$INITIAL_SEM_COUNT" ]; then
-    echo -e "${RED}Semaphore leak detected! $AFTER_CONCURRENT_SEM_COUNT semaphores remain:${NC}"
-    find /dev/shm -name "sem.bank_*" 2>/dev/null | sort
-else
-    echo -e "${GREEN}No semaphore leak detected after concurrent test${NC}"
+# Servers built before the shared-memory locks left these behind
+stale=$(find /dev/shm -name "sem.bank_*" 2>/dev/null | wc -l)
+if [ "$stale" -ne 0 ]; then
+    echo -e "${YELLOW}Removing $stale semaphore(s) left by an older build...${NC}"
+    find /dev/shm -name "sem.bank_*" -delete 2>/dev/null
 fi
 
-# Clean up
-echo -e "${YELLOW}Final cleanup...${NC}"
-find /dev/shm -name "sem.bank_*" -delete 2>/dev/null
-make clean_fifos
-
-echo -e "\n${BLUE}Semaphore Leak Test Complete${NC}"
-echo -e "${YELLOW}Check sem_logs directory for detailed logs.${NC}"
\ No newline at end of file
+# Test 1: a server serving clients one after another, then stopped
+echo -e "\n${BLUE}Test 1: Sequential Clients and Graceful Stop${NC}"
+start_server || { echo -e "${RED}Server did not start.${NC}"; cat server.out; exit 1; }
+check_none "After server start"
+for client in 1 2 3; do
+    ./BankClient Client$client.file "$FIFO_NAME" > client$client.out 2>&1
+    check_none "After client$client"
+done
+kill -TERM "$SERVER_PID"
+wait_server
+check_none "After graceful stop"
+
+# Test 2: concurrent clients, then the server is killed under load
+echo -e "\n${BLUE}Test 2: Concurrent Clients and SIGKILL${NC}"
+start_server || { echo -e "${RED}Server did not start.${NC}"; cat server.out; exit 1; }
+client_pids=""
+for client in 1 2 3; do
+    ./BankClient Client$client.file "$FIFO_NAME" > concurrent$client.out 2>&1 &
+    client_pids="$client_pids $!"
+done
+sleep 0.2
+check_none "During concurrent clients"
+kill -KILL -- "-$SERVER_PID"
+wait_server
+check_none "After SIGKILL"
+# The killed clients leave their response FIFOs behind
+for pid in $client_pids; do
+    kill -KILL "$pid" 2>/dev/null
+    wait "$pid" 2>/dev/null
+    rm -f /tmp/bank_cl_"$pid"_*
+done
+
+if [ $failures -eq 0 ]; then
+    echo -e "\n${GREEN}Semaphore test passed: the server created no named semaphores.${NC}"
+    exit 0
+fi
+echo -e "\n${RED}Semaphore test failed in $failures check(s).${NC}"
+exit 1